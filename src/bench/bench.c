@@ -0,0 +1,367 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wayland-client.h>
+
+#include "exa-wayland.h"
+#include "host.h"
+#include "pixel.h"
+
+/* Microbenchmarks of client.c built natively (make bench). Results are ns/op and
+   allocations/op, the allocations being the mallocs done by client.c */
+
+#define BENCH_BATCH 32
+#define BENCH_BUFFER_SIZE 256 // width and height of the committed buffer
+
+void send_event(struct wl_proxy * proxy, uint32_t opcode, ...); // client.c, internal
+
+static struct wl_display * display;
+static struct wl_compositor * compositor;
+static struct wl_shm * shm;
+static struct wl_surface * surface;
+static struct wl_buffer * buffer;
+static int surface_id;
+
+static unsigned long nb_done = 0;
+
+static double now_ns(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long allocs(void) {
+
+  struct host_counters counters;
+
+  host_get_counters(&counters);
+
+  return counters.mallocs;
+}
+
+static void report(const char * name, unsigned long ops, double start, unsigned long start_allocs) {
+
+  double ns = now_ns() - start;
+
+  printf("%-44s %10.1f ns/op %8.3f allocs/op\n", name, ns / ops, (double)(allocs() - start_allocs) / ops);
+}
+
+static void registry_global(void * data, struct wl_registry * registry, uint32_t name, const char * interface, uint32_t version) {
+
+  if (strcmp(interface, wl_compositor_interface.name) == 0)
+    compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+  else if (strcmp(interface, wl_shm_interface.name) == 0)
+    shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+}
+
+static void registry_global_remove(void * data, struct wl_registry * registry, uint32_t name) {
+
+}
+
+static const struct wl_registry_listener registry_listener = {
+
+  registry_global,
+  registry_global_remove,
+};
+
+static void callback_done(void * data, struct wl_callback * callback, uint32_t time) {
+
+  ++nb_done;
+}
+
+static const struct wl_callback_listener callback_listener = {
+
+  callback_done,
+};
+
+// send_event + wl_display_roundtrip: queueing, wakeup and listener dispatch
+
+static void bench_send_event(unsigned long n) {
+
+  struct wl_callback * callback = wl_surface_frame(surface);
+
+  wl_callback_add_listener(callback, &callback_listener, NULL);
+
+  unsigned long start_allocs = allocs();
+  double start = now_ns();
+
+  for (unsigned long i = 0; i < n; i += BENCH_BATCH) {
+
+    for (int j = 0; j < BENCH_BATCH; ++j)
+      send_event((struct wl_proxy *)callback, 0, (uint32_t)j);
+
+    wl_display_roundtrip(display);
+  }
+
+  report("send_event + wl_display_roundtrip", n, start, start_allocs);
+
+  wl_callback_destroy(callback);
+
+  if (nb_done < n)
+    fprintf(stderr, "bench: %lu events dispatched out of %lu\n", nb_done, n);
+}
+
+// wl_proxy_marshal_flags, one request or a create/destroy pair per op
+
+static void step_damage_buffer(void) {
+
+  wl_surface_damage_buffer(surface, 0, 0, 64, 64);
+}
+
+static void step_attach(void) {
+
+  wl_surface_attach(surface, buffer, 0, 0);
+}
+
+/* A frame: the damaged rows are converted at commit, then the host renders it as the JS glue
+   would, releasing the buffer (its id is the one given to the recorded commit call) */
+
+static void step_commit(void) {
+
+  wl_surface_attach(surface, buffer, 0, 0);
+  wl_surface_damage_buffer(surface, 0, 0, 64, 64);
+  wl_surface_commit(surface);
+
+  const struct host_call * commit = host_get_call(0);
+
+  host_push_event(1, surface_id, (int)commit->args[1].i, 0); // buffer released
+  host_push_event(2, surface_id, 0, 0);                      // frame done
+
+  wl_display_dispatch(display);
+}
+
+static void step_frame(void) {
+
+  wl_callback_destroy(wl_surface_frame(surface));
+}
+
+static void step_create_surface(void) {
+
+  wl_surface_destroy(wl_compositor_create_surface(compositor));
+}
+
+static const struct {
+
+  const char * name;
+  void (*step)(void);
+  int shift; // run n >> shift times
+} marshal_steps[] = {
+
+  { "wl_surface.damage_buffer", step_damage_buffer, 0 },
+  { "wl_surface.attach", step_attach, 0 },
+  { "wl_surface.commit of a 256x256 buffer + render", step_commit, 6 },
+  { "wl_surface.frame + wl_callback.destroy", step_frame, 0 },
+  { "wl_compositor.create_surface + destroy", step_create_surface, 0 },
+};
+
+static void bench_marshal(unsigned long n) {
+
+  for (unsigned int i = 0; i < sizeof(marshal_steps)/sizeof(marshal_steps[0]); ++i) {
+
+    unsigned long ops = n >> marshal_steps[i].shift;
+
+    unsigned long start_allocs = allocs();
+    double start = now_ns();
+
+    for (unsigned long j = 0; j < ops; ++j)
+      marshal_steps[i].step();
+
+    report(marshal_steps[i].name, ops, start, start_allocs);
+  }
+}
+
+// wl_display_dispatch of a batch of JS records: pointer motions, one button every 8 records
+
+static void bench_dispatch(unsigned long n, int batch) {
+
+  char name[64];
+
+  unsigned long start_allocs = allocs();
+  double start = now_ns();
+
+  for (unsigned long i = 0; i < n; i += batch) {
+
+    for (int j = 0; j < batch; ++j) {
+
+      int ret = ((j & 7) == 7)?host_push_event(8, surface_id, j & 8, 0):host_push_event(9, surface_id, j << 8, j << 8);
+
+      if (ret < 0) { // no ring handed over, or not drained
+
+	fprintf(stderr, "bench_dispatch: cannot write in the event ring\n");
+	exit(1);
+      }
+    }
+
+    wl_display_dispatch(display);
+  }
+
+  snprintf(name, sizeof(name), "wl_display_dispatch, batch of %d", batch);
+
+  report(name, n, start, start_allocs);
+}
+
+// Pixel conversion of a 1920x1080 buffer, per kernel: the SIMD ones when built with -msimd128
+
+#define BENCH_FRAME_WIDTH 1920
+#define BENCH_FRAME_HEIGHT 1080
+
+static void bench_pixels(unsigned long n) {
+
+  static const struct {
+
+    const char * name;
+    enum pixel_kernel kernel;
+  } kernels[] = {
+
+    { "argb8888", PIXEL_KERNEL_ARGB8888 },
+    { "xrgb8888", PIXEL_KERNEL_XRGB8888 },
+    { "abgr8888", PIXEL_KERNEL_ABGR8888 },
+    { "xbgr8888", PIXEL_KERNEL_XBGR8888 },
+  };
+
+  char name[64];
+
+  uint8_t * src = (uint8_t *)malloc(BENCH_FRAME_WIDTH * BENCH_FRAME_HEIGHT * 4);
+  uint8_t * dst = (uint8_t *)malloc(BENCH_FRAME_WIDTH * BENCH_FRAME_HEIGHT * 4);
+
+  if (!src || !dst) {
+
+    free(src);
+    free(dst);
+    return;
+  }
+
+  // Translucent pixels every 8, as in a window with antialiased rounded corners
+
+  for (int i = 0; i < BENCH_FRAME_WIDTH * BENCH_FRAME_HEIGHT; ++i) {
+
+    src[i*4] = i;
+    src[i*4+1] = i >> 8;
+    src[i*4+2] = i >> 16;
+    src[i*4+3] = (i & 7)?255:(i & 0xff);
+  }
+
+  unsigned long frames = (n >> 12) + 1;
+
+  for (unsigned int i = 0; i < sizeof(kernels)/sizeof(kernels[0]); ++i) {
+
+    for (int scalar = 0; scalar < 2; ++scalar) {
+
+      pixel_row_kernel row = (scalar)?pixel_scalar_kernels[kernels[i].kernel]:pixel_kernels[kernels[i].kernel];
+
+      unsigned long start_allocs = allocs();
+      double start = now_ns();
+
+      for (unsigned long j = 0; j < frames; ++j) {
+
+	for (int y = 0; y < BENCH_FRAME_HEIGHT; ++y)
+	  row(dst + y * BENCH_FRAME_WIDTH * 4, src + y * BENCH_FRAME_WIDTH * 4, BENCH_FRAME_WIDTH);
+      }
+
+      snprintf(name, sizeof(name), "%s %s, 1920x1080 frame", (scalar)?"scalar":"pixel_convert", kernels[i].name);
+
+      report(name, frames, start, start_allocs);
+    }
+  }
+
+  // Tile change detection of an unchanged frame: every row compared
+
+  memcpy(dst, src, BENCH_FRAME_WIDTH * BENCH_FRAME_HEIGHT * 4);
+
+  unsigned long start_allocs = allocs();
+  double start = now_ns();
+  int equal = 0;
+
+  for (unsigned long j = 0; j < frames; ++j) {
+
+    for (int y = 0; y < BENCH_FRAME_HEIGHT; ++y)
+      equal += pixel_equal(dst + y * BENCH_FRAME_WIDTH * 4, src + y * BENCH_FRAME_WIDTH * 4, BENCH_FRAME_WIDTH * 4);
+  }
+
+  report("pixel_equal, 1920x1080 frame", frames, start, start_allocs);
+
+  if (equal != frames * BENCH_FRAME_HEIGHT)
+    fprintf(stderr, "bench: pixel_equal found %d equal rows out of %lu\n", equal, frames * BENCH_FRAME_HEIGHT);
+
+  free(src);
+  free(dst);
+}
+
+int main(int argc, char * argv[]) {
+
+  unsigned long n = 1000000;
+  int verbose = 0;
+
+  for (int i = 1; i < argc; ++i) {
+
+    if (strcmp(argv[i], "-v") == 0)
+      verbose = 1;
+    else
+      n = strtoul(argv[i], NULL, 0);
+  }
+
+  n = (n + 255) & ~255UL; // multiple of all the batch sizes
+
+  display = wl_display_connect(NULL);
+
+  struct wl_registry * registry = wl_display_get_registry(display);
+
+  wl_registry_add_listener(registry, &registry_listener, NULL);
+  wl_display_roundtrip(display);
+
+  if (!compositor || !shm) {
+
+    fprintf(stderr, "bench: no wl_compositor or wl_shm\n");
+    return 1;
+  }
+
+  surface = wl_compositor_create_surface(compositor);
+  surface_id = 1; // first canvas created by the host
+
+  // A translucent 256x256 buffer in shared memory, as Module['shm'] holds it
+
+  void * pixels;
+
+  int fd = host_shm_create(BENCH_BUFFER_SIZE * BENCH_BUFFER_SIZE * 4, &pixels);
+
+  if (fd < 0) {
+
+    fprintf(stderr, "bench: no shared memory below 4 GB\n");
+    return 1;
+  }
+
+  memset(pixels, 0x80, BENCH_BUFFER_SIZE * BENCH_BUFFER_SIZE * 4);
+
+  struct wl_shm_pool * pool = wl_shm_create_pool(shm, fd, BENCH_BUFFER_SIZE * BENCH_BUFFER_SIZE * 4);
+
+  buffer = wl_shm_pool_create_buffer(pool, 0, BENCH_BUFFER_SIZE, BENCH_BUFFER_SIZE, BENCH_BUFFER_SIZE * 4, WL_SHM_FORMAT_ARGB8888);
+  wl_shm_pool_destroy(pool);
+
+  bench_send_event(n);
+  bench_marshal(n);
+
+  bench_dispatch(n, 1);
+  bench_dispatch(n, 16);
+  bench_dispatch(n, 256);
+
+  bench_pixels(n);
+
+  if (verbose) {
+
+    host_dump_calls(stdout);
+    fflush(stdout);
+
+    exa_wayland_dump_stats(1);
+  }
+
+  wl_display_disconnect(display);
+
+  return 0;
+}
@@ -6,26 +6,94 @@
 #include <xdg-decoration-unstable-v1-client-protocol.h>
 #include <primary-selection-unstable-v1-client-protocol.h>
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef EXA_WAYLAND_THREADS
+#include <pthread.h>
+#endif
+
 #include <emscripten.h>
 
+#include "exa-wayland.h"
+#include "event-ring.h"
+#include "pixel.h"
+#include "region.h"
+
 #include <xkbcommon/xkbcommon-compose.h>
 
 #define printf(...)
 //#define emscripten_log(...)
 
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5 // protocol hot path: marshalling, commits, frames, xkb
+
+/* Messages above EXA_WAYLAND_LOG_LEVEL are compiled out, arguments included. Below it,
+   they are filtered at run time by log_level (EXA_WAYLAND_LOG_LEVEL environment variable) */
+
+#ifndef EXA_WAYLAND_LOG_LEVEL
+#define EXA_WAYLAND_LOG_LEVEL LOG_LEVEL_WARN
+#endif
+
+static int log_level = (EXA_WAYLAND_LOG_LEVEL < LOG_LEVEL_INFO)?EXA_WAYLAND_LOG_LEVEL:LOG_LEVEL_INFO;
+
+#define LOG(level, ...) do {						\
+    if ( ((level) <= EXA_WAYLAND_LOG_LEVEL) && ((level) <= log_level) )	\
+      emscripten_log(EM_LOG_CONSOLE, __VA_ARGS__);			\
+  } while (0)
+
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...)  LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...) LOG(LOG_LEVEL_TRACE, __VA_ARGS__)
+
+// Same for the JS glue: the statement is dropped from the string or guarded by Module['wayland'].logLevel
+
+#define JS_LOG(level, js) "if (Module['wayland'].logLevel >= " #level ") {" js "}"
+
+#if EXA_WAYLAND_LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define JS_LOG_DEBUG(js) JS_LOG(4, js)
+#else
+#define JS_LOG_DEBUG(js) ""
+#endif
+
+#if EXA_WAYLAND_LOG_LEVEL >= LOG_LEVEL_TRACE
+#define JS_LOG_TRACE(js) JS_LOG(5, js)
+#else
+#define JS_LOG_TRACE(js) ""
+#endif
+
 #define XDG_WM_BASE_VERSION 4
 #define WL_SEAT_VERSION     8
 
-#define NB_SURFACE_MAX 64
-#define EVENT_QUEUE_SIZE 64
-#define NB_CALLBACK_MAX 64
+#define EVENT_QUEUE_SIZE 64 // initial size, must be a power of two
+#define EVENT_QUEUE_SIZE_MAX 4096
+#define OBJECT_POOL_CHUNK 16 // objects allocated at once when a pool grows
+#define SURFACE_INDEX_SIZE 128 // initial size of the id -> wl_surface hash, power of two
+#define DAMAGE_RECTS_MAX 8 // boxes sent per commit, merged into their bounding box beyond
+#define CONVERT_THREADS_MAX 16
+#define CONVERT_QUEUE_SIZE 64 // bands, must be a power of two
+#define CONVERT_PIXELS_MIN (512 * 512) // smaller conversions stay on the main thread
+#define CONVERT_BAND_ROWS_MIN 32
+#define TILE_SIZE 64 // change detection of EXA_WAYLAND_TILE_DIFF
+
+#define NB_INTERFACE_MAX 32
+#define NB_EVENT_DESCRIPTOR_MAX 256
+#define NB_MESSAGE_COUNT_MAX 512 // request and event counters of all the interfaces
+
+#define EVENT_ARENA_SIZE 16384
+#define EVENT_ARENA_ALIGN 8
 
 #define KEYBOARD_RATE 20
 #define KEYBOARD_DELAY  500
@@ -34,6 +102,127 @@
 #define MOD_ALT_INDEX   2
 #define MOD_CTRL_INDEX  3
 
+#define EVENT_ARGS_MAX 10
+
+struct event_descriptor {
+
+  const char * types; // wire signature without the version prefix, e.g. "u?oa"
+  uint8_t nargs;
+};
+
+typedef struct wl_proxy * (*request_handler)(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap);
+
+struct request_table {
+
+  const struct wl_interface * interface;
+  const request_handler * handlers; // indexed by request opcode
+  uint32_t nb_handlers;
+};
+
+/* Typed listener calls generated from the protocol XMLs by gen-trampolines.py */
+
+typedef void (*event_trampoline)(void (*handler)(void), void * data, struct wl_proxy * proxy, const union wl_argument * args);
+
+struct event_trampoline_table {
+
+  const char * interface;
+  const event_trampoline * trampolines; // indexed by event opcode
+  uint32_t nb_trampolines;
+};
+
+struct interface_descriptor {
+
+  const struct wl_interface * interface;
+  struct event_descriptor * events;
+  const struct request_table * requests;
+  const struct event_trampoline_table * trampolines; // NULL for an interface unknown at build time
+  uint32_t * request_counts; // indexed by opcode
+  uint32_t * event_counts;
+};
+
+/* Counters that do not belong to the display, the queue or the pools */
+
+struct client_stats {
+
+  unsigned int js_calls;  // js_run
+  unsigned int js_events; // records read from the JS event ring
+  unsigned int ring_high_water;
+  unsigned int ring_refills;
+  unsigned int commits;   // with a buffer, i.e. sent to JS
+  unsigned int frame_callbacks;
+  unsigned int frames_done;
+  unsigned int buffers_released;
+  unsigned int rows_converted; // to RGBA, see pixel.h
+  unsigned int frames_unchanged; // found identical by the tile change detection
+  uint64_t upload_bytes_saved;   // in the tiles found unchanged
+};
+
+static struct client_stats client_stats;
+
+static int tile_diff = 0; // EXA_WAYLAND_TILE_DIFF, see surface_diff_tiles
+
+// Every call into the JS glue goes through js_run, so that they are counted. A macro as
+// emscripten_run_fun is variadic without a va_list variant to forward to
+
+#define js_run(...) (++client_stats.js_calls, emscripten_run_fun(__VA_ARGS__))
+
+#define TRACE_RECORDS_MAX 65536 // 1.5 MB, recording stops when full
+
+/* Optional timeline of the input to photon path (EXA_WAYLAND_TRACE). Times come from
+   performance.now() on both sides, stages are correlated by the index of the input record */
+
+enum trace_stage {
+
+  TRACE_INPUT = 0,  // produced by the JS glue
+  TRACE_DISPATCH,   // listeners called by wl_display_dispatch
+  TRACE_COMMIT,     // wl_surface.commit with a buffer
+  TRACE_RENDER,     // putImageData in Module['wayland'].render
+  TRACE_FRAME_DONE, // wl_callback.done sent
+};
+
+struct trace_record {
+
+  double ts;      // ms
+  float dur;      // ms, render only
+  uint8_t stage;
+  uint8_t type;   // JS event type of an input
+  int32_t surface;
+  uint32_t serial; // index of the input record answered, 0 if none
+};
+
+struct tracer {
+
+  struct trace_record * records; // NULL when tracing is off, record 0 is unused
+  unsigned int count;
+  unsigned int dropped;
+  uint32_t pending;    // first input not followed by a commit yet
+  uint32_t undispatched;
+};
+
+static struct tracer tracer;
+
+static uint32_t trace_mark(enum trace_stage stage, double ts, float dur, int surface, uint32_t serial, int type) {
+
+  if (tracer.count >= TRACE_RECORDS_MAX) {
+
+    ++tracer.dropped;
+    return 0;
+  }
+
+  struct trace_record * record = &tracer.records[tracer.count];
+
+  record->ts = ts;
+  record->dur = dur;
+  record->stage = stage;
+  record->type = type;
+  record->surface = surface;
+  record->serial = serial;
+
+  return tracer.count++;
+}
+
+#define TRACE_ENABLED() (tracer.records != NULL)
+
 struct wl_proxy {
 
   uint32_t version;
@@ -42,21 +231,121 @@ struct wl_proxy {
   void (**listeners)(void);
   const struct wl_interface * interface;
   char * const * tag;
+  const struct interface_descriptor * descriptor;
+  struct object_pool * pool; // NULL for the static objects
 };
 
+#define EVENT_INLINE_ARGS 6
+
+#define EVENT_FLAG_EXTERNAL_ARGS 0x01
+
+/* 32 bytes on wasm32: two records per cache line. Arguments are stored inline,
+   only strings, arrays and signatures longer than EVENT_INLINE_ARGS live in the arena */
+
 struct event {
 
   struct wl_proxy * proxy;
-  char name[128];
-  void * args;
+  uint16_t opcode;
+  uint8_t nargs;
+  uint8_t flags;
+  union {
+    union wl_argument args[EVENT_INLINE_ARGS];
+    union wl_argument * external_args;
+  };
+};
+
+_Static_assert((sizeof(void *) != 4) || (sizeof(struct event) == 32), "struct event should be 32 bytes on wasm32");
+
+static inline union wl_argument * event_args(struct event * event) {
+
+  return (event->flags & EVENT_FLAG_EXTERNAL_ARGS)?event->external_args:event->args;
+}
+
+/* Protocol objects are allocated from pools that grow by chunks, so that pointers
+   stay valid. Free objects are linked through their first word */
+
+struct object_pool {
+
+  const char * name;
+  size_t object_size;
+  void * free_list;
+  unsigned int capacity;
+  unsigned int in_use;
+  unsigned int high_water;
+  unsigned int allocs;
+  unsigned int chunks; // calloc calls
+};
+
+enum object_pool_id {
+
+  OBJECT_POOL_SURFACE = 0,
+  OBJECT_POOL_XDG_SURFACE,
+  OBJECT_POOL_XDG_TOPLEVEL,
+  OBJECT_POOL_CALLBACK,
+  OBJECT_POOL_SHM_POOL,
+  OBJECT_POOL_BUFFER,
+  OBJECT_POOL_REGION,
+  NB_OBJECT_POOLS,
+};
+
+struct event_arena_chunk {
+
+  struct event_arena_chunk * next;
+  size_t size;
+  size_t used;
+};
+
+struct event_arena {
+
+  char * base;
+  size_t size;
+  size_t used;
+  struct event_arena_chunk * chunks; // overflow, folded into base at next reset
+
+  size_t in_use;
+  size_t high_water;
+  unsigned int allocs;      // served by the arena
+  unsigned int heap_allocs; // malloc calls done by the arena itself
+  unsigned int resets;
+};
+
+enum event_queue_policy {
+
+  EVENT_QUEUE_POLICY_GROW = 0,    // double the queue up to its maximum size
+  EVENT_QUEUE_POLICY_COALESCE,    // merge a pointer motion into the latest queued one
+  EVENT_QUEUE_POLICY_DROP_MOTION, // drop the oldest queued pointer motion
+  EVENT_QUEUE_POLICY_DISPATCH,    // dispatch pending events before queuing
+};
+
+struct event_queue_stats {
+
+  unsigned int high_water;
+  unsigned int overflows; // queue found full
+  unsigned int grows;
+  unsigned int coalesced;
+  unsigned int dropped_motions;
+  unsigned int dispatched;
+  unsigned int lost;      // nothing could be done, event not queued
+  unsigned int wakeups;   // readiness notifications scheduled in JS
+  unsigned int wakeups_coalesced;
+  unsigned int merged_motions; // folded into the pointer frame by wl_display_dispatch
+  unsigned int merged_axes;
 };
 
 struct wl_display {
 
   struct wl_proxy proxy;
-  struct event event_queue[EVENT_QUEUE_SIZE];
-  int head;
-  int tail;
+  struct event * event_queue;
+  unsigned int queue_size;
+  unsigned int queue_size_max;
+  enum event_queue_policy queue_policy;
+  struct event_queue_stats queue_stats;
+  unsigned int head;
+  unsigned int tail;
+  int dispatch_depth;
+  int marshal_depth; // in a request handler, which may queue events for proxies without listeners yet
+  int wakeup_armed; // a notif_select is pending in JS, cleared once the queue is drained
+  struct event_arena arena;
 };
 
 struct wl_registry {
@@ -89,11 +378,22 @@ struct wl_shm_pool {
 struct wl_buffer {
 
   struct wl_proxy proxy;
+  int id;                     // names the buffer in the JS requests and release events
   int width;
   int height;
   int stride;
   int format;
-  int fd;
+  int fd;                     // of the pool
+  int offset;                 // in the pool
+  int invalid;                // out of its pool, never read nor committed
+  unsigned int busy;          // commits not released yet
+  struct wl_buffer * busy_next;
+  uint8_t * rgba;             // converted pixels drawn by JS, packed
+  int converted;              // rgba holds every row of the buffer
+  enum pixel_kernel kernel;   // last conversion, opaque surfaces skip alpha
+  uint32_t seq;               // commits of the buffer
+  uint32_t ready;             // seq of the last commit whose rgba is complete, read by JS
+  int bands;                  // queued or running in the convert pool
 };
 
 struct xdg_wm_base {
@@ -112,10 +412,37 @@ struct wl_keyboard {
   uint32_t serial;
 };
 
+// Pointer events gathered during one wl_display_dispatch batch
+
+struct pointer_frame {
+
+  int motion;
+  wl_fixed_t x, y;  // latest position
+  int axis;
+  wl_fixed_t dx, dy; // summed wheel deltas
+  int pending;      // events sent since the last wl_pointer.frame
+};
+
 struct wl_pointer {
 
   struct wl_proxy proxy;
   uint32_t serial;
+  struct pointer_frame frame;
+};
+
+/* Buffer damage accumulated until the next commit, as a region so overlapping or adjacent
+   rectangles end up as the fewest boxes. No damage means the whole buffer */
+
+struct damage {
+
+  struct region region;
+  int unchanged;        // nothing to draw, see surface_diff_tiles
+};
+
+struct wl_region {
+
+  struct wl_proxy proxy;
+  struct region region;
 };
 
 struct wl_surface {
@@ -123,12 +450,27 @@ struct wl_surface {
   struct wl_proxy proxy;
   int id;
   struct wl_buffer * buffer;
+  struct wl_buffer * converted_buffer;  // whose rgba holds the last frame, damage is relative to it
+  struct xdg_surface * xdg_surface;     // role, if any
+  struct wl_callback * frame_callbacks; // pending, in request order
+  uint32_t trace_input;                 // input answered by the next render, see tracer
+  struct damage damage;
+  int width, height;                    // of the last committed buffer
+  unsigned int commits_pending;         // not rendered yet, JS merges their damage
+  int pending_y0, pending_y1;           // rows damaged by the pending commits
+  struct region opaque_region;          // applied at commit, as it is only read there
+  struct region input_region;
+  int input_set;                        // input_region applies, else the whole surface takes input
+  int input_changed;                    // sent to JS at the next commit
+  uint8_t * shadow;                     // pixels of the last frame, for EXA_WAYLAND_TILE_DIFF
+  int shadow_width, shadow_height;
 };
 
 struct xdg_surface {
 
   struct wl_proxy proxy;
   struct wl_surface * wl_surface;
+  struct xdg_toplevel * xdg_toplevel;
 };
 
 struct zxdg_decoration_manager_v1 {
@@ -154,6 +496,7 @@ struct wl_callback {
 
   struct wl_proxy proxy;
   struct wl_surface * wl_surface;
+  struct wl_callback * next; // in the surface pending list, or in the free list
 };
 
 struct xkb_keymap {
@@ -226,6 +569,8 @@ struct zwp_primary_selection_offer_v1 {
   struct zwp_primary_selection_device_v1 * device;
 };
 
+static struct event event_queue_storage[EVENT_QUEUE_SIZE];
+
 static struct wl_display display = {
 
   .proxy = {
@@ -234,3325 +579,5814 @@ static struct wl_display display = {
     .wl_display = NULL,
     .interface = &wl_display_interface,
   },
+  .event_queue = event_queue_storage,
+  .queue_size = EVENT_QUEUE_SIZE,
+  .queue_size_max = EVENT_QUEUE_SIZE_MAX,
+  .queue_policy = EVENT_QUEUE_POLICY_GROW,
 };
 
+static struct js_event_ring js_event_ring = {
 
-static struct wl_surface surfaces[NB_SURFACE_MAX];
-static struct xdg_surface xdg_surfaces[NB_SURFACE_MAX];
-static struct xdg_toplevel xdg_toplevels[NB_SURFACE_MAX];
+  .size = JS_EVENT_RING_SIZE,
+};
 
-static struct wl_shm_pool wl_shm_pools[16];
-static struct wl_buffer wl_buffers[16];
 
-static struct wl_callback frame_callbacks[NB_CALLBACK_MAX];
+#define OBJECT_POOL(type) { #type, sizeof(struct type), NULL, 0, 0, 0, 0, 0 }
 
-static struct xkb_keymap keymap;
+static struct object_pool object_pools[NB_OBJECT_POOLS] = {
 
-static struct xkb_compose_table kbd_compose_table;
-static struct xkb_state kbd_state;
-static struct xkb_compose_state kbd_compose_state;
+  [OBJECT_POOL_SURFACE] = OBJECT_POOL(wl_surface),
+  [OBJECT_POOL_XDG_SURFACE] = OBJECT_POOL(xdg_surface),
+  [OBJECT_POOL_XDG_TOPLEVEL] = OBJECT_POOL(xdg_toplevel),
+  [OBJECT_POOL_CALLBACK] = OBJECT_POOL(wl_callback),
+  [OBJECT_POOL_SHM_POOL] = OBJECT_POOL(wl_shm_pool),
+  [OBJECT_POOL_BUFFER] = OBJECT_POOL(wl_buffer),
+  [OBJECT_POOL_REGION] = OBJECT_POOL(wl_region),
+};
 
-static struct wl_cursor_theme cursor_theme;
+static int object_pool_grow(struct object_pool * pool, unsigned int count) {
 
-static xkb_keysym_t latest_keysym;
+  char * chunk = (char *)calloc(count, pool->object_size);
 
-struct args_usu {
+  if (!chunk)
+    return -1;
 
-  uint32_t arg1;
-  char arg2[512];
-  uint32_t arg3;
-};
+  // Chunks are never freed, objects only go back to the free list
 
-struct args_uhu {
+  for (int i = count-1; i >= 0; --i) {
 
-  uint32_t arg1;
-  int32_t arg2;
-  uint32_t arg3;
-};
+    *(void **)(chunk + i * pool->object_size) = pool->free_list;
+    pool->free_list = chunk + i * pool->object_size;
+  }
 
-struct args_u {
+  pool->capacity += count;
+  ++pool->chunks;
 
-  uint32_t arg1;
-};
+  return 0;
+}
 
-struct args_iia {
-  
-  int32_t arg1;
-  int32_t arg2;
-  void * arg3;
-};
+static struct wl_proxy * object_pool_alloc(enum object_pool_id id, const struct wl_interface * interface) {
 
-struct args_uuuu {
+  struct object_pool * pool = &object_pools[id];
 
-  uint32_t arg1;
-  uint32_t arg2;
-  uint32_t arg3;
-  uint32_t arg4;
-};
+  if (!pool->free_list && (object_pool_grow(pool, OBJECT_POOL_CHUNK) < 0)) {
 
-struct args_ii {
+    LOG_ERROR("object_pool_alloc: cannot grow %s pool (%u objects)", pool->name, pool->capacity);
+    return NULL;
+  }
 
-  int32_t arg1;
-  int32_t arg2;
-};
+  struct wl_proxy * proxy = (struct wl_proxy *)pool->free_list;
 
-struct args_uuuuu {
+  pool->free_list = *(void **)proxy;
 
-  uint32_t arg1;
-  uint32_t arg2;
-  uint32_t arg3;
-  uint32_t arg4;
-  uint32_t arg5;
-};
+  memset(proxy, 0, pool->object_size);
 
-struct args_uuf {
+  proxy->wl_display = &display;
+  proxy->interface = interface;
+  proxy->pool = pool;
 
-  uint32_t arg1;
-  uint32_t arg2;
-  int32_t arg3;
-};
+  ++pool->allocs;
 
-struct args_uff {
+  if (++pool->in_use > pool->high_water)
+    pool->high_water = pool->in_use;
 
-  uint32_t arg1;
-  int32_t arg2;
-  int32_t arg3;
-};
+  return proxy;
+}
 
-struct args_iiiiissi {
+static void object_pool_free(struct wl_proxy * proxy) {
 
-  int32_t arg1;
-  int32_t arg2;
-  int32_t arg3;
-  int32_t arg4;
-  int32_t arg5;
-  char * arg6;
-  char * arg7;
-  int32_t arg8;
-};
+  struct object_pool * pool = proxy->pool;
 
-struct args_uiii {
+  /* Internal pointers to the object (surface->buffer, the busy list, callback->wl_surface, ...)
+     are cleared by wl_proxy_destroy before this. The NULL interface only guards the client's
+     own stale proxies, ignored by wl_proxy_marshal_flags, and the surface commit check */
 
-  uint32_t arg1;
-  int32_t arg2;
-  int32_t arg3;
-  int32_t arg4;
-};
+  proxy->interface = NULL;
+  proxy->pool = NULL;
 
-struct args_uoff {
+  *(void **)proxy = pool->free_list;
+  pool->free_list = proxy;
 
-  uint32_t arg1;
-  void * arg2;
-  int32_t arg3;
-  int32_t arg4;
-};
+  --pool->in_use;
+}
 
-struct args_uo {
+const char * exa_wayland_get_pool_stats(int index, unsigned int * in_use, unsigned int * capacity, unsigned int * high_water) {
 
-  uint32_t arg1;
-  void * arg2;
-};
+  if ( (index < 0) || (index >= NB_OBJECT_POOLS) )
+    return NULL;
 
-struct args_uoa {
+  *in_use = object_pools[index].in_use;
+  *capacity = object_pools[index].capacity;
+  *high_water = object_pools[index].high_water;
 
-  uint32_t arg1;
-  void * arg2;
-  void * arg3;
-};
+  return object_pools[index].name;
+}
 
-struct args_n {
+// Surface ids come from the JS canvas list, open addressing with linear probing
 
-  void * arg1;
-};
+static struct wl_surface ** surface_index;
+static unsigned int surface_index_size;
+static unsigned int surface_index_count;
 
-struct args_s {
+static void surface_index_insert(struct wl_surface * surface) {
 
-  char * arg1;
-};
+  unsigned int slot = (unsigned int)surface->id & (surface_index_size - 1);
 
-struct args_sh {
-  
-  char * arg1;
-  uint32_t arg2;
-};
+  while (surface_index[slot])
+    slot = (slot + 1) & (surface_index_size - 1);
 
-void send_event(struct wl_proxy * proxy, const char * name, ...) {
+  surface_index[slot] = surface;
+}
 
-  //emscripten_log(EM_LOG_CONSOLE, "send_event: %s (%d %d)\n", name, display.head, display.tail);
+static int surface_index_add(struct wl_surface * surface) {
 
-  
+  // Kept at most half full
 
-  display.event_queue[display.head].proxy = proxy;
-  strcpy(display.event_queue[display.head].name, name);
-  
-  va_list ap;
+  if ((surface_index_count + 1) * 2 > surface_index_size) {
 
-  va_start(ap, name);
+    struct wl_surface ** old_index = surface_index;
+    unsigned int old_size = surface_index_size;
 
-  struct wl_interface * interface = proxy->interface;
+    unsigned int size = (old_size > 0)?old_size*2:SURFACE_INDEX_SIZE;
 
-  int i = 0;
+    struct wl_surface ** index = (struct wl_surface **)calloc(size, sizeof(struct wl_surface *));
 
-  for (;i < interface->event_count; ++i) {
+    if (!index)
+      return -1;
 
-    if (strcmp(interface->events[i].name, name) == 0) {
+    surface_index = index;
+    surface_index_size = size;
 
-      int offset = 0;
+    for (unsigned int i = 0; i < old_size; ++i) {
 
-	//Signature starts by the minimum version, so we skip it
-	
-	while ( (interface->events[i].signature[offset] >= '0') && (interface->events[i].signature[offset] <= '9') )
-	  ++offset;
+      if (old_index[i])
+	surface_index_insert(old_index[i]);
+    }
 
-      if (strcmp(interface->events[i].signature+offset, "usu") == 0) {
+    free(old_index);
+  }
 
-	struct args_usu * args = (struct args_usu *)malloc(sizeof(struct args_usu));
+  surface_index_insert(surface);
 
-	display.event_queue[display.head].args = args;
+  ++surface_index_count;
 
-	args->arg1 = va_arg(ap, uint32_t);
-	strcpy(args->arg2, va_arg(ap, const char *));
-	args->arg3 = va_arg(ap, uint32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "u") == 0) {
+  return 0;
+}
 
-	struct args_u * args = (struct args_u *)malloc(sizeof(struct args_u));
+static void surface_index_remove(struct wl_surface * surface) {
 
-	display.event_queue[display.head].args = args;
+  if (!surface_index_size)
+    return;
 
-	args->arg1 = va_arg(ap, uint32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "iia") == 0) {
+  unsigned int mask = surface_index_size - 1;
+  unsigned int slot = (unsigned int)surface->id & mask;
 
-	struct args_iia * args = (struct args_iia *)malloc(sizeof(struct args_iia));
+  while (surface_index[slot] && (surface_index[slot] != surface))
+    slot = (slot + 1) & mask;
 
-	display.event_queue[display.head].args = args;
+  if (!surface_index[slot])
+    return;
 
-	args->arg1 = va_arg(ap, int32_t);
-	args->arg2 = va_arg(ap, int32_t);
-	args->arg3 = va_arg(ap, void *);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uhu") == 0) {
+  surface_index[slot] = NULL;
 
-	struct args_uhu * args = (struct args_uhu *)malloc(sizeof(struct args_uhu));
+  --surface_index_count;
 
-	display.event_queue[display.head].args = args;
+  // Backward shift: move up the entries of the cluster that were probed past the hole
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, int32_t);
-	args->arg3 = va_arg(ap, uint32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uuuu") == 0) {
+  unsigned int hole = slot;
 
-	struct args_uuuu * args = (struct args_uuuu *)malloc(sizeof(struct args_uuuu));
+  for (slot = (slot + 1) & mask; surface_index[slot]; slot = (slot + 1) & mask) {
 
-	display.event_queue[display.head].args = args;
+    unsigned int home = (unsigned int)surface_index[slot]->id & mask;
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, uint32_t);
-	args->arg3 = va_arg(ap, uint32_t);
-	args->arg4 = va_arg(ap, uint32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "ii") == 0) {
+    if ( ((slot - home) & mask) >= ((slot - hole) & mask) ) {
 
-	struct args_ii * args = (struct args_ii *)malloc(sizeof(struct args_ii));
+      surface_index[hole] = surface_index[slot];
+      surface_index[slot] = NULL;
+      hole = slot;
+    }
+  }
+}
 
-	display.event_queue[display.head].args = args;
+static inline struct wl_surface * surface_from_id(int id) {
 
-	args->arg1 = va_arg(ap, int32_t);
-	args->arg2 = va_arg(ap, int32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uuuuu") == 0) {
+  if (!surface_index_size)
+    return NULL;
 
-	struct args_uuuuu * args = (struct args_uuuuu *)malloc(sizeof(struct args_uuuu));
+  unsigned int slot = (unsigned int)id & (surface_index_size - 1);
 
-	display.event_queue[display.head].args = args;
+  while (surface_index[slot]) {
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, uint32_t);
-	args->arg3 = va_arg(ap, uint32_t);
-	args->arg4 = va_arg(ap, uint32_t);
-	args->arg5 = va_arg(ap, uint32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uuf") == 0) {
+    if (surface_index[slot]->id == id)
+      return surface_index[slot];
 
-	struct args_uuf * args = (struct args_uuf *)malloc(sizeof(struct args_uuf));
+    slot = (slot + 1) & (surface_index_size - 1);
+  }
 
-	display.event_queue[display.head].args = args;
+  return NULL;
+}
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, uint32_t);
-	args->arg3 = va_arg(ap, int32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uff") == 0) {
+/* Buffers committed and not released by the render yet. A client double or triple
+   buffering has at most a few of them, so a list is enough */
 
-	struct args_uff * args = (struct args_uff *)malloc(sizeof(struct args_uff));
+static struct wl_buffer * busy_buffers;
+static int next_buffer_id = 1;
 
-	display.event_queue[display.head].args = args;
+static void buffer_set_busy(struct wl_buffer * buffer) {
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, int32_t);
-	args->arg3 = va_arg(ap, int32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "iiiiissi") == 0) {
+  if (buffer->busy++ == 0) {
 
-	struct args_iiiiissi * args = (struct args_iiiiissi *)malloc(sizeof(struct args_iiiiissi));
+    buffer->busy_next = busy_buffers;
+    busy_buffers = buffer;
+  }
+}
 
-	display.event_queue[display.head].args = args;
+static void buffer_unlink_busy(struct wl_buffer * buffer) {
 
-	args->arg1 = va_arg(ap, int32_t);
-	args->arg2 = va_arg(ap, int32_t);
-	args->arg3 = va_arg(ap, int32_t);
-	args->arg4 = va_arg(ap, int32_t);
-	args->arg5 = va_arg(ap, int32_t);
+  struct wl_buffer ** link = &busy_buffers;
 
-	char * s1 = va_arg(ap, char *);
+  while (*link && (*link != buffer))
+    link = &(*link)->busy_next;
 
-	if (s1) {
-	  args->arg6 = malloc(strlen(s1)+1);
-	  strcpy(args->arg6, s1);
+  if (*link)
+    *link = buffer->busy_next;
 
-	}
-	else {
+  buffer->busy_next = NULL;
+  buffer->busy = 0;
+}
 
-	  args->arg6 = NULL;
-	}
+// The buffer is released once every commit of it has been rendered
 
-	char * s2 = va_arg(ap, char *);
+static struct wl_buffer * buffer_release(int id) {
 
-	if (s2) {
-	  args->arg7 = malloc(strlen(s2)+1);
-	  strcpy(args->arg7, s2);
+  for (struct wl_buffer * buffer = busy_buffers; buffer; buffer = buffer->busy_next) {
 
-	}
-	else {
+    if (buffer->id == id) {
 
-	  args->arg7 = NULL;
-	}
+      if (--buffer->busy > 0)
+	return NULL;
 
-	args->arg8 = va_arg(ap, int32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uiii") == 0) {
+      buffer_unlink_busy(buffer);
 
-	struct args_uiii * args = (struct args_uiii *)malloc(sizeof(struct args_uiii));
+      return buffer;
+    }
+  }
 
-	display.event_queue[display.head].args = args;
+  return NULL;
+}
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, int32_t);
-	args->arg3 = va_arg(ap, int32_t);
-	args->arg4 = va_arg(ap, int32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uoff") == 0) {
+#ifdef EXA_WAYLAND_THREADS
 
-	struct args_uoff * args = (struct args_uoff *)malloc(sizeof(struct args_uoff));
+/* Conversion of large buffers is split into bands of rows run by a pool of threads.
+   Commit does not wait for it: the last band done publishes the buffer by storing the
+   seq of the commit in buffer->ready, JS draws the surface once it reads it back */
 
-	display.event_queue[display.head].args = args;
+struct convert_band {
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, void *);
-	args->arg3 = va_arg(ap, int32_t);
-	args->arg4 = va_arg(ap, int32_t);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uo") == 0) {
-	struct args_uo * args = (struct args_uo *)malloc(sizeof(struct args_uo));
+  struct wl_buffer * buffer;
+  const uint8_t * pixels;
+  enum pixel_kernel kernel;
+  int y0, y1;
+  uint32_t seq;
+};
 
-	display.event_queue[display.head].args = args;
+static struct {
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, void *);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "uoa") == 0) {
-	struct args_uoa * args = (struct args_uoa *)malloc(sizeof(struct args_uoa));
+  pthread_t threads[CONVERT_THREADS_MAX];
+  int nb_threads;
+  int quit;
+  pthread_mutex_t lock;
+  pthread_cond_t work; // bands queued
+  pthread_cond_t done; // a band done
+  unsigned int head;
+  unsigned int tail;
+  struct convert_band bands[CONVERT_QUEUE_SIZE];
+} convert_pool = {
 
-	display.event_queue[display.head].args = args;
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
 
-	args->arg1 = va_arg(ap, uint32_t);
-	args->arg2 = va_arg(ap, void *);
-	args->arg3 = va_arg(ap, void *);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "n") == 0) {
+static void * convert_worker(void * arg) {
 
-	struct args_n * args = (struct args_n *)malloc(sizeof(struct args_n));
+  pthread_mutex_lock(&convert_pool.lock);
 
-	display.event_queue[display.head].args = args;
+  for (;;) {
 
-	args->arg1 = va_arg(ap, void *);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "s") == 0) {
+    while ( (convert_pool.head == convert_pool.tail) && !convert_pool.quit )
+      pthread_cond_wait(&convert_pool.work, &convert_pool.lock);
 
-	struct args_s * args = (struct args_s *)malloc(sizeof(struct args_s));
+    if (convert_pool.head == convert_pool.tail)
+      break;
 
-	display.event_queue[display.head].args = args;
+    struct convert_band band = convert_pool.bands[convert_pool.tail++ & (CONVERT_QUEUE_SIZE - 1)];
 
-	args->arg1 = va_arg(ap, char *);
-      }
-      else if (strcmp(interface->events[i].signature+offset, "sh") == 0) {
+    pthread_mutex_unlock(&convert_pool.lock);
 
-	struct args_sh * args = (struct args_sh *)malloc(sizeof(struct args_sh));
+    struct wl_buffer * buffer = band.buffer;
 
-	display.event_queue[display.head].args = args;
+    pixel_convert(band.kernel, buffer->rgba, band.pixels, buffer->stride, buffer->width, band.y0, band.y1);
 
-	args->arg1 = va_arg(ap, char *);
-	args->arg2 = va_arg(ap, uint32_t);
-      }
-      else if (interface->events[i].signature[offset] == 0) {
+    pthread_mutex_lock(&convert_pool.lock);
 
-	display.event_queue[display.head].args = NULL;
-      }
+    if (--buffer->bands == 0)
+      __atomic_store_n(&buffer->ready, band.seq, __ATOMIC_RELEASE);
 
-      break;
-    }
+    pthread_cond_broadcast(&convert_pool.done);
   }
-  
-  va_end(ap);
 
-  display.head = (display.head+1) % EVENT_QUEUE_SIZE;
+  pthread_mutex_unlock(&convert_pool.lock);
 
-  /*EM_ASM({*/
-  
-  const char * fun = 
-      "Module['wayland'].queueNotEmpty = 1;"
-      
-      "setTimeout(() => {"
+  return NULL;
+}
 
-    "if ( (Module['fd_table'][0x7e000000].notif_select) /*&& (Module['wayland'].queueNotEmpty)*/ ) {"
+// EXA_WAYLAND_CONVERT_THREADS threads, one less than the number of cores by default, 0 to convert on the main thread
 
-	    // TODO check rw
-		      
-	    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-	  "}"
-		    
-    "}, 0);";
-/*});*/
+static void convert_pool_start(void) {
 
-  static int send_event_handle = -1;
+  const char * env = getenv("EXA_WAYLAND_CONVERT_THREADS");
 
-  if (send_event_handle < 0)
-    send_event_handle = emscripten_load_fun(fun, "v");
-  
-  emscripten_run_fun(send_event_handle);
-}
+  int nb_threads = (env)?atoi(env):(int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
 
-struct wl_display * wl_display_connect(const char *name) {
+  if (nb_threads > CONVERT_THREADS_MAX)
+    nb_threads = CONVERT_THREADS_MAX;
 
-  emscripten_log(EM_LOG_CONSOLE, "--> wl_display_connect");
-  
-  /*EM_ASM_({*/
+  convert_pool.quit = 0;
 
-  const char * fun = "const fd = 0x7e000000;"
+  for (convert_pool.nb_threads = 0; convert_pool.nb_threads < nb_threads; ++convert_pool.nb_threads) {
 
-      "let desc = {};"
+    if (pthread_create(&convert_pool.threads[convert_pool.nb_threads], NULL, convert_worker, NULL) != 0) {
 
-      "desc['fd'] = fd;"
-      "desc['remote_fd'] = -1;"
-      "desc['select'] = (fd, rw, start, notif_select) => {"
+      LOG_WARN("convert_pool_start: %d threads out of %d", convert_pool.nb_threads, nb_threads);
+      break;
+    }
+  }
 
-	"if (start) {"
+  LOG_INFO("convert_pool_start: %d threads", convert_pool.nb_threads);
+}
 
-    //"//console.log(\"select wayland display: fd=\"+fd+\", rw=\"+rw+\", start=\"+start);"
+static void convert_pool_stop(void) {
 
-	  "if ( (Module['wayland'].events.length > 0) || (Module['wayland'].queueNotEmpty) ) {"
+  pthread_mutex_lock(&convert_pool.lock);
+  convert_pool.quit = 1;
+  pthread_cond_broadcast(&convert_pool.work);
+  pthread_mutex_unlock(&convert_pool.lock);
 
-	    "Module['fd_table'][fd].notif_select = null;"
-	    "notif_select(fd, rw);"
-	  "}"
-	  "else {"
+  for (int i = 0; i < convert_pool.nb_threads; ++i)
+    pthread_join(convert_pool.threads[i], NULL);
 
-	    "Module['fd_table'][fd].notif_select = notif_select;"
-	  "}"
-	"}"
-	"else {"
+  convert_pool.nb_threads = 0;
+}
 
-	  "Module['fd_table'][fd].notif_select = null;"
-	"}"
-	
-      "};"
+// Before rgba is written again or freed
 
-    "Module['fd_table'][fd] = desc;"
+static void convert_wait(struct wl_buffer * buffer) {
 
-    "if (!('wayland' in Module)) {"
-    
-	"Module['wayland'] = {};"
-	"Module['wayland'].requests = new Array();"
-	"Module['wayland'].events = new Array();"
+  pthread_mutex_lock(&convert_pool.lock);
 
-	"Module['wayland'].render = function() {"
+  while (buffer->bands)
+    pthread_cond_wait(&convert_pool.done, &convert_pool.lock);
 
-	  "for (const request of Module['wayland'].requests) {"
+  pthread_mutex_unlock(&convert_pool.lock);
+}
 
-    //"//console.log(\"Wayland client: render -> \"+request.type);"
+// Queues rows [y0, y1) as one band per thread, returns 0 when they are left to the caller
 
-	    "if (request.type == 'damage_buffer') {"
+static int convert_bands(struct wl_buffer * buffer, const uint8_t * pixels, enum pixel_kernel kernel, int y0, int y1) {
 
-    //"// TODO"
-	    "}"
-	    "else if (request.type == 'commit') {"
+  if ( !convert_pool.nb_threads || ((int64_t)(y1 - y0) * buffer->width < CONVERT_PIXELS_MIN) )
+    return 0;
 
-	      "const canvas = Module['surfaces'][request.surface_id-1];"
+  int nb_bands = convert_pool.nb_threads;
 
-	      "const ctx = canvas.getContext('2d');"
+  if ((y1 - y0) / nb_bands < CONVERT_BAND_ROWS_MIN)
+    nb_bands = (y1 - y0) / CONVERT_BAND_ROWS_MIN;
 
-	      "if ( (canvas.width != request.width) || (canvas.height != request.height) ) {"
-	        "canvas.width = request.width;"
-	        "canvas.height = request.height;"
+  if (nb_bands < 1)
+    nb_bands = 1;
 
-	        "canvas.style.width = request.width/window.devicePixelRatio + \"px\";"
-	        "canvas.style.height = request.height/window.devicePixelRatio + \"px\";"
-	        "canvas.parentElement.style.width = request.width/window.devicePixelRatio + \"px\";"
-	      "}"
+  pthread_mutex_lock(&convert_pool.lock);
 
-              "const pixels = new Uint8ClampedArray(Module.HEAPU8.buffer, Module['shm'].fds[request.shm_fd-0x7f000000].mem, Module['shm'].fds[request.shm_fd-0x7f000000].len);"
+  while (convert_pool.head - convert_pool.tail + nb_bands > CONVERT_QUEUE_SIZE)
+    pthread_cond_wait(&convert_pool.done, &convert_pool.lock);
 
-              "const imageData = new ImageData(pixels, request.width, request.height);"
-	
-	      "ctx.putImageData(imageData, 0, 0);"
+  buffer->bands = nb_bands;
 
-	      "Module['wayland'].events.push({"
+  for (int i = 0; i < nb_bands; ++i) {
 
-		"'type': 1," // buffer released"
-		"'surface_id': request.surface_id,"
-		"'shm_fd': request.shm_fd"
-		"});"
-
-	      "Module['wayland'].events.push({"
+    struct convert_band * band = &convert_pool.bands[convert_pool.head++ & (CONVERT_QUEUE_SIZE - 1)];
 
-		"'type': 2," // frame done"
-		"'surface_id': request.surface_id,"
-		"'timestamp': new Date().getTime()"
-		"});"
-	    "}"
-    
-	  "}"
+    band->buffer = buffer;
+    band->pixels = pixels;
+    band->kernel = kernel;
+    band->y0 = y0 + (int)((int64_t)(y1 - y0) * i / nb_bands);
+    band->y1 = y0 + (int)((int64_t)(y1 - y0) * (i + 1) / nb_bands);
+    band->seq = buffer->seq;
+  }
 
-	  "if (Module['wayland'].events.length > 0) {"
+  pthread_cond_broadcast(&convert_pool.work);
+  pthread_mutex_unlock(&convert_pool.lock);
 
-	    "setTimeout(() => {"
+  return 1;
+}
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+#endif
 
-    //"// TODO check rw"
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	  "}"
-	  
-	  "Module['wayland'].requests = new Array();"
+static inline struct xdg_toplevel * surface_get_toplevel(struct wl_surface * surface) {
 
-	  "window.requestAnimationFrame(Module['wayland'].render);"
+  return (surface && surface->xdg_surface)?surface->xdg_surface->xdg_toplevel:NULL;
+}
 
-	  "if (Module.swapCounter) {"
+static struct xkb_keymap keymap;
 
-	    "if (Module.swapCounter > 0) {"
+static struct xkb_compose_table kbd_compose_table;
+static struct xkb_state kbd_state;
+static struct xkb_compose_state kbd_compose_state;
 
-	      "Module.swapCounter -= 1;"
-	    "}"
+static struct wl_cursor_theme cursor_theme;
 
-	    "if ( (Module.swapCounter == 0) && (Module.swapBuffersWakeUp) ) {"
+static xkb_keysym_t latest_keysym;
 
-	      "Module.swapCounter = Module.swapInterval;"
+/* Arguments of queued events live in a per-display arena which is recycled
+   when the event queue is drained, so steady state dispatch does not malloc */
 
-	      "const wakeUp = Module.swapBuffersWakeUp;"
-	      
-	      "Module.swapBuffersWakeUp = null;"
-	      "wakeUp(1);"
-	    "}"
-    
-	  "}"
-    
-	"};"
+static void * event_arena_alloc(struct event_arena * arena, size_t size) {
 
-    
+  size = (size + EVENT_ARENA_ALIGN - 1) & ~(size_t)(EVENT_ARENA_ALIGN - 1);
 
-	"Module['wayland'].queueNotEmpty = 0;"
-    "}";
-    
-    /*});*/
+  void * ptr = NULL;
 
-  static int display_connect_handle = -1;
+  if ( (arena->used + size) <= arena->size) {
 
-  if (display_connect_handle < 0)
-    display_connect_handle = emscripten_load_fun(fun, "v");
-  
-  emscripten_run_fun(display_connect_handle);
-  
-  
-  for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+    ptr = arena->base + arena->used;
+    arena->used += size;
+  }
+  else if (arena->chunks && ((arena->chunks->used + size) <= arena->chunks->size)) {
 
-    surfaces[i].id = -1;
-    xdg_surfaces[i].wl_surface = NULL;
-    xdg_toplevels[i].xdg_surface = NULL;
+    ptr = (char *)(arena->chunks + 1) + arena->chunks->used;
+    arena->chunks->used += size;
   }
+  else {
+
+    size_t chunk_size = (size > EVENT_ARENA_SIZE)?size:EVENT_ARENA_SIZE;
+
+    struct event_arena_chunk * chunk = (struct event_arena_chunk *)malloc(sizeof(struct event_arena_chunk) + chunk_size);
+
+    if (!chunk)
+      return NULL;
+
+    ++arena->heap_allocs;
 
-  for (int i = 0; i < NB_CALLBACK_MAX; ++i) {
+    chunk->size = chunk_size;
+    chunk->used = size;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
 
-    frame_callbacks[i].wl_surface = NULL;
+    ptr = chunk + 1;
   }
 
-  display.head = 0;
-  display.tail = 0;
+  ++arena->allocs;
 
-  emscripten_log(EM_LOG_CONSOLE, "<-- wl_display_connect");
-  
-  return &display;
-}
+  arena->in_use += size;
 
-void wl_display_disconnect(struct wl_display *display) {
+  if (arena->in_use > arena->high_water)
+    arena->high_water = arena->in_use;
 
-  emscripten_log(EM_LOG_CONSOLE, "--> wl_display_disconnect");
+  return ptr;
+}
 
-  /*EM_ASM({*/
+static char * event_arena_strdup(struct event_arena * arena, const char * str) {
 
-  const char * fun = 
-      "Module.iframeShown = true;"
+  if (!str)
+    return NULL;
 
-      "let m = new Object();"
-	
-      "m.type = 6;" // hide iframe
-      "m.pid = Module.getpid() & 0x0000ffff;"
+  size_t len = strlen(str)+1;
 
-    "window.parent.postMessage(m);";
-      /*});*/
+  char * copy = (char *)event_arena_alloc(arena, len);
 
-  static int display_disconnect_handle = -1;
+  if (copy)
+    memcpy(copy, str, len);
 
-  if (display_disconnect_handle < 0)
-    display_disconnect_handle = emscripten_load_fun(fun, "v");
-  
-  emscripten_run_fun(display_disconnect_handle);
+  return copy;
 }
 
-  /*interface: 'wl_compositor', version: 5, name: 1
-interface: 'wl_drm', version: 2, name: 2
-interface: 'wl_shm', version: 1, name: 3
-interface: 'wl_output', version: 3, name: 4
-interface: 'zxdg_output_manager_v1', version: 3, name: 5
-interface: 'wl_data_device_manager', version: 3, name: 6
-interface: 'zwp_primary_selection_device_manager_v1', version: 1, name: 7
-interface: 'wl_subcompositor', version: 1, name: 8
-interface: 'xdg_wm_base', version: 4, name: 9
-interface: 'gtk_shell1', version: 5, name: 10
-interface: 'wp_viewporter', version: 1, name: 11
-interface: 'zwp_pointer_gestures_v1', version: 3, name: 12
-interface: 'zwp_tablet_manager_v2', version: 1, name: 13
-interface: 'wl_seat', version: 8, name: 14
-interface: 'zwp_relative_pointer_manager_v1', version: 1, name: 15
-interface: 'zwp_pointer_constraints_v1', version: 1, name: 16
-interface: 'zxdg_exporter_v1', version: 1, name: 17
-interface: 'zxdg_importer_v1', version: 1, name: 18
-interface: 'zwp_linux_dmabuf_v1', version: 4, name: 19
-interface: 'wp_single_pixel_buffer_manager_v1', version: 1, name: 20
-interface: 'zwp_keyboard_shortcuts_inhibit_manager_v1', version: 1, name: 21
-interface: 'zwp_text_input_manager_v3', version: 1, name: 22
-interface: 'wp_presentation', version: 1, name: 23
-interface: 'xdg_activation_v1', version: 1, name: 24*/
+static void event_arena_reset(struct event_arena * arena) {
 
-extern const struct wl_interface wl_registry_interface;
+  if (arena->chunks) {
 
-static struct wl_registry registry = {
+    // Grow the main block so that the same burst fits without chunks next time
 
-  .proxy = {
+    size_t size = arena->size;
 
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_registry_interface,
-  },
-};
+    while (arena->chunks) {
 
+      struct event_arena_chunk * next = arena->chunks->next;
 
-void wl_proxy_destroy(struct wl_proxy *proxy) {
+      size += arena->chunks->size;
 
-}
+      free(arena->chunks);
 
-uint32_t wl_proxy_get_version(struct wl_proxy * proxy)
-{
-	return proxy->version;
-}
+      arena->chunks = next;
+    }
 
-void
-wl_proxy_set_user_data(struct wl_proxy *proxy, void *user_data) {
+    free(arena->base);
 
-  proxy->data = user_data;
+    arena->base = (char *)malloc(size);
+    arena->size = (arena->base)?size:0;
+
+    ++arena->heap_allocs;
+  }
+
+  arena->used = 0;
+  arena->in_use = 0;
+
+  ++arena->resets;
 }
 
-void *
-wl_proxy_get_user_data(struct wl_proxy *proxy) {
+static struct wl_array * event_states_new(uint32_t state) {
 
-  return proxy->data;
+  struct wl_array * states = (struct wl_array *)event_arena_alloc(&display.arena, sizeof(struct wl_array) + sizeof(uint32_t));
+
+  if (!states)
+    return NULL;
+
+  states->size = sizeof(uint32_t);
+  states->alloc = states->size;
+  states->data = states + 1;
+
+  ((uint32_t *)(states->data))[0] = state;
+
+  return states;
 }
 
-void
-wl_proxy_set_tag(struct wl_proxy *proxy,
-		 const char * const *tag) {
-  
-  proxy->tag = tag;
+/* Event opcodes are the index of the handler in the generated listener struct */
+#define EVENT_OPCODE(iface, event) (offsetof(struct iface##_listener, event) / sizeof(void (*)(void)))
+
+static struct interface_descriptor interface_descriptors[NB_INTERFACE_MAX];
+static int nb_interface_descriptors = 0;
+
+static struct event_descriptor event_descriptors[NB_EVENT_DESCRIPTOR_MAX];
+static int nb_event_descriptors = 0;
+
+static uint32_t message_counts[NB_MESSAGE_COUNT_MAX];
+static int nb_message_counts = 0;
+
+static int count_event_args(const char * signature) {
+
+  int nargs = 0;
+
+  for (; *signature; ++signature) {
+
+    if ( (*signature != '?') && ((*signature < '0') || (*signature > '9')) )
+      ++nargs;
+  }
+
+  return nargs;
 }
 
-const char * const *
-wl_proxy_get_tag(struct wl_proxy *proxy) {
-  
-  return proxy->tag;
+static const char * skip_event_version(const char * signature) {
+
+  //Signature starts by the minimum version, so we skip it
+
+  while ( (*signature >= '0') && (*signature <= '9') )
+    ++signature;
+
+  return signature;
 }
 
-int wl_display_roundtrip(struct wl_display * display) {
+static const struct request_table * find_request_table(const struct wl_interface * interface);
+static const struct event_trampoline_table * find_event_trampolines(const struct wl_interface * interface);
 
-  //emscripten_log(EM_LOG_CONSOLE, "--> wl_display_roundtrip %d %d", display->head, display->tail);
+// Built once per interface, the first time a proxy of this interface is seen
 
-  while (display->head != display->tail) {
-    
-    struct wl_interface * interface = display->event_queue[display->tail].proxy->interface;
+static const struct interface_descriptor * get_interface_descriptor(const struct wl_interface * interface) {
 
-    if (interface) {
+  for (int i = 0; i < nb_interface_descriptors; ++i) {
+
+    if (interface_descriptors[i].interface == interface)
+      return &interface_descriptors[i];
+  }
 
-      int i = 0;
+  if ( (nb_interface_descriptors >= NB_INTERFACE_MAX) ||
+       ((nb_event_descriptors + interface->event_count) > NB_EVENT_DESCRIPTOR_MAX) ||
+       ((nb_message_counts + interface->method_count + interface->event_count) > NB_MESSAGE_COUNT_MAX) ) {
 
-      for (;i < interface->event_count; ++i) {
+    LOG_ERROR("get_interface_descriptor: no room left for %s", interface->name);
+    return NULL;
+  }
 
-	if (strcmp(interface->events[i].name, display->event_queue[display->tail].name) == 0) {
+  struct interface_descriptor * descriptor = &interface_descriptors[nb_interface_descriptors++];
 
-	  printf("found event: %d %s\n", i, interface->events[i].signature);
+  descriptor->interface = interface;
+  descriptor->events = &event_descriptors[nb_event_descriptors];
+  descriptor->requests = find_request_table(interface);
+  descriptor->trampolines = find_event_trampolines(interface);
+  descriptor->request_counts = &message_counts[nb_message_counts];
+  descriptor->event_counts = &message_counts[nb_message_counts + interface->method_count];
 
-	  int offset = 0;
+  nb_event_descriptors += interface->event_count;
+  nb_message_counts += interface->method_count + interface->event_count;
 
-	  //Signature starts by the minimum version, so we skip it
-	
-	  while ( (interface->events[i].signature[offset] >= '0') && (interface->events[i].signature[offset] <= '9') )
-	    ++offset;
+  for (int i = 0; i < interface->event_count; ++i) {
 
-	  if (strcmp(interface->events[i].signature+offset, "usu") == 0) {
+    descriptor->events[i].types = skip_event_version(interface->events[i].signature);
+    descriptor->events[i].nargs = count_event_args(descriptor->events[i].types);
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, const char *, uint32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, const char *, uint32_t))display->event_queue[display->tail].proxy->listeners[i];
+    if (descriptor->events[i].nargs > EVENT_ARGS_MAX)
+      LOG_WARN("get_interface_descriptor: too many arguments for %s.%s(%s)", interface->name, interface->events[i].name, interface->events[i].signature);
+  }
 
-	    struct args_usu * args = (struct args_usu * )display->event_queue[display->tail].args;
+  return descriptor;
+}
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "u") == 0) {
+static inline const struct interface_descriptor * proxy_get_descriptor(struct wl_proxy * proxy) {
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t) = (void (*)(void *, struct wl_proxy *, uint32_t))display->event_queue[display->tail].proxy->listeners[i];
+  if (!proxy->descriptor || (proxy->descriptor->interface != proxy->interface))
+    proxy->descriptor = get_interface_descriptor(proxy->interface);
 
-	    struct args_u * args = (struct args_u * )display->event_queue[display->tail].args;
+  return proxy->descriptor;
+}
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "iia") == 0) {
+static void event_queue_dispatch(struct wl_display * display);
 
-	    void (*listener)(void *, struct wl_proxy *, int32_t, int32_t, struct wl_array *) = (void (*)(void *, struct wl_proxy *, int32_t, int32_t, struct wl_array *))display->event_queue[display->tail].proxy->listeners[i];
+static inline unsigned int event_queue_count(struct wl_display * display) {
 
-	    struct args_iia * args = (struct args_iia * )display->event_queue[display->tail].args;
+  return (display->head - display->tail) & (display->queue_size - 1);
+}
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3);
-	  
-	    struct wl_array * a = args->arg3;
-	  
-	    if (a) {
-	    
-	      if (a->data)
-		free(a->data);
-	    
-	      free(a);
-	    }
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uhu") == 0) {
+static inline int event_queue_full(struct wl_display * display) {
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, int32_t, uint32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, int32_t, uint32_t))display->event_queue[display->tail].proxy->listeners[i];
+  return ((display->head + 1) & (display->queue_size - 1)) == display->tail;
+}
+
+static inline int is_motion_event(struct wl_proxy * proxy, uint32_t opcode) {
+
+  return proxy && (proxy->interface == &wl_pointer_interface) && (opcode == EVENT_OPCODE(wl_pointer, motion));
+}
 
-	    struct args_uhu * args = (struct args_uhu * )display->event_queue[display->tail].args;
+static int event_queue_grow(struct wl_display * display) {
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uuuu") == 0) {
+  if (display->queue_size >= display->queue_size_max)
+    return -1;
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, uint32_t, uint32_t, uint32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, uint32_t, uint32_t, uint32_t))display->event_queue[display->tail].proxy->listeners[i];
+  unsigned int size = display->queue_size * 2;
 
-	    struct args_uuuu * args = (struct args_uuuu * )display->event_queue[display->tail].args;
+  struct event * queue = (struct event *)malloc(size * sizeof(struct event));
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3, args->arg4);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "ii") == 0) {
+  if (!queue)
+    return -1;
 
-	    void (*listener)(void *, struct wl_proxy *, int32_t, int32_t) = (void (*)(void *, struct wl_proxy *, int32_t, int32_t))display->event_queue[display->tail].proxy->listeners[i];
+  // Unwrap pending events at the beginning of the new queue
 
-	    struct args_ii * args = (struct args_ii * )display->event_queue[display->tail].args;
+  unsigned int count = event_queue_count(display);
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uuuuu") == 0) {
+  for (unsigned int i = 0; i < count; ++i)
+    queue[i] = display->event_queue[(display->tail + i) & (display->queue_size - 1)];
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t))display->event_queue[display->tail].proxy->listeners[i];
+  if (display->event_queue != event_queue_storage)
+    free(display->event_queue);
 
-	    struct args_uuuuu * args = (struct args_uuuu * )display->event_queue[display->tail].args;
+  display->event_queue = queue;
+  display->queue_size = size;
+  display->tail = 0;
+  display->head = count;
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3, args->arg4, args->arg5);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uuf") == 0) {
+  ++display->queue_stats.grows;
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, uint32_t, int32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, uint32_t, int32_t))display->event_queue[display->tail].proxy->listeners[i];
+  return 0;
+}
 
-	    struct args_uuf * args = (struct args_uuf * )display->event_queue[display->tail].args;
+static int event_queue_drop_oldest_motion(struct wl_display * display) {
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uff") == 0) {
+  unsigned int mask = display->queue_size - 1;
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, int32_t, int32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, int32_t, int32_t))display->event_queue[display->tail].proxy->listeners[i];
+  for (unsigned int i = display->tail; i != display->head; i = (i + 1) & mask) {
 
-	    struct args_uff * args = (struct args_uff * )display->event_queue[display->tail].args;
+    if (is_motion_event(display->event_queue[i].proxy, display->event_queue[i].opcode)) {
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "iiiiissi") == 0) {
+      // Shift the newer events down to keep the queue ordered
 
-	    void (*listener)(void *, struct wl_proxy *, int32_t, int32_t, int32_t, int32_t, int32_t, char *, char *, int32_t) = (void (*)(void *, struct wl_proxy *, int32_t, int32_t, int32_t, int32_t, int32_t, char *, char *, int32_t))display->event_queue[display->tail].proxy->listeners[i];
+      for (unsigned int j = i; ((j + 1) & mask) != display->head; j = (j + 1) & mask)
+	display->event_queue[j] = display->event_queue[(j + 1) & mask];
 
-	    struct args_iiiiissi * args = (struct args_iiiiissi * )display->event_queue[display->tail].args;
+      display->head = (display->head - 1) & mask;
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3, args->arg4, args->arg5, args->arg6, args->arg7, args->arg8);
+      ++display->queue_stats.dropped_motions;
 
-	    if (args->arg6)
-	      free(args->arg6);
+      return 0;
+    }
+  }
 
-	    if (args->arg7)
-	      free(args->arg7);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uiii") == 0) {
+  return -1;
+}
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, int32_t, int32_t, int32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, int32_t, int32_t, int32_t))display->event_queue[display->tail].proxy->listeners[i];
+static inline int object_contains(void * object, size_t size, void * pointer) {
 
-	    struct args_uiii * args = (struct args_uiii * )display->event_queue[display->tail].args;
+  return ((char *)pointer >= (char *)object) && ((char *)pointer < (char *)object + size);
+}
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3, args->arg4);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uoff") == 0) {
+/* Events still queued for a destroyed object, or carrying it as an object argument,
+   are kept in place but not dispatched */
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, void *, int32_t, int32_t) = (void (*)(void *, struct wl_proxy *, uint32_t, void *, int32_t, int32_t))display->event_queue[display->tail].proxy->listeners[i];
+static void event_queue_purge(struct wl_display * display, void * object, size_t size) {
 
-	    struct args_uoff * args = (struct args_uoff * )display->event_queue[display->tail].args;
+  unsigned int mask = display->queue_size - 1;
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3, args->arg4);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uo") == 0) {
+  for (unsigned int i = display->tail; i != display->head; i = (i + 1) & mask) {
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, void *) = (void (*)(void *, struct wl_proxy *, uint32_t, void *))display->event_queue[display->tail].proxy->listeners[i];
+    struct event * event = &display->event_queue[i];
 
-	    struct args_uo * args = (struct args_uo * )display->event_queue[display->tail].args;
+    if (!event->proxy)
+      continue;
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "uoa") == 0) {
+    if (object_contains(object, size, event->proxy)) {
 
-	    void (*listener)(void *, struct wl_proxy *, uint32_t, void *, void *) = (void (*)(void *, struct wl_proxy *, uint32_t, void *, void *))display->event_queue[display->tail].proxy->listeners[i];
+      event->proxy = NULL;
+      continue;
+    }
 
-	    struct args_uoa * args = (struct args_uoa * )display->event_queue[display->tail].args;
+    const union wl_argument * args = event_args(event);
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2, args->arg3);
+    if (!args)
+      continue;
 
-	    struct wl_array * a = args->arg3;
-	  
-	    if (a) {
-	    
-	      if (a->data)
-		free(a->data);
-	    
-	      free(a);
-	    }
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "n") == 0) {
+    for (const char * types = proxy_get_descriptor(event->proxy)->events[event->opcode].types; *types; ++types) {
 
-	    void (*listener)(void *, struct wl_proxy *, void *) = (void (*)(void *, struct wl_proxy *, void *))display->event_queue[display->tail].proxy->listeners[i];
+      if (*types == '?')
+	continue;
 
-	    struct args_n * args = (struct args_n * )display->event_queue[display->tail].args;
+      if ( (*types == 'o') && object_contains(object, size, args->o) ) {
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "s") == 0) {
+	event->proxy = NULL;
+	break;
+      }
+
+      ++args;
+    }
+  }
+}
 
-	    void (*listener)(void *, struct wl_proxy *, void *) = (void (*)(void *, struct wl_proxy *, void *))display->event_queue[display->tail].proxy->listeners[i];
+/* Makes room for one more event. Returns a queued motion event to be overwritten
+   when coalescing, the head slot when there is room, NULL when the event is lost */
 
-	    struct args_s * args = (struct args_s * )display->event_queue[display->tail].args;
+static struct event * event_queue_reserve(struct wl_display * display, struct wl_proxy * proxy, uint32_t opcode) {
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1);
-	  }
-	  else if (strcmp(interface->events[i].signature+offset, "sh") == 0) {
+  if (event_queue_full(display)) {
 
-	    void (*listener)(void *, struct wl_proxy *, void *, uint32_t) = (void (*)(void *, struct wl_proxy *, void *, uint32_t))display->event_queue[display->tail].proxy->listeners[i];
+    ++display->queue_stats.overflows;
 
-	    struct args_sh * args = (struct args_sh * )display->event_queue[display->tail].args;
+    switch (display->queue_policy) {
 
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy, args->arg1, args->arg2);
-	  }
-	  else if (interface->events[i].signature[offset] == 0) {
+    case EVENT_QUEUE_POLICY_COALESCE:
 
-	    void (*listener)(void *, struct wl_proxy *) = (void (*)(void *, struct wl_proxy *))display->event_queue[display->tail].proxy->listeners[i];
-	  
-	    if (listener)
-	      (*listener)(display->event_queue[display->tail].proxy->data, display->event_queue[display->tail].proxy);
-	  }
-	
-	  break;
+      if (is_motion_event(proxy, opcode)) {
+
+	struct event * last = &display->event_queue[(display->head - 1) & (display->queue_size - 1)];
+
+	if ( (last->proxy == proxy) && (last->opcode == opcode) ) {
+
+	  ++display->queue_stats.coalesced;
+
+	  return last;
 	}
       }
+      break;
+
+    case EVENT_QUEUE_POLICY_DROP_MOTION:
+
+      event_queue_drop_oldest_motion(display);
+      break;
+
+    case EVENT_QUEUE_POLICY_DISPATCH:
+
+      /* Only from wl_display_dispatch and roundtrip: from a listener it would reorder events
+	 around the one being dispatched, from a request the client has not set the listeners
+	 of the new proxies yet (wl_display.get_registry) and their events would be dropped.
+	 The queue grows instead */
+
+      if ( (display->dispatch_depth == 0) && (display->marshal_depth == 0) ) {
+
+	event_queue_dispatch(display);
+
+	++display->queue_stats.dispatched;
+      }
+      break;
+
+    default:
+      break;
     }
 
-    if (display->event_queue[display->tail].args)
-      free(display->event_queue[display->tail].args);
+    if (event_queue_full(display) && (event_queue_grow(display) < 0)) {
+
+      ++display->queue_stats.lost;
+
+      LOG_WARN("send_event: queue full (%d), event %s.%s lost", display->queue_size, proxy->interface->name, proxy->interface->events[opcode].name);
 
-    display->tail = (display->tail +1) % EVENT_QUEUE_SIZE;
+      return NULL;
+    }
   }
 
-  /*EM_ASM({*/
+  struct event * event = &display->event_queue[display->head];
 
-  const char * fun = "Module['wayland'].queueNotEmpty = 0;";
-      
-      /*});*/
+  display->head = (display->head + 1) & (display->queue_size - 1);
 
-    static int display_roundtrip_handle = -1;
+  unsigned int count = event_queue_count(display);
 
-  if (display_roundtrip_handle < 0)
-    display_roundtrip_handle = emscripten_load_fun(fun, "v");
-  
-  emscripten_run_fun(display_roundtrip_handle);
-  
-  return 0;
+  if (count > display->queue_stats.high_water)
+    display->queue_stats.high_water = count;
+
+  return event;
 }
 
+/* Signature interpreter: one wl_argument per type letter, '?' only marks a nullable argument */
 
-static const struct wl_interface *wayland_types[] = {
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	/*&wl_callback_interface*/NULL,
-	/*&wl_registry_interface*/NULL,
-	/*&wl_surface_interface*/NULL,
-	/*&wl_region_interface*/NULL,
-	/*&wl_buffer_interface*/NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	/*&wl_shm_pool_interface*/NULL,
-	NULL,
-	NULL,
-	#if 0
-	&wl_data_source_interface,
-	&wl_surface_interface,
-	&wl_surface_interface,
-	NULL,
-	&wl_data_source_interface,
-	NULL,
-	&wl_data_offer_interface,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	&wl_data_offer_interface,
-	&wl_data_offer_interface,
-	&wl_data_source_interface,
-	&wl_data_device_interface,
-	&wl_seat_interface,
-	&wl_shell_surface_interface,
-	&wl_surface_interface,
-	&wl_seat_interface,
-	NULL,
-	&wl_seat_interface,
-	NULL,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	&wl_output_interface,
-	&wl_seat_interface,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	NULL,
-	&wl_output_interface,
-	&wl_buffer_interface,
-	NULL,
-	NULL,
-	&wl_callback_interface,
-	&wl_region_interface,
-	&wl_region_interface,
-	&wl_output_interface,
-	&wl_output_interface,
-	&wl_pointer_interface,
-	&wl_keyboard_interface,
-	&wl_touch_interface,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	&wl_surface_interface,
-	NULL,
-	NULL,
-	NULL,
-	&wl_subsurface_interface,
-	&wl_surface_interface,
-	&wl_surface_interface,
-	&wl_surface_interface,
-	&wl_surface_interface,
-	#endif
+static void event_args_from_va(const char * types, union wl_argument * args, va_list ap) {
+
+  for (; *types; ++types) {
+
+    switch (*types) {
+
+    case 'i':
+      args->i = va_arg(ap, int32_t);
+      break;
+    case 'u':
+      args->u = va_arg(ap, uint32_t);
+      break;
+    case 'f':
+      args->f = va_arg(ap, wl_fixed_t);
+      break;
+    case 's':
+      args->s = event_arena_strdup(&display.arena, va_arg(ap, const char *));
+      break;
+    case 'o':
+    case 'n':
+      args->o = (struct wl_object *)va_arg(ap, void *);
+      break;
+    case 'a':
+      args->a = va_arg(ap, struct wl_array *);
+      break;
+    case 'h':
+      args->h = va_arg(ap, int32_t);
+      break;
+    default: // '?'
+      continue;
+    }
+
+    ++args;
+  }
+}
+
+static void event_args_to_words(const char * types, const union wl_argument * args, uintptr_t * words) {
+
+  for (; *types; ++types) {
+
+    switch (*types) {
+
+    case 'i':
+      *words = (uintptr_t)(intptr_t)args->i;
+      break;
+    case 'u':
+      *words = args->u;
+      break;
+    case 'f':
+      *words = (uintptr_t)(intptr_t)args->f;
+      break;
+    case 's':
+      *words = (uintptr_t)args->s;
+      break;
+    case 'o':
+    case 'n':
+      *words = (uintptr_t)args->o;
+      break;
+    case 'a':
+      *words = (uintptr_t)args->a;
+      break;
+    case 'h':
+      *words = (uintptr_t)(intptr_t)args->h;
+      break;
+    default: // '?'
+      continue;
+    }
+
+    ++args;
+    ++words;
+  }
+}
+
+/* Arity trampolines: on wasm32 every wire argument is an i32, so a listener can be called
+   with pointer-sized words whatever its declared argument types */
+
+#define EVENT_LISTENER(...) ((void (*)(void *, struct wl_proxy *, __VA_ARGS__))handler)
+
+static void event_call_listener(void (*handler)(void), void * data, struct wl_proxy * proxy, int nargs, const uintptr_t * w) {
+
+  typedef uintptr_t W;
+
+  switch (nargs) {
+
+  case 0:
+    ((void (*)(void *, struct wl_proxy *))handler)(data, proxy);
+    break;
+  case 1:
+    EVENT_LISTENER(W)(data, proxy, w[0]);
+    break;
+  case 2:
+    EVENT_LISTENER(W, W)(data, proxy, w[0], w[1]);
+    break;
+  case 3:
+    EVENT_LISTENER(W, W, W)(data, proxy, w[0], w[1], w[2]);
+    break;
+  case 4:
+    EVENT_LISTENER(W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3]);
+    break;
+  case 5:
+    EVENT_LISTENER(W, W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3], w[4]);
+    break;
+  case 6:
+    EVENT_LISTENER(W, W, W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3], w[4], w[5]);
+    break;
+  case 7:
+    EVENT_LISTENER(W, W, W, W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3], w[4], w[5], w[6]);
+    break;
+  case 8:
+    EVENT_LISTENER(W, W, W, W, W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7]);
+    break;
+  case 9:
+    EVENT_LISTENER(W, W, W, W, W, W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8]);
+    break;
+  case 10:
+    EVENT_LISTENER(W, W, W, W, W, W, W, W, W, W)(data, proxy, w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8], w[9]);
+    break;
+  default:
+    break;
+  }
+}
+
+// Queues an event and returns where its arguments go, NULL if it was not queued
+
+static union wl_argument * event_push(struct wl_proxy * proxy, uint32_t opcode) {
+
+  //emscripten_log(EM_LOG_CONSOLE, "send_event: %d (%d %d)\n", opcode, display.head, display.tail);
+
+  const struct interface_descriptor * descriptor = proxy_get_descriptor(proxy);
+
+  if (!descriptor || (opcode >= proxy->interface->event_count))
+    return NULL;
+
+  struct event * event = event_queue_reserve(&display, proxy, opcode);
+
+  if (!event)
+    return NULL;
+
+  event->proxy = proxy;
+  event->opcode = opcode;
+  event->nargs = descriptor->events[opcode].nargs;
+  event->flags = 0;
+
+  union wl_argument * args = event->args;
+
+  if (event->nargs > EVENT_INLINE_ARGS) {
+
+    args = (union wl_argument *)event_arena_alloc(&display.arena, event->nargs * sizeof(union wl_argument));
+
+    event->external_args = args; // NULL if no memory, the event is then skipped by dispatch
+    event->flags |= EVENT_FLAG_EXTERNAL_ARGS;
+  }
+
+  return args;
+}
+
+static inline const char * event_string(const char * s) {
+
+  return event_arena_strdup(&display.arena, s);
+}
+
+// One readiness notification per display until wl_display_roundtrip drains the queue
+
+static void event_notify(void) {
+
+  if (display.wakeup_armed) {
+
+    ++display.queue_stats.wakeups_coalesced;
+    return;
+  }
+
+  display.wakeup_armed = 1;
+  ++display.queue_stats.wakeups;
+
+  /*EM_ASM({*/
+  
+  const char * fun = 
+      "Module['wayland'].queueNotEmpty = 1;"
+      
+      "setTimeout(() => {"
+
+    "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].queueNotEmpty) ) {"
+
+	    // TODO check rw
+		      
+	    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+	  "}"
+		    
+    "}, 0);";
+/*});*/
+
+  static int event_notify_handle = -1;
+
+  if (event_notify_handle < 0)
+    event_notify_handle = emscripten_load_fun(fun, "v");
+  
+  js_run(event_notify_handle);
+}
+
+void send_event(struct wl_proxy * proxy, uint32_t opcode, ...) {
+
+  union wl_argument * args = event_push(proxy, opcode);
+
+  if (!args)
+    return;
+
+  va_list ap;
+
+  va_start(ap, opcode);
+
+  event_args_from_va(proxy->descriptor->events[opcode].types, args, ap);
+
+  va_end(ap);
+
+  event_notify();
+}
+
+#include "exa-wayland-trampolines.h"
+
+static const struct event_trampoline_table * find_event_trampolines(const struct wl_interface * interface) {
+
+  for (unsigned int i = 0; i < sizeof(event_trampoline_tables)/sizeof(event_trampoline_tables[0]); ++i) {
+
+    if (strcmp(event_trampoline_tables[i].interface, interface->name) == 0)
+      return &event_trampoline_tables[i];
+  }
+
+  return NULL;
+}
+
+/* Record and replay (EXA_WAYLAND_RECORD, EXA_WAYLAND_REPLAY). The log is a magic followed by
+   records: the JS events consumed by wl_display_dispatch, with an end of batch marker (type 0)
+   when the ring runs dry, and the requests handled by wl_proxy_marshal_flags with their arguments.
+   Interfaces are written by name once, then referred to by index */
+
+#define RECORD_MAGIC "EXAWLOG1"
+#define RECORD_BUFFER_SIZE 65536
+#define RECORD_PAYLOAD_MAX 4096
+#define RECORD_STRING_MAX 1024 // longer strings are truncated
+
+enum record_kind {
+
+  RECORD_EVENT = 1,  // code: JS event type, payload: 3 int32
+  RECORD_REQUEST,    // code: opcode, payload: interface index, then the arguments
+  RECORD_INTERFACE,  // code: interface index, payload: name
 };
 
-static const struct wl_message wl_display_requests[] = {
-	{ "sync", "n", wayland_types + 8 },
-	{ "get_registry", "n", wayland_types + 9 },
-};
+struct record_header {
+
+  uint8_t kind;
+  uint8_t reserved;
+  uint16_t code;
+  uint32_t size; // payload bytes, multiple of 4
+  double ts;     // ms since the start of the recording
+};
+
+struct recorder {
+
+  int fd; // -1 when not recording
+  char * buffer;
+  size_t used;
+  double start;
+  int nb_interfaces; // names already written
+  unsigned int batch; // events since the last end of batch marker
+};
+
+struct replayer {
+
+  char * log; // NULL when not replaying
+  size_t size;
+  size_t event_pos;
+  size_t request_pos;
+  int original_pacing;
+  double start;
+  unsigned int events;
+  unsigned int requests_checked;
+  unsigned int requests_diverged;
+};
+
+static struct recorder recorder = { .fd = -1 };
+static struct replayer replayer;
+
+#define RECORD_ENABLED() (recorder.fd >= 0)
+#define REPLAY_ENABLED() (replayer.log != NULL)
+
+static void record_flush(void) {
+
+  if (recorder.used && (write(recorder.fd, recorder.buffer, recorder.used) != (ssize_t)recorder.used))
+    LOG_WARN("record_flush: write failed");
+
+  recorder.used = 0;
+}
+
+static void record_write(enum record_kind kind, uint16_t code, double ts, const void * payload, uint32_t size) {
+
+  struct record_header header = { kind, 0, code, size, ts - recorder.start };
+
+  if ((recorder.used + sizeof(header) + size) > RECORD_BUFFER_SIZE)
+    record_flush();
+
+  memcpy(recorder.buffer + recorder.used, &header, sizeof(header));
+  memcpy(recorder.buffer + recorder.used + sizeof(header), payload, size);
+
+  recorder.used += sizeof(header) + size;
+}
+
+// Arguments as 32 bit words: objects by interface index + 1, strings by length and bytes, arrays by size
+
+static uint32_t record_request_args(char * payload, const char * signature, va_list ap) {
+
+  uint32_t size = 0;
+
+  for (signature = skip_event_version(signature); *signature; ++signature) {
+
+    if ( (*signature == '?') || ((*signature >= '0') && (*signature <= '9')) )
+      continue;
+
+    if ((size + 8) > RECORD_PAYLOAD_MAX)
+      break;
+
+    int32_t word = 0;
+
+    switch (*signature) {
+
+    case 'i':
+    case 'u':
+    case 'f':
+    case 'h':
+      word = va_arg(ap, int32_t);
+      break;
+    case 'o': {
+
+      struct wl_proxy * object = va_arg(ap, struct wl_proxy *);
+
+      const struct interface_descriptor * descriptor = (object && object->interface)?proxy_get_descriptor(object):NULL;
+
+      word = (descriptor)?(descriptor - interface_descriptors) + 1:0;
+      break;
+    }
+    case 'n':
+      (void)va_arg(ap, void *);
+      break;
+    case 'a': {
+
+      struct wl_array * array = va_arg(ap, struct wl_array *);
+
+      word = (array)?array->size:0;
+      break;
+    }
+    case 's': {
+
+      const char * s = va_arg(ap, const char *);
+
+      uint32_t len = (s)?strlen(s):0;
+
+      if (len > RECORD_STRING_MAX)
+	len = RECORD_STRING_MAX;
+
+      if ((size + 4 + len + 4) > RECORD_PAYLOAD_MAX)
+	len = 0;
+
+      memcpy(payload + size, &len, 4);
+      memcpy(payload + size + 4, s, len);
+
+      size += 4 + ((len + 3) & ~3u);
+      continue;
+    }
+    default:
+      break;
+    }
+
+    memcpy(payload + size, &word, 4);
+    size += 4;
+  }
+
+  return size;
+}
+
+static int replay_check_request(const char * payload, uint32_t size, uint16_t opcode);
+
+static void record_request(struct wl_proxy * proxy, uint32_t opcode, va_list ap) {
+
+  const struct interface_descriptor * descriptor = proxy_get_descriptor(proxy);
+
+  if (!descriptor || (opcode >= proxy->interface->method_count))
+    return;
+
+  int index = descriptor - interface_descriptors;
+
+  static char payload[RECORD_PAYLOAD_MAX];
+
+  uint32_t word = index;
+
+  memcpy(payload, &word, 4);
+
+  uint32_t size = 4 + record_request_args(payload + 4, proxy->interface->methods[opcode].signature, ap);
+
+  if (REPLAY_ENABLED()) {
+
+    replay_check_request(payload, size, opcode);
+    return;
+  }
+
+  // Interface names the first time they are seen, descriptors are never removed
+
+  for (; recorder.nb_interfaces <= index; ++recorder.nb_interfaces) {
+
+    const char * name = interface_descriptors[recorder.nb_interfaces].interface->name;
+
+    char padded[128] = { 0 };
+
+    strncpy(padded, name, sizeof(padded) - 1);
+
+    record_write(RECORD_INTERFACE, recorder.nb_interfaces, emscripten_get_now(), padded, (strlen(padded) + 4) & ~3u);
+  }
+
+  record_write(RECORD_REQUEST, opcode, emscripten_get_now(), payload, size);
+}
+
+static void record_event(int type, int arg1, int arg2, int arg3, double ts) {
+
+  // Clipboard events carry fds and pointers that mean nothing in another session
+
+  if ( (type == 14) || (type == 15) )
+    return;
+
+  if (type == 0) {
+
+    if (!recorder.batch)
+      return;
+
+    recorder.batch = 0;
+    ts = emscripten_get_now();
+  }
+  else {
+
+    ++recorder.batch;
+  }
+
+  int32_t args[3] = { arg1, arg2, arg3 };
+
+  record_write(RECORD_EVENT, type, ts, args, sizeof(args));
+}
+
+static void record_open(const char * path) {
+
+  recorder.buffer = (char *)malloc(RECORD_BUFFER_SIZE);
+  recorder.fd = (recorder.buffer)?open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644):-1;
+
+  if (recorder.fd < 0) {
+
+    LOG_WARN("record_open: cannot record to %s", path);
+
+    free(recorder.buffer);
+    recorder.buffer = NULL;
+    return;
+  }
+
+  recorder.start = emscripten_get_now();
+
+  memcpy(recorder.buffer, RECORD_MAGIC, 8);
+  recorder.used = 8;
+}
+
+static void record_close(void) {
+
+  record_flush();
+  close(recorder.fd);
+
+  free(recorder.buffer);
+
+  recorder.fd = -1;
+  recorder.buffer = NULL;
+}
+
+// Next record of a kind from pos, NULL at the end of the log
+
+static const struct record_header * replay_find(size_t * pos, enum record_kind kind) {
+
+  while ((*pos + sizeof(struct record_header)) <= replayer.size) {
+
+    const struct record_header * header = (const struct record_header *)(replayer.log + *pos);
+
+    if ((*pos + sizeof(struct record_header) + header->size) > replayer.size)
+      break;
+
+    *pos += sizeof(struct record_header) + header->size;
+
+    if (header->kind == kind)
+      return header;
+  }
+
+  *pos = replayer.size;
+
+  return NULL;
+}
+
+// Requests of the replayed client are compared with the recorded ones, in order
+
+static int replay_check_request(const char * payload, uint32_t size, uint16_t opcode) {
+
+  const struct record_header * header = replay_find(&replayer.request_pos, RECORD_REQUEST);
+
+  ++replayer.requests_checked;
+
+  if (!header || (header->code != opcode) || (header->size != size) || memcmp(header + 1, payload, size)) {
+
+    ++replayer.requests_diverged;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void replay_set_js(int replay) {
+
+  const char * fun = "Module['wayland'].replay = $0;";
+
+  static int replay_set_js_handle = -1;
+
+  if (replay_set_js_handle < 0)
+    replay_set_js_handle = emscripten_load_fun(fun, "vi");
+
+  js_run(replay_set_js_handle, replay);
+}
+
+static void replay_close(void) {
+
+  LOG_INFO("replay: %u events in %.1f ms, %u requests checked, %u diverged", replayer.events, emscripten_get_now() - replayer.start, replayer.requests_checked, replayer.requests_diverged);
+
+  free(replayer.log);
+  replayer.log = NULL;
+
+  replay_set_js(0);
+}
+
+static void replay_open(const char * path) {
+
+  int fd = open(path, O_RDONLY);
+
+  off_t size = (fd >= 0)?lseek(fd, 0, SEEK_END):-1;
+
+  if (size <= 8) {
+
+    LOG_WARN("replay_open: cannot replay %s", path);
+
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+
+  replayer.log = (char *)malloc(size);
+  replayer.size = size;
+
+  lseek(fd, 0, SEEK_SET);
+
+  if (!replayer.log || (read(fd, replayer.log, size) != size) || memcmp(replayer.log, RECORD_MAGIC, 8)) {
+
+    LOG_WARN("replay_open: %s is not a log", path);
+
+    free(replayer.log);
+    replayer.log = NULL;
+  }
+
+  close(fd);
+
+  if (!replayer.log)
+    return;
+
+  const char * pacing = getenv("EXA_WAYLAND_REPLAY_PACING");
+
+  replayer.original_pacing = (pacing && (strcmp(pacing, "original") == 0));
+  replayer.event_pos = 8;
+  replayer.request_pos = 8;
+  replayer.start = emscripten_get_now();
+}
+
+/* Writes the next recorded batch in the ring, as the JS glue would, once the ring is empty.
+   Live JS events are dropped while replaying (Module['wayland'].replay) */
+
+static void replay_pump(struct js_event_ring * ring) {
+
+  if (ring->head != ring->tail)
+    return;
+
+  while ((ring->head - ring->tail) < ring->size) {
+
+    size_t pos = replayer.event_pos;
+
+    const struct record_header * header = replay_find(&pos, RECORD_EVENT);
+
+    if (!header) {
+
+      replay_close();
+      return;
+    }
+
+    if (replayer.original_pacing) {
+
+      double delay = header->ts - (emscripten_get_now() - replayer.start);
+
+      if (delay > 0)
+	usleep(delay * 1000);
+    }
+
+    replayer.event_pos = pos;
+
+    if (header->code == 0) // end of batch
+      break;
+
+    const int32_t * args = (const int32_t *)(header + 1);
+
+    struct js_event * record = &ring->records[ring->head & (ring->size - 1)];
+
+    record->type = header->code;
+    record->args[0] = args[0];
+    record->args[1] = args[1];
+    record->args[2] = args[2];
+    record->args[3] = 0;
+    record->timestamp = emscripten_get_now();
+
+    ++ring->head;
+    ++replayer.events;
+  }
+}
+
+struct wl_display * wl_display_connect(const char *name) {
+
+  const char * level = getenv("EXA_WAYLAND_LOG_LEVEL");
+
+  if (level)
+    log_level = atoi(level);
+
+  if (getenv("EXA_WAYLAND_TRACE") && !tracer.records) {
+
+    tracer.records = (struct trace_record *)malloc(TRACE_RECORDS_MAX * sizeof(struct trace_record));
+    tracer.count = 1;
+  }
+
+  const char * record_path = getenv("EXA_WAYLAND_RECORD");
+  const char * replay_path = getenv("EXA_WAYLAND_REPLAY");
+
+  if (replay_path && !REPLAY_ENABLED())
+    replay_open(replay_path);
+  else if (record_path && !RECORD_ENABLED())
+    record_open(record_path);
+
+  LOG_INFO("--> wl_display_connect");
+  
+  /*EM_ASM_({*/
+
+  const char * fun = "const fd = 0x7e000000;"
+
+      "let desc = {};"
+
+      "desc['fd'] = fd;"
+      "desc['remote_fd'] = -1;"
+      "desc['select'] = (fd, rw, start, notif_select) => {"
+
+	"if (start) {"
+
+    //"//console.log(\"select wayland display: fd=\"+fd+\", rw=\"+rw+\", start=\"+start);"
+
+	  "if ( (Module['wayland'].pending()) || (Module['wayland'].queueNotEmpty) ) {"
+
+	    "Module['fd_table'][fd].notif_select = null;"
+	    "notif_select(fd, rw);"
+	  "}"
+	  "else {"
+
+	    "Module['fd_table'][fd].notif_select = notif_select;"
+	  "}"
+	"}"
+	"else {"
+
+	  "Module['fd_table'][fd].notif_select = null;"
+	"}"
+	
+      "};"
+
+    "Module['fd_table'][fd] = desc;"
+
+    "if (!('wayland' in Module)) {"
+    
+	"Module['wayland'] = {};"
+	"Module['wayland'].requests = new Array();"
+	"Module['wayland'].events = new Array();"
+
+	"Module['wayland'].render = function() {"
+
+	  // A surface whose last buffer is still converted by the thread pool waits for the next frame
+
+	  "const waiting = new Set();"
+
+	  "for (const request of Module['wayland'].requests) {"
+
+	    "if ( (request.type == 'commit') && request.ready && (Atomics.load(Module.HEAP32, request.ready >> 2) != request.seq) )"
+	      "waiting.add(request.surface_id);"
+	    "else if (request.type == 'commit')"
+	      "waiting.delete(request.surface_id);"
+	  "}"
+
+	  // Only the last commit of a surface is drawn, with the damage of the commits it supersedes
+
+	  "const last = new Map();"
+
+	  "for (const request of Module['wayland'].requests) {"
+
+	    "if ( (request.type != 'commit') || waiting.has(request.surface_id) )"
+	      "continue;"
+
+	    "const previous = last.get(request.surface_id);"
+
+	    "if (previous) {"
+
+	      "previous.superseded = true;"
+	      "request.damage = (previous.damage && request.damage)?previous.damage.concat(request.damage):null;"
+	    "}"
+
+	    "last.set(request.surface_id, request);"
+	  "}"
+
+	  "for (const request of Module['wayland'].requests) {"
+
+    //"//console.log(\"Wayland client: render -> \"+request.type);"
+
+	    "if ( (request.type == 'commit') && waiting.has(request.surface_id) )"
+	      "continue;"
+
+	    // The canvas is gone when the surface was destroyed after this commit: the buffer is only released
+
+	    "let canvas = (request.type == 'commit')?Module['surfaces'][request.surface_id-1]:null;"
+
+	    "if ( canvas && !request.superseded && request.pixels ) {"
+
+	      // The alpha of a context is fixed: the canvas is replaced when the surface becomes opaque or translucent
+
+	      "let full = !request.damage;"
+
+	      "if ( canvas.wlContext && (canvas.wlOpaque != request.opaque) ) {"
+
+		"canvas = Module['wayland'].replaceCanvas(request.surface_id, canvas);"
+		"full = true;"
+	      "}"
+
+	      "if (!canvas.wlContext) {"
+
+		"canvas.wlContext = canvas.getContext('2d', { 'alpha': !request.opaque });"
+		"canvas.wlOpaque = request.opaque;"
+	      "}"
+
+	      "const ctx = canvas.wlContext;"
+
+	      // Damage covering most of the surface is uploaded at once, as its bounding box: only the damaged rows are converted
+
+	      "if (!full) {"
+
+		"let area = 0;"
+		"let x0 = request.width, y0 = request.height, x1 = 0, y1 = 0;"
+
+		"for (let i = 0; i < request.damage.length; i += 4) {"
+
+		  "area += Math.min(request.damage[i+2], request.width) * Math.min(request.damage[i+3], request.height);"
+
+		  "x0 = Math.min(x0, request.damage[i]); y0 = Math.min(y0, request.damage[i+1]);"
+		  "x1 = Math.max(x1, request.damage[i] + request.damage[i+2]); y1 = Math.max(y1, request.damage[i+1] + request.damage[i+3]);"
+		"}"
+
+		"if (4 * area >= 3 * request.width * request.height)"
+		  "request.damage = [x0, y0, x1 - x0, y1 - y0];"
+	      "}"
+
+	      "if ( (canvas.width != request.width) || (canvas.height != request.height) ) {"
+	        "full = true;"
+	        "canvas.width = request.width;"
+	        "canvas.height = request.height;"
+
+	        "canvas.style.width = request.width/window.devicePixelRatio + \"px\";"
+	        "canvas.style.height = request.height/window.devicePixelRatio + \"px\";"
+	        "canvas.parentElement.style.width = request.width/window.devicePixelRatio + \"px\";"
+	      "}"
+
+              "const imageData = Module['wayland'].getImage(request, (full)?null:request.damage);"
+
+	      "const seq = canvas.wlSeq = (canvas.wlSeq || 0) + 1;"
+
+	      "const start = performance.now();"
+
+	      // Large surfaces go through createImageBitmap, which snapshots the pixels before returning
+
+	      "if ( Module['wayland'].bitmapThreshold && ((request.width * request.height) >= Module['wayland'].bitmapThreshold) && (Module['wayland'].inFlight < 2) ) {"
+
+		"const damage = (full)?null:request.damage;"
+
+		"++Module['wayland'].inFlight;"
+		"request.async = true;"
+
+		"createImageBitmap(imageData).then((bitmap) => {"
+
+		    "--Module['wayland'].inFlight;"
+
+		    // A later frame already drawn wins
+
+		    "if (seq > (canvas.wlDrawn || 0)) {"
+
+		      "canvas.wlDrawn = seq;"
+
+		      "if (!damage) {"
+
+			"ctx.drawImage(bitmap, 0, 0);"
+		      "}"
+		      "else {"
+
+			"for (let i = 0; i < damage.length; i += 4)"
+			  "ctx.drawImage(bitmap, damage[i], damage[i+1], damage[i+2], damage[i+3], damage[i], damage[i+1], damage[i+2], damage[i+3]);"
+		      "}"
+		    "}"
+
+		    "bitmap.close();"
+
+		    "Module['wayland'].pushEvent({"
+
+			"'type': 2," // frame done"
+			"'surface_id': request.surface_id,"
+			"'timestamp': new Date().getTime(),"
+			"'render': performance.now() - start"
+		      "});"
+
+		    "Module['wayland'].wakeUp();"
+		  "});"
+	      "}"
+	      "else {"
+
+		"canvas.wlDrawn = seq;"
+
+		"if (full) {"
+
+		  "ctx.putImageData(imageData, 0, 0);"
+		"}"
+		"else {"
+
+		  "for (let i = 0; i < request.damage.length; i += 4)"
+		    "ctx.putImageData(imageData, 0, 0, request.damage[i], request.damage[i+1], request.damage[i+2], request.damage[i+3]);"
+		"}"
+
+		"request.render = performance.now() - start;"
+	      "}"
+	    "}"
+
+	    "if (request.type == 'commit') {"
+
+	      "Module['wayland'].pushEvent({"
+
+		"'type': 1," // buffer released"
+		"'surface_id': request.surface_id,"
+		"'buffer_id': request.buffer_id"
+		"});"
+
+	      "if (!request.async)"
+	      "Module['wayland'].pushEvent({"
+
+		"'type': 2," // frame done"
+		"'surface_id': request.surface_id,"
+		"'timestamp': new Date().getTime(),"
+		"'render': request.render || 0"
+		"});"
+	    "}"
+    
+	  "}"
+
+	  "if (Module['wayland'].pending()) {"
+
+	    "setTimeout(() => {"
+
+		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+    //"// TODO check rw"
+		      
+		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		  "}"
+		    
+		"}, 0);"
+	  "}"
+	  
+	  "Module['wayland'].requests = (waiting.size > 0)?Module['wayland'].requests.filter((request) => (request.type == 'commit') && waiting.has(request.surface_id)):new Array();"
+
+	  "window.requestAnimationFrame(Module['wayland'].render);"
+
+	  "if (Module.swapCounter) {"
+
+	    "if (Module.swapCounter > 0) {"
+
+	      "Module.swapCounter -= 1;"
+	    "}"
+
+	    "if ( (Module.swapCounter == 0) && (Module.swapBuffersWakeUp) ) {"
+
+	      "Module.swapCounter = Module.swapInterval;"
+
+	      "const wakeUp = Module.swapBuffersWakeUp;"
+	      
+	      "Module.swapBuffersWakeUp = null;"
+	      "wakeUp(1);"
+	    "}"
+    
+	  "}"
+    
+	"};"
+
+    
+
+	"Module['wayland'].queueNotEmpty = 0;"
+
+	"Module['wayland'].wakeUpPending = 0;"
+
+	// New canvas in place of a surface's one, with its attributes, listeners and state, for a context of another alpha
+
+	"Module['wayland'].replaceCanvas = function(id, canvas) {"
+
+	  "const fresh = document.createElement('canvas');"
+
+	  "for (const attr of canvas.attributes)"
+	    "fresh.setAttribute(attr.name, attr.value);"
+
+	  "fresh.width = canvas.width;"
+	  "fresh.height = canvas.height;"
+
+	  "for (const key of ['wlListen', 'wlInput', 'wlInside', 'wlButtons', 'wlSeq', 'wlDrawn'])"
+	    "fresh[key] = canvas[key];"
+
+	  "fresh.wlListen(fresh);"
+
+	  "const focused = (document.activeElement === canvas);"
+
+	  "canvas.replaceWith(fresh);"
+
+	  "Module['surfaces'][id-1] = fresh;"
+
+	  "if (focused)"
+	    "fresh.focus();"
+
+	  "return fresh;"
+	"};"
+
+	"Module['wayland'].images = new Map();"
+	"Module['wayland'].staged = new Map();" // surface id -> buffer id last copied to its staging image
+	"Module['wayland'].inFlight = 0;" // createImageBitmap frames
+
+	// ImageData over the RGBA pixels of a wl_buffer, converted by C at commit (see pixel.h).
+	// Rebuilt only when they moved or the wasm heap grew (detaching HEAPU8.buffer).
+	// ImageData rejects views of a shared heap (threads build): the damaged rectangles, or
+	// everything when damage is null, are then copied to an unshared staging image. As damage
+	// is relative to the previous frame, all of it is copied when that came from another buffer
+
+	"Module['wayland'].getImage = function(request, damage) {"
+
+	  "let image = Module['wayland'].images.get(request.buffer_id);"
+
+	  "const shared = (typeof SharedArrayBuffer !== 'undefined') && (Module.HEAPU8.buffer instanceof SharedArrayBuffer);"
+
+	  "if ( !image || (image.heap !== Module.HEAPU8.buffer) || (image.pixels != request.pixels) || (image.data.width != request.width) || (image.data.height != request.height) ) {"
+
+	    "image = {"
+	      "'heap': Module.HEAPU8.buffer,"
+	      "'pixels': request.pixels,"
+	      "'data': (shared)?new ImageData(request.width, request.height):new ImageData(new Uint8ClampedArray(Module.HEAPU8.buffer, request.pixels, request.width * request.height * 4), request.width, request.height)"
+	    "};"
+
+	    "Module['wayland'].images.set(request.buffer_id, image);"
+
+	    "damage = null;"
+	  "}"
+
+	  "if (shared) {"
+
+	    "if (Module['wayland'].staged.get(request.surface_id) !== request.buffer_id)"
+	      "damage = null;"
+
+	    "Module['wayland'].staged.set(request.surface_id, request.buffer_id);"
+
+	    "const dst = image.data.data;"
+	    "const stride = request.width * 4;"
+
+	    "if (!damage) {"
+
+	      "dst.set(Module.HEAPU8.subarray(request.pixels, request.pixels + stride * request.height));"
+	    "}"
+	    "else {"
+
+	      "for (let i = 0; i < damage.length; i += 4) {"
+
+		"const x0 = Math.max(damage[i], 0), x1 = Math.min(damage[i] + damage[i+2], request.width);"
+		"const y0 = Math.max(damage[i+1], 0), y1 = Math.min(damage[i+1] + damage[i+3], request.height);"
+
+		"for (let y = y0; (y < y1) && (x1 > x0); ++y) {"
+
+		  "const offset = y * stride + x0 * 4;"
+
+		  "dst.set(Module.HEAPU8.subarray(request.pixels + offset, request.pixels + offset + (x1 - x0) * 4), offset);"
+		"}"
+	      "}"
+	    "}"
+	  "}"
+
+	  "return image.data;"
+	"};"
+
+	// Encode an event as a binary record in the ring shared with wl_display_dispatch
+
+	"Module['wayland'].writeEvent = function(event) {"
+
+	  "const base = Module['wayland'].ring >> 2;"
+	  "const head = Module.HEAP32[base] >>> 0;"
+	  "const size = Module.HEAP32[base+2];"
+
+	  "if ( ((head - (Module.HEAP32[base+1] >>> 0)) >>> 0) >= size )"
+	    "return false;"
+
+	  "let a0 = 0, a1 = 0, a2 = 0;"
+
+	  "switch (event.type) {"
+
+	  "case 1:" // buffer released
+	    "a0 = event.surface_id; a1 = event.buffer_id;"
+	    "break;"
+	  "case 2:" // frame done, render time in us
+	    "a0 = event.surface_id; a1 = event.timestamp; a2 = (event.render * 1000) | 0;"
+	    "break;"
+	  "case 3:" // key down
+	  "case 4:" // key up
+	    "a0 = event.key; a1 = event.timestamp;"
+	    "break;"
+	  "case 5:" // close button pressed
+	  "case 16:" // window resized
+	    "a0 = event.surface_id; a1 = event.width; a2 = event.height;"
+	    "break;"
+	  "case 6:" // mods updated
+	    "a0 = event.mods;"
+	    "break;"
+	  "case 7:" // wheel, converted to fixed
+	    "a0 = event.id; a1 = event.deltaX * 256; a2 = event.deltaY * 256;"
+	    "break;"
+	  "case 8:" // button
+	    "a0 = event.id; a1 = event.state; a2 = 0x110;"
+
+	    "if (event.button == 2)" // right
+	      "a2 = 0x111;"
+	    "else if (event.button == 1)" // middle
+	      "a2 = 0x112;"
+	    "break;"
+	  "case 9:" // move
+	  "case 10:" // mouse enter
+	    "a0 = event.id; a1 = event.x * 256; a2 = event.y * 256;"
+	    "break;"
+	  "case 14:" // ps receive
+	    "a0 = event.fd;"
+	    "break;"
+	  "case 15: {" // data receive, the string is freed by wl_display_dispatch
+
+	    "const len = lengthBytesUTF8(event.data)+1;"
+	    "const ptr = Module._malloc(len);"
+
+	    "stringToUTF8Array(event.data, Module.HEAPU8, ptr, len);"
+
+	    "a0 = event.fd; a1 = ptr;"
+	    "break;"
+	  "}"
+	  "default:" // mouse leave, keyboard enter and leave
+	    "a0 = event.id;"
+	    "break;"
+	  "}"
+
+	  "const r = base + 4 + (head & (size-1)) * 8;"
+
+	  "Module.HEAP32[r] = event.type;"
+	  "Module.HEAP32[r+1] = a0;"
+	  "Module.HEAP32[r+2] = a1;"
+	  "Module.HEAP32[r+3] = a2;"
+	  "Module.HEAP32[r+4] = 0;"
+	  "Module.HEAPF64[(r >> 1) + 3] = event.time;"
+
+	  "Module.HEAP32[base] = head + 1;"
+
+	  "return true;"
+	"};"
+
+	// Region boxes (x1, y1, x2, y2) as the x, y, width, height rectangles of the canvas API
+
+	"Module['wayland'].boxRects = function(boxes, n) {"
+
+	  "const b = Module.HEAP32.subarray(boxes >> 2, (boxes >> 2) + n * 4);"
+	  "const rects = new Array(n * 4);"
+
+	  "for (let i = 0; i < n * 4; i += 4) {"
+
+	    "rects[i] = b[i]; rects[i+1] = b[i+1];"
+	    "rects[i+2] = b[i+2] - b[i]; rects[i+3] = b[i+3] - b[i+1];"
+	  "}"
+
+	  "return rects;"
+	"};"
+
+	// Input region of a canvas, boxes sorted by y as they are banded: none means the whole canvas
+
+	"Module['wayland'].inInput = function(canvas, x, y) {"
+
+	  "const r = canvas.wlInput;"
+
+	  "if (!r)"
+	    "return true;"
+
+	  "for (let i = 0; (i < r.length) && (r[i+1] <= y); i += 4) {"
+
+	    "if ( (y < r[i+3]) && (x >= r[i]) && (x < r[i+2]) )"
+	      "return true;"
+	  "}"
+
+	  "return false;"
+	"};"
+
+	// Crossing the border of the input region is an enter or leave instead of a motion, unless a button is held
+
+	"Module['wayland'].pointerMoved = function(canvas, id, x, y) {"
+
+	  "if (canvas.wlButtons)" // grabbed by a pressed button
+	    "return true;"
+
+	  "const inside = Module['wayland'].inInput(canvas, x, y);"
+
+	  "if (inside == (canvas.wlInside !== false))"
+	    "return inside;"
+
+	  "canvas.wlInside = inside;"
+
+	  "Module['wayland'].pushEvent({"
+
+	      "'type': (inside)?10:11," // mouseenter, mouseleave
+	      "'id': id,"
+	      "'x': x,"
+	      "'y': y"
+	      "});"
+
+	  "return false;"
+	"};"
+
+	"Module['wayland'].pushEvent = function(event) {"
+
+	  "if (Module['wayland'].replay)"
+	    "return;"
+
+	  "event.time = performance.now();"
+
+	  "if ( (Module['wayland'].events.length == 0) && Module['wayland'].writeEvent(event) )"
+	    "return;"
+
+	  // Ring full: keep order by queueing behind the records that are waiting
+
+	  "Module['wayland'].events.push(event);"
+	  "Module.HEAP32[(Module['wayland'].ring >> 2)+3] = Module['wayland'].events.length;"
+	"};"
+
+	"Module['wayland'].refill = function() {"
+
+	  "let n = 0;"
+
+	  "while ( (n < Module['wayland'].events.length) && Module['wayland'].writeEvent(Module['wayland'].events[n]) )"
+	    "++n;"
+
+	  "Module['wayland'].events.splice(0, n);"
+	  "Module.HEAP32[(Module['wayland'].ring >> 2)+3] = Module['wayland'].events.length;"
+	"};"
+
+	"Module['wayland'].pending = function() {"
+
+	  "const base = Module['wayland'].ring >> 2;"
+
+	  "return (Module['wayland'].events.length > 0) || (Module.HEAP32[base] != Module.HEAP32[base+1]);"
+	"};"
+
+	"Module['wayland'].wakeUp = function() {"
+
+	  "if (Module['wayland'].wakeUpPending)"
+	    "return;"
+
+	  "Module['wayland'].wakeUpPending = 1;"
+
+	  "setTimeout(() => {"
+
+	      "Module['wayland'].wakeUpPending = 0;"
+
+	      "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		"Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+	      "}"
+
+	    "}, 0);"
+	"};"
+    "}"
+
+    "Module['wayland'].ring = $0;"
+    "Module['wayland'].logLevel = $1;"
+    "Module['wayland'].replay = $2;"
+    "Module['wayland'].bitmapThreshold = $3;";
+    
+    /*});*/
+
+  static int display_connect_handle = -1;
+
+  if (display_connect_handle < 0)
+    display_connect_handle = emscripten_load_fun(fun, "vpiii");
+
+  // Surfaces of at least this many pixels are drawn through createImageBitmap, 0 to never
+
+  const char * bitmap = getenv("EXA_WAYLAND_IMAGE_BITMAP");
+  
+  js_run(display_connect_handle, &js_event_ring, log_level, REPLAY_ENABLED(), (bitmap)?atoi(bitmap):0);
+
+#ifdef EXA_WAYLAND_THREADS
+  convert_pool_start();
+#endif
+
+  const char * tiles = getenv("EXA_WAYLAND_TILE_DIFF");
+
+  tile_diff = (tiles)?atoi(tiles):0;
+  
+  
+  display.head = 0;
+  display.tail = 0;
+  display.wakeup_armed = 0;
+
+  const char * policy = getenv("EXA_WAYLAND_QUEUE_POLICY");
+
+  if (policy) {
+
+    if (strcmp(policy, "coalesce") == 0)
+      display.queue_policy = EVENT_QUEUE_POLICY_COALESCE;
+    else if (strcmp(policy, "drop-motion") == 0)
+      display.queue_policy = EVENT_QUEUE_POLICY_DROP_MOTION;
+    else if (strcmp(policy, "dispatch") == 0)
+      display.queue_policy = EVENT_QUEUE_POLICY_DISPATCH;
+    else
+      display.queue_policy = EVENT_QUEUE_POLICY_GROW;
+  }
+
+  const char * queue_max = getenv("EXA_WAYLAND_QUEUE_MAX");
+
+  if (queue_max) {
+
+    // Rounded up to a power of two, never below the initial size
+
+    unsigned int max = EVENT_QUEUE_SIZE;
+
+    while ( (max < (unsigned int)atoi(queue_max)) && (max < (1u << 20)) )
+      max *= 2;
+
+    display.queue_size_max = max;
+  }
+
+  if (REPLAY_ENABLED())
+    replay_pump(&js_event_ring);
+
+  LOG_INFO("<-- wl_display_connect");
+  
+  return &display;
+}
+
+static void trace_input(int type, double ts) {
+
+  uint32_t serial = trace_mark(TRACE_INPUT, ts, 0, 0, 0, type);
+
+  if (!serial)
+    return;
+
+  tracer.records[serial].serial = serial;
+
+  if (!tracer.pending)
+    tracer.pending = serial;
+
+  if (!tracer.undispatched)
+    tracer.undispatched = serial;
+}
+
+// The oldest input since the previous commit is the one this frame answers
+
+static void trace_commit(struct wl_surface * surface) {
+
+  trace_mark(TRACE_COMMIT, emscripten_get_now(), 0, surface->id, tracer.pending, 0);
+
+  if (!surface->trace_input)
+    surface->trace_input = tracer.pending;
+
+  tracer.pending = 0;
+}
+
+static void trace_render(struct wl_surface * surface, double ts, float render) {
+
+  trace_mark(TRACE_RENDER, ts - render, render, surface->id, surface->trace_input, 0);
+  trace_mark(TRACE_FRAME_DONE, emscripten_get_now(), 0, surface->id, surface->trace_input, 0);
+
+  surface->trace_input = 0;
+}
+
+static const char * trace_input_name(int type) {
+
+  switch (type) {
+
+  case 3:
+    return "keydown";
+  case 4:
+    return "keyup";
+  case 7:
+    return "wheel";
+  case 8:
+    return "button";
+  case 9:
+    return "motion";
+  default:
+    return "input";
+  }
+}
+
+int exa_wayland_dump_trace(int fd) {
+
+  static const char * const stage_names[] = { "input", "dispatch", "commit", "render", "frame done" };
+
+  if (!TRACE_ENABLED())
+    return -1;
+
+  int pid = getpid();
+
+  dprintf(fd, "{\"traceEvents\":[\n");
+  dprintf(fd, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"exa-wayland\"}},\n", pid);
+  dprintf(fd, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"input\"}}", pid);
+
+  // Inputs on thread 0, the other stages on the thread of their surface
+
+  for (unsigned int i = 1; i < tracer.count; ++i) {
+
+    const struct trace_record * record = &tracer.records[i];
+
+    const char * name = (record->stage == TRACE_INPUT)?trace_input_name(record->type):stage_names[record->stage];
+
+    if (record->stage == TRACE_RENDER)
+      dprintf(fd, ",\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"serial\":%u}}", name, record->ts * 1000.0, record->dur * 1000.0, pid, record->surface, record->serial);
+    else
+      dprintf(fd, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"serial\":%u}}", name, (record->stage == TRACE_INPUT)?"input":"frame", record->ts * 1000.0, pid, record->surface, record->serial);
+
+    // Latency of the frame: from the input it answers to the end of putImageData
+
+    if ( (record->stage == TRACE_RENDER) && record->serial ) {
+
+      const struct trace_record * input = &tracer.records[record->serial];
+
+      dprintf(fd, ",\n{\"name\":\"input-to-photon\",\"cat\":\"latency\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"serial\":%u,\"input\":\"%s\"}}", input->ts * 1000.0, (record->ts + record->dur - input->ts) * 1000.0, pid, record->surface, record->serial, trace_input_name(input->type));
+    }
+  }
+
+  dprintf(fd, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%u}}\n", tracer.dropped);
+
+  return 0;
+}
+
+int exa_wayland_get_stats(struct exa_wayland_stats * stats) {
+
+  if (!stats)
+    return -1;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for (int i = 0; i < nb_interface_descriptors; ++i) {
+
+    const struct interface_descriptor * descriptor = &interface_descriptors[i];
+
+    for (int j = 0; j < descriptor->interface->method_count; ++j)
+      stats->requests += descriptor->request_counts[j];
+
+    for (int j = 0; j < descriptor->interface->event_count; ++j)
+      stats->events += descriptor->event_counts[j];
+  }
+
+  stats->queue_size = display.queue_size;
+  stats->queue_high_water = display.queue_stats.high_water;
+  stats->queue_overflows = display.queue_stats.overflows;
+  stats->queue_grows = display.queue_stats.grows;
+  stats->events_coalesced = display.queue_stats.coalesced;
+  stats->motions_dropped = display.queue_stats.dropped_motions;
+  stats->events_lost = display.queue_stats.lost;
+  stats->motions_merged = display.queue_stats.merged_motions;
+  stats->axes_merged = display.queue_stats.merged_axes;
+  stats->wakeups = display.queue_stats.wakeups;
+  stats->wakeups_coalesced = display.queue_stats.wakeups_coalesced;
+
+  stats->js_calls = client_stats.js_calls;
+  stats->js_events = client_stats.js_events;
+  stats->js_ring_high_water = client_stats.ring_high_water;
+  stats->js_ring_refills = client_stats.ring_refills;
+
+  stats->commits = client_stats.commits;
+  stats->frame_callbacks = client_stats.frame_callbacks;
+  stats->frames_done = client_stats.frames_done;
+  stats->buffers_released = client_stats.buffers_released;
+  stats->rows_converted = client_stats.rows_converted;
+  stats->frames_unchanged = client_stats.frames_unchanged;
+  stats->upload_bytes_saved = client_stats.upload_bytes_saved;
+
+  stats->arena_allocs = display.arena.allocs;
+  stats->heap_allocs = display.arena.heap_allocs;
+
+  for (int i = 0; i < NB_OBJECT_POOLS; ++i) {
+
+    stats->objects_allocated += object_pools[i].allocs;
+    stats->objects_in_use += object_pools[i].in_use;
+    stats->heap_allocs += object_pools[i].chunks;
+  }
+
+  return 0;
+}
+
+const char * exa_wayland_get_interface_stats(int index, const uint32_t ** requests, uint32_t * nb_requests, const uint32_t ** events, uint32_t * nb_events) {
+
+  if ( (index < 0) || (index >= nb_interface_descriptors) )
+    return NULL;
+
+  const struct interface_descriptor * descriptor = &interface_descriptors[index];
+
+  *requests = descriptor->request_counts;
+  *nb_requests = descriptor->interface->method_count;
+  *events = descriptor->event_counts;
+  *nb_events = descriptor->interface->event_count;
+
+  return descriptor->interface->name;
+}
+
+int exa_wayland_dump_stats(int fd) {
+
+  struct exa_wayland_stats stats;
+
+  exa_wayland_get_stats(&stats);
+
+#define DUMP_STAT(field) dprintf(fd, #field " %u\n", stats.field)
+
+  DUMP_STAT(requests);
+  DUMP_STAT(events);
+  DUMP_STAT(queue_size);
+  DUMP_STAT(queue_high_water);
+  DUMP_STAT(queue_overflows);
+  DUMP_STAT(queue_grows);
+  DUMP_STAT(events_coalesced);
+  DUMP_STAT(motions_dropped);
+  DUMP_STAT(events_lost);
+  DUMP_STAT(motions_merged);
+  DUMP_STAT(axes_merged);
+  DUMP_STAT(wakeups);
+  DUMP_STAT(wakeups_coalesced);
+  DUMP_STAT(js_calls);
+  DUMP_STAT(js_events);
+  DUMP_STAT(js_ring_high_water);
+  DUMP_STAT(js_ring_refills);
+  DUMP_STAT(commits);
+  DUMP_STAT(frame_callbacks);
+  DUMP_STAT(frames_done);
+  DUMP_STAT(buffers_released);
+  DUMP_STAT(rows_converted);
+  DUMP_STAT(frames_unchanged);
+  dprintf(fd, "upload_bytes_saved %llu\n", (unsigned long long)stats.upload_bytes_saved);
+  DUMP_STAT(objects_allocated);
+  DUMP_STAT(objects_in_use);
+  DUMP_STAT(arena_allocs);
+  DUMP_STAT(heap_allocs);
+
+#undef DUMP_STAT
+
+  for (int i = 0; i < NB_OBJECT_POOLS; ++i)
+    dprintf(fd, "pool.%s %u %u %u\n", object_pools[i].name, object_pools[i].in_use, object_pools[i].capacity, object_pools[i].high_water);
+
+  // Only the messages seen at least once
+
+  for (int i = 0; i < nb_interface_descriptors; ++i) {
+
+    const struct interface_descriptor * descriptor = &interface_descriptors[i];
+    const struct wl_interface * interface = descriptor->interface;
+
+    for (int j = 0; j < interface->method_count; ++j) {
+
+      if (descriptor->request_counts[j])
+	dprintf(fd, "request.%s.%s %u\n", interface->name, interface->methods[j].name, descriptor->request_counts[j]);
+    }
+
+    for (int j = 0; j < interface->event_count; ++j) {
+
+      if (descriptor->event_counts[j])
+	dprintf(fd, "event.%s.%s %u\n", interface->name, interface->events[j].name, descriptor->event_counts[j]);
+    }
+  }
+
+  return 0;
+}
+
+void wl_display_disconnect(struct wl_display *display) {
+
+  LOG_INFO("--> wl_display_disconnect");
+
+  LOG_INFO("wl_display_disconnect: arena allocs=%u heap_allocs=%u resets=%u high_water=%u", display->arena.allocs, display->arena.heap_allocs, display->arena.resets, (unsigned int)display->arena.high_water);
+
+  LOG_INFO("wl_display_disconnect: queue size=%u high_water=%u overflows=%u grows=%u coalesced=%u dropped_motions=%u dispatched=%u lost=%u", display->queue_size, display->queue_stats.high_water, display->queue_stats.overflows, display->queue_stats.grows, display->queue_stats.coalesced, display->queue_stats.dropped_motions, display->queue_stats.dispatched, display->queue_stats.lost);
+
+  LOG_INFO("wl_display_disconnect: wakeups=%u wakeups_coalesced=%u", display->queue_stats.wakeups, display->queue_stats.wakeups_coalesced);
+
+  LOG_INFO("wl_display_disconnect: merged_motions=%u merged_axes=%u", display->queue_stats.merged_motions, display->queue_stats.merged_axes);
+
+  for (int i = 0; i < NB_OBJECT_POOLS; ++i) {
+
+    LOG_INFO("wl_display_disconnect: pool %s in_use=%u capacity=%u high_water=%u", object_pools[i].name, object_pools[i].in_use, object_pools[i].capacity, object_pools[i].high_water);
+  }
+
+#ifdef EXA_WAYLAND_THREADS
+  convert_pool_stop();
+#endif
+
+  if (RECORD_ENABLED())
+    record_close();
+
+  if (REPLAY_ENABLED())
+    replay_close();
+
+  const char * trace_path = getenv("EXA_WAYLAND_TRACE");
+
+  if (trace_path && TRACE_ENABLED()) {
+
+    int fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0) {
+
+      exa_wayland_dump_trace(fd);
+      close(fd);
+    }
+    else {
+
+      LOG_WARN("wl_display_disconnect: cannot open %s", trace_path);
+    }
+  }
+
+  const char * stats_path = getenv("EXA_WAYLAND_STATS");
+
+  if (stats_path) {
+
+    int fd = open(stats_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0) {
+
+      exa_wayland_dump_stats(fd);
+      close(fd);
+    }
+    else {
+
+      LOG_WARN("wl_display_disconnect: cannot open %s", stats_path);
+    }
+  }
+
+  /*EM_ASM({*/
+
+  const char * fun = 
+      "Module.iframeShown = true;"
+
+      "let m = new Object();"
+	
+      "m.type = 6;" // hide iframe
+      "m.pid = Module.getpid() & 0x0000ffff;"
+
+    "window.parent.postMessage(m);";
+      /*});*/
+
+  static int display_disconnect_handle = -1;
+
+  if (display_disconnect_handle < 0)
+    display_disconnect_handle = emscripten_load_fun(fun, "v");
+  
+  js_run(display_disconnect_handle);
+}
+
+  /*interface: 'wl_compositor', version: 5, name: 1
+interface: 'wl_drm', version: 2, name: 2
+interface: 'wl_shm', version: 1, name: 3
+interface: 'wl_output', version: 3, name: 4
+interface: 'zxdg_output_manager_v1', version: 3, name: 5
+interface: 'wl_data_device_manager', version: 3, name: 6
+interface: 'zwp_primary_selection_device_manager_v1', version: 1, name: 7
+interface: 'wl_subcompositor', version: 1, name: 8
+interface: 'xdg_wm_base', version: 4, name: 9
+interface: 'gtk_shell1', version: 5, name: 10
+interface: 'wp_viewporter', version: 1, name: 11
+interface: 'zwp_pointer_gestures_v1', version: 3, name: 12
+interface: 'zwp_tablet_manager_v2', version: 1, name: 13
+interface: 'wl_seat', version: 8, name: 14
+interface: 'zwp_relative_pointer_manager_v1', version: 1, name: 15
+interface: 'zwp_pointer_constraints_v1', version: 1, name: 16
+interface: 'zxdg_exporter_v1', version: 1, name: 17
+interface: 'zxdg_importer_v1', version: 1, name: 18
+interface: 'zwp_linux_dmabuf_v1', version: 4, name: 19
+interface: 'wp_single_pixel_buffer_manager_v1', version: 1, name: 20
+interface: 'zwp_keyboard_shortcuts_inhibit_manager_v1', version: 1, name: 21
+interface: 'zwp_text_input_manager_v3', version: 1, name: 22
+interface: 'wp_presentation', version: 1, name: 23
+interface: 'xdg_activation_v1', version: 1, name: 24*/
+
+extern const struct wl_interface wl_registry_interface;
+
+static struct wl_registry registry = {
+
+  .proxy = {
+
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_registry_interface,
+  },
+};
+
+
+static void surface_destroy_canvas(int id) {
+
+  const char * fun =
+
+    "const canvas = Module['surfaces'][$0-1];"
+
+    "if (canvas) {"
+
+      // Toplevels are wrapped in a div with their decoration
+
+      "if (canvas.parentElement && canvas.parentElement.querySelector('#deco'))"
+	"canvas.parentElement.remove();"
+      "else "
+	"canvas.remove();"
+
+      // Ids are indexes in this array, they are never reused
+
+      "Module['surfaces'][$0-1] = null;"
+    "}"
+
+    // Commits not rendered yet are dropped, their buffers released
+
+    "if ('wayland' in Module) {"
+
+      "Module['wayland'].requests = Module['wayland'].requests.filter((request) => {"
+
+	  "if ( (request.type != 'commit') || (request.surface_id != $0) )"
+	    "return true;"
+
+	  "Module['wayland'].pushEvent({"
+
+	      "'type': 1," // buffer released"
+	      "'surface_id': request.surface_id,"
+	      "'buffer_id': request.buffer_id"
+	    "});"
+
+	  "return false;"
+	"});"
+
+      "Module['wayland'].staged.delete($0);"
+    "}";
+
+  static int surface_destroy_canvas_handle = -1;
+
+  if (surface_destroy_canvas_handle < 0)
+    surface_destroy_canvas_handle = emscripten_load_fun(fun, "vi");
+
+  js_run(surface_destroy_canvas_handle, id);
+}
+
+static void buffer_forget_image(int id) {
+
+  /*EM_ASM({*/
+
+  const char * fun =
+
+    "if ('wayland' in Module) {"
+
+      "Module['wayland'].images.delete($0);"
+
+      // Its pixels are freed: commits not rendered yet only release and send frame done
+
+      "for (const request of Module['wayland'].requests) {"
+
+	"if ( (request.type == 'commit') && (request.buffer_id == $0) )"
+	  "request.pixels = 0;"
+      "}"
+    "}";
+
+  //}, id);*/
+
+  static int buffer_forget_image_handle = -1;
+
+  if (buffer_forget_image_handle < 0)
+    buffer_forget_image_handle = emscripten_load_fun(fun, "vi");
+
+  js_run(buffer_forget_image_handle, id);
+}
+
+// Static objects (globals, seat devices, ...) are never destroyed
+
+void wl_proxy_destroy(struct wl_proxy *proxy) {
+
+  if (!proxy || !proxy->pool)
+    return;
+
+  event_queue_purge(&display, proxy, proxy->pool->object_size);
+
+  switch (proxy->pool - object_pools) {
+
+  case OBJECT_POOL_SURFACE: {
+
+    struct wl_surface * surface = (struct wl_surface *)proxy;
+
+    surface_index_remove(surface);
+
+    if (surface->xdg_surface)
+      surface->xdg_surface->wl_surface = NULL;
+
+    for (struct wl_callback * callback = surface->frame_callbacks; callback; callback = callback->next)
+      callback->wl_surface = NULL;
+
+    surface_destroy_canvas(surface->id);
+
+    free(surface->shadow);
+
+    region_fini(&surface->damage.region);
+    region_fini(&surface->opaque_region);
+    region_fini(&surface->input_region);
+
+    break;
+  }
+  case OBJECT_POOL_REGION:
+
+    region_fini(&((struct wl_region *)proxy)->region);
+
+    break;
+  case OBJECT_POOL_XDG_SURFACE: {
+
+    struct xdg_surface * xdg_surface = (struct xdg_surface *)proxy;
+
+    if (xdg_surface->wl_surface)
+      xdg_surface->wl_surface->xdg_surface = NULL;
+
+    if (xdg_surface->xdg_toplevel)
+      xdg_surface->xdg_toplevel->xdg_surface = NULL;
+
+    break;
+  }
+  case OBJECT_POOL_XDG_TOPLEVEL: {
+
+    struct xdg_toplevel * toplevel = (struct xdg_toplevel *)proxy;
+
+    if (toplevel->xdg_surface)
+      toplevel->xdg_surface->xdg_toplevel = NULL;
+
+    break;
+  }
+  case OBJECT_POOL_CALLBACK: {
+
+    struct wl_callback * callback = (struct wl_callback *)proxy;
+
+    if (callback->wl_surface) {
+
+      struct wl_callback ** link = &callback->wl_surface->frame_callbacks;
+
+      while (*link && (*link != callback))
+	link = &(*link)->next;
+
+      if (*link)
+	*link = callback->next;
+    }
+
+    break;
+  }
+  case OBJECT_POOL_BUFFER: {
+
+    struct wl_buffer * buffer = (struct wl_buffer *)proxy;
+
+    if (buffer->busy)
+      buffer_unlink_busy(buffer);
+
+    // Surfaces still attached to it commit no buffer from now on
+
+    for (unsigned int i = 0; i < surface_index_size; ++i) {
+
+      if (!surface_index[i])
+	continue;
+
+      if (surface_index[i]->buffer == buffer)
+	surface_index[i]->buffer = NULL;
+      if (surface_index[i]->converted_buffer == buffer)
+	surface_index[i]->converted_buffer = NULL;
+    }
+
+    buffer_forget_image(buffer->id);
+
+#ifdef EXA_WAYLAND_THREADS
+    convert_wait(buffer);
+#endif
+
+    free(buffer->rgba);
+
+    break;
+  }
+  default:
+    break;
+  }
+
+  object_pool_free(proxy);
+}
+
+uint32_t wl_proxy_get_version(struct wl_proxy * proxy)
+{
+	return proxy->version;
+}
+
+void
+wl_proxy_set_user_data(struct wl_proxy *proxy, void *user_data) {
+
+  proxy->data = user_data;
+}
+
+void *
+wl_proxy_get_user_data(struct wl_proxy *proxy) {
+
+  return proxy->data;
+}
+
+void
+wl_proxy_set_tag(struct wl_proxy *proxy,
+		 const char * const *tag) {
+  
+  proxy->tag = tag;
+}
+
+const char * const *
+wl_proxy_get_tag(struct wl_proxy *proxy) {
+  
+  return proxy->tag;
+}
+
+static void event_queue_dispatch(struct wl_display * display) {
+
+  ++display->dispatch_depth;
+
+  while (display->head != display->tail) {
+
+    // Dequeue first: listeners may queue events and grow the queue
+
+    struct event current = display->event_queue[display->tail];
+
+    display->tail = (display->tail + 1) & (display->queue_size - 1);
+
+    struct event * event = &current;
+
+    struct wl_proxy * proxy = event->proxy;
+
+    if (!proxy) // destroyed after the event was queued
+      continue;
+
+    const struct interface_descriptor * descriptor = proxy_get_descriptor(proxy);
+
+    ++descriptor->event_counts[event->opcode];
+
+    void (*handler)(void) = (proxy->listeners)?proxy->listeners[event->opcode]:NULL;
+
+    union wl_argument * args = event_args(event);
+
+    printf("found event: %d %d\n", event->opcode, event->nargs);
+
+    if (!handler || !args || (event->nargs > EVENT_ARGS_MAX))
+      continue;
+
+    if (descriptor->trampolines && (event->opcode < descriptor->trampolines->nb_trampolines)) {
+
+      descriptor->trampolines->trampolines[event->opcode](handler, proxy->data, proxy, args);
+      continue;
+    }
+
+    // Interface not in the protocol XMLs, generic call
+
+    uintptr_t words[EVENT_ARGS_MAX];
+
+    event_args_to_words(descriptor->events[event->opcode].types, args, words);
+
+    event_call_listener(handler, proxy->data, proxy, event->nargs, words);
+  }
+
+  --display->dispatch_depth;
+}
+
+int wl_display_roundtrip(struct wl_display * display) {
+
+  //emscripten_log(EM_LOG_CONSOLE, "--> wl_display_roundtrip %d %d", display->head, display->tail);
+
+  event_queue_dispatch(display);
+
+  // Listeners may dispatch recursively, only the outermost call recycles the arguments
+
+  if (display->dispatch_depth == 0)
+    event_arena_reset(&display->arena);
+
+  // Nested roundtrips leave the wakeup armed, the outermost one drains the queue
+
+  if ( (display->dispatch_depth > 0) || !display->wakeup_armed || (display->head != display->tail) )
+    return 0;
+
+  display->wakeup_armed = 0;
+
+  /*EM_ASM({*/
+
+  const char * fun = "Module['wayland'].queueNotEmpty = 0;";
+      
+      /*});*/
+
+    static int display_roundtrip_handle = -1;
+
+  if (display_roundtrip_handle < 0)
+    display_roundtrip_handle = emscripten_load_fun(fun, "v");
+  
+  js_run(display_roundtrip_handle);
+  
+  return 0;
+}
+
+
+static const struct wl_interface *wayland_types[] = {
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	/*&wl_callback_interface*/NULL,
+	/*&wl_registry_interface*/NULL,
+	/*&wl_surface_interface*/NULL,
+	/*&wl_region_interface*/NULL,
+	/*&wl_buffer_interface*/NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	/*&wl_shm_pool_interface*/NULL,
+	NULL,
+	NULL,
+	#if 0
+	&wl_data_source_interface,
+	&wl_surface_interface,
+	&wl_surface_interface,
+	NULL,
+	&wl_data_source_interface,
+	NULL,
+	&wl_data_offer_interface,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	&wl_data_offer_interface,
+	&wl_data_offer_interface,
+	&wl_data_source_interface,
+	&wl_data_device_interface,
+	&wl_seat_interface,
+	&wl_shell_surface_interface,
+	&wl_surface_interface,
+	&wl_seat_interface,
+	NULL,
+	&wl_seat_interface,
+	NULL,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	&wl_output_interface,
+	&wl_seat_interface,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	NULL,
+	&wl_output_interface,
+	&wl_buffer_interface,
+	NULL,
+	NULL,
+	&wl_callback_interface,
+	&wl_region_interface,
+	&wl_region_interface,
+	&wl_output_interface,
+	&wl_output_interface,
+	&wl_pointer_interface,
+	&wl_keyboard_interface,
+	&wl_touch_interface,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	&wl_surface_interface,
+	NULL,
+	NULL,
+	NULL,
+	&wl_subsurface_interface,
+	&wl_surface_interface,
+	&wl_surface_interface,
+	&wl_surface_interface,
+	&wl_surface_interface,
+	#endif
+};
+
+static const struct wl_message wl_display_requests[] = {
+	{ "sync", "n", wayland_types + 8 },
+	{ "get_registry", "n", wayland_types + 9 },
+};
+
+static const struct wl_message wl_display_events[] = {
+	{ "error", "ous", wayland_types + 0 },
+	{ "delete_id", "u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_display_interface = {
+	"wl_display", 1,
+	2, wl_display_requests,
+	2, wl_display_events,
+};
+
+static const struct wl_message wl_registry_requests[] = {
+	{ "bind", "usun", wayland_types + 0 },
+};
+
+static const struct wl_message wl_registry_events[] = {
+	{ "global", "usu", wayland_types + 0 },
+	{ "global_remove", "u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_registry_interface = {
+	"wl_registry", 1,
+	1, wl_registry_requests,
+	2, wl_registry_events,
+};
+
+static const struct wl_message wl_callback_events[] = {
+	{ "done", "u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_callback_interface = {
+	"wl_callback", 1,
+	0, NULL,
+	1, wl_callback_events,
+};
+
+static const struct wl_message wl_compositor_requests[] = {
+	{ "create_surface", "n", wayland_types + 10 },
+	{ "create_region", "n", wayland_types + 11 },
+};
+
+const struct wl_interface wl_compositor_interface = {
+	"wl_compositor", 6,
+	2, wl_compositor_requests,
+	0, NULL,
+};
+
+static const struct wl_message wl_shm_pool_requests[] = {
+	{ "create_buffer", "niiiiu", wayland_types + 12 },
+	{ "destroy", "", wayland_types + 0 },
+	{ "resize", "i", wayland_types + 0 },
+};
+
+const struct wl_interface wl_shm_pool_interface = {
+	"wl_shm_pool", 1,
+	3, wl_shm_pool_requests,
+	0, NULL,
+};
+
+static const struct wl_message wl_shm_requests[] = {
+	{ "create_pool", "nhi", wayland_types + 18 },
+};
+
+static const struct wl_message wl_shm_events[] = {
+	{ "format", "u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_shm_interface = {
+	"wl_shm", 1,
+	1, wl_shm_requests,
+	1, wl_shm_events,
+};
+
+
+static const struct wl_message wl_surface_requests[] = {
+	{ "destroy", "", wayland_types + 0 },
+	{ "attach", "?oii", wayland_types + 58 },
+	{ "damage", "iiii", wayland_types + 0 },
+	{ "frame", "n", wayland_types + 61 },
+	{ "set_opaque_region", "?o", wayland_types + 62 },
+	{ "set_input_region", "?o", wayland_types + 63 },
+	{ "commit", "", wayland_types + 0 },
+	{ "set_buffer_transform", "2i", wayland_types + 0 },
+	{ "set_buffer_scale", "3i", wayland_types + 0 },
+	{ "damage_buffer", "4iiii", wayland_types + 0 },
+	{ "offset", "5ii", wayland_types + 0 },
+};
+
+static const struct wl_message wl_surface_events[] = {
+	{ "enter", "o", wayland_types + 64 },
+	{ "leave", "o", wayland_types + 65 },
+	{ "preferred_buffer_scale", "6i", wayland_types + 0 },
+	{ "preferred_buffer_transform", "6u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_surface_interface = {
+	"wl_surface", 6,
+	11, wl_surface_requests,
+	4, wl_surface_events,
+};
+
+static const struct wl_message wl_buffer_requests[] = {
+	{ "destroy", "", wayland_types + 0 },
+};
+
+static const struct wl_message wl_buffer_events[] = {
+	{ "release", "", wayland_types + 0 },
+};
+
+const struct wl_interface wl_buffer_interface = {
+	"wl_buffer", 1,
+	1, wl_buffer_requests,
+	1, wl_buffer_events,
+};
+
+static const struct wl_message wl_region_requests[] = {
+	{ "destroy", "", wayland_types + 0 },
+	{ "add", "iiii", wayland_types + 0 },
+	{ "subtract", "iiii", wayland_types + 0 },
+};
+
+const struct wl_interface wl_region_interface = {
+	"wl_region", 1,
+	3, wl_region_requests,
+	0, NULL,
+};
+
+static const struct wl_interface *xdg_shell_types[] = {
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	/*&xdg_positioner_interface*/NULL,
+	/*&xdg_surface_interface*/NULL,
+	/*&wl_surface_interface*/NULL,
+	/*&xdg_toplevel_interface*/NULL,
+	#if 0
+	&xdg_popup_interface,
+	&xdg_surface_interface,
+	&xdg_positioner_interface,
+	&xdg_toplevel_interface,
+	&wl_seat_interface,
+	NULL,
+	NULL,
+	NULL,
+	&wl_seat_interface,
+	NULL,
+	&wl_seat_interface,
+	NULL,
+	NULL,
+	&wl_output_interface,
+	&wl_seat_interface,
+	NULL,
+	&xdg_positioner_interface,
+	NULL,
+	#endif
+};
+
+static const struct wl_message xdg_wm_base_requests[] = {
+	{ "destroy", "", xdg_shell_types + 0 },
+	{ "create_positioner", "n", xdg_shell_types + 4 },
+	{ "get_xdg_surface", "no", xdg_shell_types + 5 },
+	{ "pong", "u", xdg_shell_types + 0 },
+};
+
+static const struct wl_message xdg_wm_base_events[] = {
+	{ "ping", "u", xdg_shell_types + 0 },
+};
+
+const struct wl_interface xdg_wm_base_interface = {
+	"xdg_wm_base", 6,
+	4, xdg_wm_base_requests,
+	1, xdg_wm_base_events,
+};
+
+static const struct wl_message xdg_surface_requests[] = {
+	{ "destroy", "", xdg_shell_types + 0 },
+	{ "get_toplevel", "n", xdg_shell_types + 7 },
+	{ "get_popup", "n?oo", xdg_shell_types + 8 },
+	{ "set_window_geometry", "iiii", xdg_shell_types + 0 },
+	{ "ack_configure", "u", xdg_shell_types + 0 },
+};
+
+static const struct wl_message xdg_surface_events[] = {
+	{ "configure", "u", xdg_shell_types + 0 },
+};
+
+const struct wl_interface xdg_surface_interface = {
+	"xdg_surface", 6,
+	5, xdg_surface_requests,
+	1, xdg_surface_events,
+};
+
+static const struct wl_message xdg_toplevel_requests[] = {
+	{ "destroy", "", xdg_shell_types + 0 },
+	{ "set_parent", "?o", xdg_shell_types + 11 },
+	{ "set_title", "s", xdg_shell_types + 0 },
+	{ "set_app_id", "s", xdg_shell_types + 0 },
+	{ "show_window_menu", "ouii", xdg_shell_types + 12 },
+	{ "move", "ou", xdg_shell_types + 16 },
+	{ "resize", "ouu", xdg_shell_types + 18 },
+	{ "set_max_size", "ii", xdg_shell_types + 0 },
+	{ "set_min_size", "ii", xdg_shell_types + 0 },
+	{ "set_maximized", "", xdg_shell_types + 0 },
+	{ "unset_maximized", "", xdg_shell_types + 0 },
+	{ "set_fullscreen", "?o", xdg_shell_types + 21 },
+	{ "unset_fullscreen", "", xdg_shell_types + 0 },
+	{ "set_minimized", "", xdg_shell_types + 0 },
+};
+
+static const struct wl_message xdg_toplevel_events[] = {
+	{ "configure", "iia", xdg_shell_types + 0 },
+	{ "close", "", xdg_shell_types + 0 },
+	{ "configure_bounds", "4ii", xdg_shell_types + 0 },
+	{ "wm_capabilities", "5a", xdg_shell_types + 0 },
+};
+
+const struct wl_interface xdg_toplevel_interface = {
+	"xdg_toplevel", 6,
+	14, xdg_toplevel_requests,
+	4, xdg_toplevel_events,
+};
+
+static const struct wl_message wl_data_offer_requests[] = {
+	{ "accept", "u?s", wayland_types + 0 },
+	{ "receive", "sh", wayland_types + 0 },
+	{ "destroy", "", wayland_types + 0 },
+	{ "finish", "3", wayland_types + 0 },
+	{ "set_actions", "3uu", wayland_types + 0 },
+};
+
+static const struct wl_message wl_data_offer_events[] = {
+	{ "offer", "s", wayland_types + 0 },
+	{ "source_actions", "3u", wayland_types + 0 },
+	{ "action", "3u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_data_offer_interface = {
+	"wl_data_offer", 3,
+	5, wl_data_offer_requests,
+	3, wl_data_offer_events,
+};
+
+static const struct wl_message wl_data_source_requests[] = {
+	{ "offer", "s", wayland_types + 0 },
+	{ "destroy", "", wayland_types + 0 },
+	{ "set_actions", "3u", wayland_types + 0 },
+};
+
+static const struct wl_message wl_data_source_events[] = {
+	{ "target", "?s", wayland_types + 0 },
+	{ "send", "sh", wayland_types + 0 },
+	{ "cancelled", "", wayland_types + 0 },
+	{ "dnd_drop_performed", "3", wayland_types + 0 },
+	{ "dnd_finished", "3", wayland_types + 0 },
+	{ "action", "3u", wayland_types + 0 },
+};
+
+const struct wl_interface wl_data_source_interface = {
+	"wl_data_source", 3,
+	3, wl_data_source_requests,
+	6, wl_data_source_events,
+};
+
+static const struct wl_message wl_data_device_requests[] = {
+	{ "start_drag", "?oo?ou", wayland_types + 21 },
+	{ "set_selection", "?ou", wayland_types + 25 },
+	{ "release", "2", wayland_types + 0 },
+};
+
+static const struct wl_message wl_data_device_events[] = {
+	{ "data_offer", "n", wayland_types + 27 },
+	{ "enter", "uoff?o", wayland_types + 28 },
+	{ "leave", "", wayland_types + 0 },
+	{ "motion", "uff", wayland_types + 0 },
+	{ "drop", "", wayland_types + 0 },
+	{ "selection", "?o", wayland_types + 33 },
+};
+
+const struct wl_interface wl_data_device_interface = {
+	"wl_data_device", 3,
+	3, wl_data_device_requests,
+	6, wl_data_device_events,
+};
+
+static const struct wl_message wl_data_device_manager_requests[] = {
+	{ "create_data_source", "n", wayland_types + 34 },
+	{ "get_data_device", "no", wayland_types + 35 },
+};
+
+const struct wl_interface wl_data_device_manager_interface = {
+	"wl_data_device_manager", 3,
+	2, wl_data_device_manager_requests,
+	0, NULL,
+};
+
+static const struct wl_message wl_seat_requests[] = {
+	{ "get_pointer", "n", wayland_types + 66 },
+	{ "get_keyboard", "n", wayland_types + 67 },
+	{ "get_touch", "n", wayland_types + 68 },
+	{ "release", "5", wayland_types + 0 },
+};
+
+static const struct wl_message wl_seat_events[] = {
+	{ "capabilities", "u", wayland_types + 0 },
+	{ "name", "2s", wayland_types + 0 },
+};
+
+const struct wl_interface wl_seat_interface = {
+	"wl_seat", 6,
+	4, wl_seat_requests,
+	2, wl_seat_events,
+};
+
+static const struct wl_message wl_pointer_requests[] = {
+	{ "set_cursor", "u?oii", wayland_types + 69 },
+	{ "release", "3", wayland_types + 0 },
+};
+
+static const struct wl_message wl_pointer_events[] = {
+	{ "enter", "uoff", wayland_types + 73 },
+	{ "leave", "uo", wayland_types + 77 },
+	{ "motion", "uff", wayland_types + 0 },
+	{ "button", "uuuu", wayland_types + 0 },
+	{ "axis", "uuf", wayland_types + 0 },
+	{ "frame", "5", wayland_types + 0 },
+	{ "axis_source", "5u", wayland_types + 0 },
+	{ "axis_stop", "5uu", wayland_types + 0 },
+	{ "axis_discrete", "5ui", wayland_types + 0 },
+};
+
+const struct wl_interface wl_pointer_interface = {
+	"wl_pointer", 6,
+	2, wl_pointer_requests,
+	9, wl_pointer_events,
+};
+
+static const struct wl_message wl_keyboard_requests[] = {
+	{ "release", "3", wayland_types + 0 },
+};
+
+static const struct wl_message wl_keyboard_events[] = {
+	{ "keymap", "uhu", wayland_types + 0 },
+	{ "enter", "uoa", wayland_types + 79 },
+	{ "leave", "uo", wayland_types + 82 },
+	{ "key", "uuuu", wayland_types + 0 },
+	{ "modifiers", "uuuuu", wayland_types + 0 },
+	{ "repeat_info", "4ii", wayland_types + 0 },
+};
+
+const struct wl_interface wl_keyboard_interface = {
+	"wl_keyboard", 6,
+	1, wl_keyboard_requests,
+	6, wl_keyboard_events,
+};
+
+static const struct wl_message wl_touch_requests[] = {
+	{ "release", "3", wayland_types + 0 },
+};
+
+static const struct wl_message wl_touch_events[] = {
+	{ "down", "uuoiff", wayland_types + 84 },
+	{ "up", "uui", wayland_types + 0 },
+	{ "motion", "uiff", wayland_types + 0 },
+	{ "frame", "", wayland_types + 0 },
+	{ "cancel", "", wayland_types + 0 },
+	{ "shape", "6iff", wayland_types + 0 },
+	{ "orientation", "6if", wayland_types + 0 },
+};
+
+const struct wl_interface wl_touch_interface = {
+	"wl_touch", 6,
+	1, wl_touch_requests,
+	7, wl_touch_events,
+};
+
+static const struct wl_message wl_output_requests[] = {
+	{ "release", "3", wayland_types + 0 },
+};
+
+static const struct wl_message wl_output_events[] = {
+	{ "geometry", "iiiiissi", wayland_types + 0 },
+	{ "mode", "uiii", wayland_types + 0 },
+	{ "done", "2", wayland_types + 0 },
+	{ "scale", "2i", wayland_types + 0 },
+	{ "name", "4s", wayland_types + 0 },
+	{ "description", "4s", wayland_types + 0 },
+};
+
+WL_EXPORT const struct wl_interface wl_output_interface = {
+	"wl_output", 4,
+	1, wl_output_requests,
+	6, wl_output_events,
+	};
+
+extern const struct wl_interface zwp_primary_selection_device_v1_interface;
+extern const struct wl_interface zwp_primary_selection_offer_v1_interface;
+extern const struct wl_interface zwp_primary_selection_source_v1_interface;
+
+static const struct wl_interface *wp_primary_selection_unstable_v1_types[] = {
+	NULL,
+	NULL,
+	&zwp_primary_selection_source_v1_interface,
+	&zwp_primary_selection_device_v1_interface,
+	&wl_seat_interface,
+	&zwp_primary_selection_source_v1_interface,
+	NULL,
+	&zwp_primary_selection_offer_v1_interface,
+	&zwp_primary_selection_offer_v1_interface,
+};
+
+static const struct wl_message zwp_primary_selection_device_manager_v1_requests[] = {
+	{ "create_source", "n", wp_primary_selection_unstable_v1_types + 2 },
+	{ "get_device", "no", wp_primary_selection_unstable_v1_types + 3 },
+	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
+};
+
+const struct wl_interface zwp_primary_selection_device_manager_v1_interface = {
+	"zwp_primary_selection_device_manager_v1", 1,
+	3, zwp_primary_selection_device_manager_v1_requests,
+	0, NULL,
+};
+
+static const struct wl_message zwp_primary_selection_device_v1_requests[] = {
+	{ "set_selection", "?ou", wp_primary_selection_unstable_v1_types + 5 },
+	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
+};
+
+static const struct wl_message zwp_primary_selection_device_v1_events[] = {
+	{ "data_offer", "n", wp_primary_selection_unstable_v1_types + 7 },
+	{ "selection", "?o", wp_primary_selection_unstable_v1_types + 8 },
+};
+
+const struct wl_interface zwp_primary_selection_device_v1_interface = {
+	"zwp_primary_selection_device_v1", 1,
+	2, zwp_primary_selection_device_v1_requests,
+	2, zwp_primary_selection_device_v1_events,
+};
+
+static const struct wl_message zwp_primary_selection_offer_v1_requests[] = {
+	{ "receive", "sh", wp_primary_selection_unstable_v1_types + 0 },
+	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
+};
+
+static const struct wl_message zwp_primary_selection_offer_v1_events[] = {
+	{ "offer", "s", wp_primary_selection_unstable_v1_types + 0 },
+};
+
+const struct wl_interface zwp_primary_selection_offer_v1_interface = {
+	"zwp_primary_selection_offer_v1", 1,
+	2, zwp_primary_selection_offer_v1_requests,
+	1, zwp_primary_selection_offer_v1_events,
+};
+
+static const struct wl_message zwp_primary_selection_source_v1_requests[] = {
+	{ "offer", "s", wp_primary_selection_unstable_v1_types + 0 },
+	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
+};
+
+static const struct wl_message zwp_primary_selection_source_v1_events[] = {
+	{ "send", "sh", wp_primary_selection_unstable_v1_types + 0 },
+	{ "cancelled", "", wp_primary_selection_unstable_v1_types + 0 },
+};
+
+const struct wl_interface zwp_primary_selection_source_v1_interface = {
+	"zwp_primary_selection_source_v1", 1,
+	2, zwp_primary_selection_source_v1_requests,
+	2, zwp_primary_selection_source_v1_events,
+};
+
+
+extern const struct wl_interface xdg_toplevel_interface;
+extern const struct wl_interface zxdg_toplevel_decoration_v1_interface;
+
+static const struct wl_interface *xdg_decoration_unstable_v1_types[] = {
+	NULL,
+	&zxdg_toplevel_decoration_v1_interface,
+	&xdg_toplevel_interface,
+};
+
+static const struct wl_message zxdg_decoration_manager_v1_requests[] = {
+	{ "destroy", "", xdg_decoration_unstable_v1_types + 0 },
+	{ "get_toplevel_decoration", "no", xdg_decoration_unstable_v1_types + 1 },
+};
+
+const struct wl_interface zxdg_decoration_manager_v1_interface = {
+	"zxdg_decoration_manager_v1", 1,
+	2, zxdg_decoration_manager_v1_requests,
+	0, NULL,
+};
+
+static const struct wl_message zxdg_toplevel_decoration_v1_requests[] = {
+	{ "destroy", "", xdg_decoration_unstable_v1_types + 0 },
+	{ "set_mode", "u", xdg_decoration_unstable_v1_types + 0 },
+	{ "unset_mode", "", xdg_decoration_unstable_v1_types + 0 },
+};
+
+static const struct wl_message zxdg_toplevel_decoration_v1_events[] = {
+	{ "configure", "u", xdg_decoration_unstable_v1_types + 0 },
+};
+
+const struct wl_interface zxdg_toplevel_decoration_v1_interface = {
+	"zxdg_toplevel_decoration_v1", 1,
+	3, zxdg_toplevel_decoration_v1_requests,
+	1, zxdg_toplevel_decoration_v1_events,
+};
+
+
+
+
+static struct wl_compositor compositor = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_compositor_interface,
+  },
+};
+
+static struct wl_shm shm = {
+
+  .proxy = {
+
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_shm_interface,
+  },
+};
+
+static struct wl_output output = {
+
+  .proxy = {
+
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_output_interface,
+  },
+};
+
+static struct xdg_wm_base xdg_wm_base = {
+
+  .proxy = {
+
+    .version = XDG_WM_BASE_VERSION,
+    .wl_display = &display,
+    .interface = &xdg_wm_base_interface,
+  },
+};
+
+static struct wl_seat seat = {
+
+  .proxy = {
+    
+    .version = WL_SEAT_VERSION,
+    .wl_display = &display,
+    .interface = &wl_seat_interface,
+  },
+};
+
+static struct wl_keyboard keyboard = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_keyboard_interface,
+  },
+  .serial = 0,
+};
+
+static struct wl_pointer pointer = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_pointer_interface,
+  },
+  .serial = 0,
+};
+
+static struct zxdg_decoration_manager_v1 decoration_manager = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &zxdg_decoration_manager_v1_interface,
+  },
+};
+
+/*static struct zxdg_toplevel_decoration_v1 toplevel_decoration = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &zxdg_toplevel_decoration_v1_interface,
+  },
+  };*/
+
+static struct wl_data_device_manager data_device_manager = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_data_device_manager_interface,
+  },
+};
+
+static struct wl_data_device data_device = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_data_device_interface,
+  },
+};
+
+static struct wl_data_offer data_source = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_data_source_interface,
+  },
+};
+
+static struct wl_data_offer data_offer = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &wl_data_offer_interface,
+  },
+};
+
+static struct zwp_primary_selection_device_manager_v1 primary_selection_device_manager = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &zwp_primary_selection_device_manager_v1_interface,
+  },
+};
+
+static struct zwp_primary_selection_device_v1 primary_selection_device = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &zwp_primary_selection_device_v1_interface,
+  },
+};
+
+static struct zwp_primary_selection_source_v1 primary_selection_source = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &zwp_primary_selection_source_v1_interface,
+  },
+};
+
+static struct zwp_primary_selection_offer_v1 primary_data_offer = {
+
+  .proxy = {
+    
+    .version = 0,
+    .wl_display = &display,
+    .interface = &zwp_primary_selection_offer_v1_interface,
+  },
+};
+
+// Globals advertised by the registry, the global name is the index in this table plus one
+
+static const struct registry_global {
+
+  const char * name;
+  const struct wl_interface * interface;
+  uint32_t version;
+  struct wl_proxy * proxy;
+} registry_globals[] = {
+
+  { "wl_compositor", &wl_compositor_interface, 5, (struct wl_proxy *)&compositor },
+  { "wl_shm", &wl_shm_interface, 1, (struct wl_proxy *)&shm },
+  { "wl_output", &wl_output_interface, 3, (struct wl_proxy *)&output },
+  { "xdg_wm_base", &xdg_wm_base_interface, XDG_WM_BASE_VERSION, (struct wl_proxy *)&xdg_wm_base },
+  { "wl_seat", &wl_seat_interface, WL_SEAT_VERSION, (struct wl_proxy *)&seat },
+  { "zxdg_decoration_manager_v1", &zxdg_decoration_manager_v1_interface, 1, (struct wl_proxy *)&decoration_manager },
+  { "wl_data_device_manager", &wl_data_device_manager_interface, 2, (struct wl_proxy *)&data_device_manager },
+  { "zwp_primary_selection_device_manager_v1", &zwp_primary_selection_device_manager_v1_interface, 1, (struct wl_proxy *)&primary_selection_device_manager },
+};
+
+#define NB_REGISTRY_GLOBALS (sizeof(registry_globals)/sizeof(registry_globals[0]))
+
+static struct wl_proxy * marshal_wl_display_get_registry(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  for (int i = 0; i < NB_REGISTRY_GLOBALS; ++i) {
+
+    queue_wl_registry_global((struct wl_proxy *) &registry, i+1, registry_globals[i].name, registry_globals[i].version);
+  }
+
+  return (struct wl_proxy *)&registry;
+}
+
+static struct wl_proxy * marshal_wl_registry_bind(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  if (!interface)
+    return NULL;
+
+  uint32_t name = va_arg(ap, uint32_t);
+
+  const struct registry_global * global = NULL;
+
+  if ( (name >= 1) && (name <= NB_REGISTRY_GLOBALS) &&
+       ( (registry_globals[name-1].interface == interface) || (strcmp(registry_globals[name-1].name, interface->name) == 0) ) ) {
+
+    global = &registry_globals[name-1];
+  }
+  else {
+
+    // Client did not use the advertised name, look for the interface
+
+    for (int i = 0; i < NB_REGISTRY_GLOBALS; ++i) {
+
+      if (strcmp(registry_globals[i].name, interface->name) == 0) {
+
+	global = &registry_globals[i];
+	break;
+      }
+    }
+  }
+
+  if (!global)
+    return NULL;
+
+  global->proxy->version = (version < global->version)?version:global->version;
+
+  return global->proxy;
+}
+
+static struct wl_proxy * marshal_wl_compositor_create_surface(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  LOG_DEBUG("WL_COMPOSITOR_CREATE_SURFACE");
+
+  //int id = 0 /*EM_ASM_INT({*/
+
+  const char * fun =
+
+      //console.log("degas client: Create surface");
+
+      "const newCanvas = document.createElement(\"canvas\");"
+
+      "newCanvas.setAttribute(\"tabIndex\", \"1\");"
+      "newCanvas.style.outline = \"none\";"
+
+      "if (!Module['surfaces'])"
+	"Module['surfaces'] = new Array();"
+
+      "Module['surfaces'].push(newCanvas);"
+
+      "const id = Module['surfaces'].length;"
+
+      // Also called for the canvas replacing this one, see Module['wayland'].replaceCanvas
+
+      "const listen = (newCanvas) => {"
+
+      "newCanvas.addEventListener(\"mouseenter\", (event) => {"
+
+	  //console.log("mouseenter");
+
+	  "newCanvas.wlInside = Module['wayland'].inInput(newCanvas, event.offsetX * window.devicePixelRatio, event.offsetY * window.devicePixelRatio);"
+
+	  "if (!newCanvas.wlInside)"
+	    "return;"
+
+	  "Module['wayland'].pushEvent({"
+
+	      "'type': 10," // mouseenter
+	      "'id': id,"
+	      "'x': event.offsetX * window.devicePixelRatio,"
+	      "'y': event.offsetY * window.devicePixelRatio"
+	      "});"
+
+	    "setTimeout(() => {"
+
+		"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		  // TODO check rw
+
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		"}"
+
+	      "}, 0);"
+
+    "});"
+
+    "newCanvas.addEventListener(\"mouseleave\", (event) => {"
+
+	  //console.log("mouseleave");
+
+	  "if (newCanvas.wlInside === false)"
+	    "return;"
+
+	  "newCanvas.wlInside = false;"
+
+	  "Module['wayland'].pushEvent({"
+
+	      "'type': 11," // mouseleave
+	      "'id': id,"
+	      "'x': event.offsetX * window.devicePixelRatio,"
+	      "'y': event.offsetY * window.devicePixelRatio"
+	      "});"
+
+	    "setTimeout(() => {"
+
+		"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		  // TODO check rw
+
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		"}"
+
+	      "}, 0);"
+	"});"
+
+      "newCanvas.addEventListener(\"mousemove\", (event) => {"
+
+	  "if (Module.selected_toplevel)"
+	    "return;"
+
+	  "if (Module.pointerListener) {"
+
+	    "event.preventDefault();"
+	    "event.stopPropagation();"
+
+	    //console.log(event);
+	    //console.log("id="+id);
+
+	    "const x = event.offsetX * window.devicePixelRatio;"
+	    "const y = event.offsetY * window.devicePixelRatio;"
+
+	    "if (!event.buttons)" // released out of the canvas
+	      "newCanvas.wlButtons = 0;"
+
+	    "if (!Module['wayland'].pointerMoved(newCanvas, id, x, y)) {"
+
+	      "Module['wayland'].wakeUp();"
+	      "return;"
+	    "}"
+
+	    "Module['wayland'].pushEvent({"
+
+	      "'type': 9," // mousemove
+	      "'id': id,"
+	      "'x': x,"
+	      "'y': y"
+	      "});"
+
+	    "Module['wayland'].wakeUp();" // one timer for a burst of events
+	  "}"
+
+	"});"
+
+      "newCanvas.addEventListener(\"mousedown\", (event) => {"
+
+	  JS_LOG_TRACE("console.log(event);")
+
+	  "if (Module.selected_toplevel)"
+	    "return;"
+
+	  // Implicit grab: once a button is pressed, buttons and motions go to the surface wherever the pointer is
+
+	  "if ( (newCanvas.wlInside === false) && !newCanvas.wlButtons )" // a new press out of the input region
+	    "return;"
+
+	  "newCanvas.wlButtons = (newCanvas.wlButtons || 0) | (1 << event.button);"
+
+	  "if (Module.pointerListener) {"
+
+	    "event.target.focus();"
+
+	    "event.preventDefault();"
+	    "event.stopPropagation();"
+
+    //"console.log(\"Mouse Down\");"
+    //"console.log(event);"
+	    //console.log("id="+id);
+
+	    "Module['wayland'].pushEvent({"
+
+	      "'type': 8," // button
+	      "'id': id,"
+	      "'state': 1," // pressed
+	      "'button': event.button"
+	      "});"
+
+	    "setTimeout(() => {"
+
+		"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		  // TODO check rw
+
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		"}"
+
+	      "}, 0);"
+	  "}"
+
+	"});"
+
+      "newCanvas.addEventListener(\"mouseup\", (event) => {"
+
+	  "if (Module.selected_toplevel)"
+	    "return;"
+
+	  "const grabbed = (newCanvas.wlButtons || 0) & (1 << event.button);"
+
+	  "newCanvas.wlButtons = (newCanvas.wlButtons || 0) & ~(1 << event.button);"
+
+	  "if ( !grabbed && (newCanvas.wlInside === false) )" // out of the input region
+	    "return;"
+
+	  "if (Module.pointerListener) {"
+
+	    "event.preventDefault();"
+	    "event.stopPropagation();"
+
+	    //console.log("Mouse Up");
+	    //console.log(event);
+	    //console.log("id="+id);
+
+	    "Module['wayland'].pushEvent({"
+
+	      "'type': 8," // button
+	      "'id': id,"
+	      "'state': 0," // released
+	      "'button': event.button"
+	      "});"
+
+	    // The grab ended out of the input region: leave now rather than at the next motion
+
+	    "if (!newCanvas.wlButtons)"
+	      "Module['wayland'].pointerMoved(newCanvas, id, event.offsetX * window.devicePixelRatio, event.offsetY * window.devicePixelRatio);"
+
+	    "setTimeout(() => {"
+
+		"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		  // TODO check rw
+
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		"}"
+
+	      "}, 0);"
+	  "}"
+
+	"});"
+
+      "newCanvas.addEventListener(\"wheel\", (event) => {"
+
+	  "if (Module.selected_toplevel)"
+	    "return;"
+
+	  "if (newCanvas.wlInside === false)" // out of the input region
+	    "return;"
+
+	  "if (Module.pointerListener) {"
+
+	    //console.log("wheel");
+	    //console.log(event);
+
+	    "Module['wayland'].pushEvent({"
+
+	      "'type': 7," // wheel
+	      "'id': id,"
+	      "'deltaX': event.deltaX * window.devicePixelRatio,"
+	      "'deltaY': event.deltaY * window.devicePixelRatio,"
+	      "'deltaMode': event.deltaMode"
+	      "});"
+
+	    "Module['wayland'].wakeUp();" // one timer for a burst of events
+
+	  "}"
+
+	"});"
+
+      "newCanvas.addEventListener(\"focusin\", (event) => {"
+
+	  //console.log("focusin");
+	  //console.log(event);
+
+	  "Module['wayland'].pushEvent({"
+
+	      "'type': 12," // keyboard focus in
+	      "'id': id"
+	      "});"
+
+	    "setTimeout(() => {"
+
+		"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		  // TODO check rw
+
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		"}"
+
+	      "}, 0);"
+	"});"
+
+      "newCanvas.addEventListener(\"focusout\", (event) => {"
+
+	  //console.log("focusout");
+	  //console.log(event);
+
+	  "Module['wayland'].pushEvent({"
+
+	      "'type': 13," // keyboard focus out
+	      "'id': id"
+	      "});"
+
+	    "setTimeout(() => {"
+
+		"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
+
+		  // TODO check rw
+
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		"}"
+
+	      "}, 0);"
+
+	      "});"
+
+      "newCanvas.addEventListener(\"contextmenu\", event => event.preventDefault());"
+
+      "};"
+
+      "listen(newCanvas);"
+
+      "newCanvas.wlListen = listen;"
+
+      "return id;"
+    /*})*/;
+
+  static int create_surface_handle = -1;
+
+  if (create_surface_handle < 0)
+  create_surface_handle = emscripten_load_fun(fun, "i");
+
+  int id = js_run(create_surface_handle);
+
+  LOG_DEBUG("WL_COMPOSITOR_CREATE_SURFACE: %d", id);
+
+  struct wl_surface * surface = (struct wl_surface *)object_pool_alloc(OBJECT_POOL_SURFACE, &wl_surface_interface);
+
+  if (!surface)
+    return NULL;
+
+  surface->id = id;
+
+  if (surface_index_add(surface) < 0) {
+
+    object_pool_free((struct wl_proxy *)surface);
+    return NULL;
+  }
+
+  LOG_DEBUG("WL_COMPOSITOR_CREATE_SURFACE: wl_surface=%p", surface);
+
+  return (struct wl_proxy *)surface;
+}
+
+static struct wl_proxy * marshal_xdg_wm_base_get_xdg_surface(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  void * dummy = va_arg(ap, void*);
+
+  struct wl_surface * wl_surface = va_arg(ap, struct wl_surface*);
+
+  if (wl_surface->xdg_surface) {
+
+    LOG_DEBUG("XDG_WM_BASE_GET_XDG_SURFACE: %p", wl_surface->xdg_surface);
+
+    return (struct wl_proxy *)wl_surface->xdg_surface;
+  }
+
+  struct xdg_surface * xdg_surface = (struct xdg_surface *)object_pool_alloc(OBJECT_POOL_XDG_SURFACE, &xdg_surface_interface);
+
+  if (!xdg_surface)
+    return NULL;
+
+  xdg_surface->wl_surface = wl_surface;
+
+  wl_surface->xdg_surface = xdg_surface;
+
+  LOG_DEBUG("XDG_WM_BASE_GET_XDG_SURFACE: %p (wl_surface=%p)", xdg_surface, wl_surface);
+
+  return (struct wl_proxy *)xdg_surface;
+}
+
+static struct wl_proxy * marshal_xdg_surface_get_toplevel(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  LOG_DEBUG("XDG_SURFACE_GET_TOPLEVEL: xdg_surface=%p wl_surface=%p id=%d", proxy, ((struct xdg_surface *)proxy)->wl_surface, ((struct xdg_surface *)proxy)->wl_surface->id);
+
+  /*EM_ASM({*/
+
+  const char * fun = 
+
+      "let div = document.createElement(\"div\");"
+
+      "div.style.position = \"absolute\";"
+
+      "div.style.left = Math.floor(Math.random() * 100) + \"px\";"
+      "div.style.top = Math.floor(Math.random() * 100) + \"px\";"
+
+      "div.style.width = Module['surfaces'][$0-1].style.width;"
+      "div.style.height = Module['surfaces'][$0-1].style.height;"
+
+      "let deco = document.createElement(\"div\");"
+      "deco.id = \"deco\";"
+
+      "div.appendChild(deco);"
+
+      "div.appendChild(Module['surfaces'][$0-1]);"
+
+      "document.body.appendChild(div);"
+
+      "if (!Module.listenersRegistered) {"
+
+	"Module.listenersRegistered = true;"
+
+	"window.addEventListener('message', (event) => {"
+
+	    "if (event.data.type == 8) {" // mouse down
+
+	      "for (const div of document.getElementsByTagName(\"div\")) {"
+
+		"const rect = div.getBoundingClientRect();"
+
+		//console.log("Bingo ? ");
+		//console.log("x="+event.data.x+", y="+event.data.y);
+		//console.log(rect);
+
+		"if ( (event.data.x >= rect.left) && (event.data.x <= rect.right) && (event.data.y >= rect.top) && (event.data.y <= rect.bottom) ) {"
+
+		  "let m = new Object();"
+
+		  "m.type = 10;" // ask focus
+		  "m.pid = Module.getpid() & 0x0000ffff;"
+
+		  "window.parent.postMessage(m);"
+
+		  //console.log("Bingo !!");
+		  //console.log(rect);
+
+		  "return;"
+		"}"
+	      "}"
+
+	      "let m = new Object();"
+
+	      "m.type = 9;" // continue searching clicked window
+	      "m.pid = Module.getpid() & 0x0000ffff;"
+	      "m.x = event.data.x;"
+	      "m.y = event.data.y;"
+
+	      "window.parent.postMessage(m);"
+	    "}"
+	  "});"
+
+	"document.body.addEventListener(\"mousemove\", (event) => {"
+
+    //"console.log(\"Body mouse move\");"
+
+	    "if (Module.selected_toplevel) {"
+
+	      "Module.selected_toplevel.style.left = (Module.start_x+event.clientX-Module.selected_x)+\"px\";"
+	      "Module.selected_toplevel.style.top = (Module.start_y+event.clientY-Module.selected_y)+\"px\";"
+	    "}"
+
+	  "}, false);"
+
+	"document.body.addEventListener(\"mousedown\", (event) => {"
+
+    //"console.log(\"Body mouse down: click outside window !\");"
+    //"console.log(event);"
+
+	    "let m = new Object();"
+
+	    "m.type = 8;" // mouse down
+	    "m.pid = Module.getpid() & 0x0000ffff;"
+	    "m.x = event.clientX;"
+	    "m.y = event.clientY;"
+
+	    "window.parent.postMessage(m);"
+
+	  "}, false);"
+
+	"document.body.addEventListener(\"mouseup\", (event) => {"
+
+    //"console.log(\"Body mouse up\");"
+
+	    "Module.selected_toplevel = null;"
+
+	  "}, false);"
+    "}";
+
+  //}
+  //, ((struct xdg_surface *)proxy)->wl_surface->id);*/
+
+  static int xdg_surface_get_toplevel_handle = -1;
+
+  if (xdg_surface_get_toplevel_handle < 0)
+    xdg_surface_get_toplevel_handle = emscripten_load_fun(fun, "vi");
+
+  js_run(xdg_surface_get_toplevel_handle, ((struct xdg_surface *)proxy)->wl_surface->id);
+
+  struct xdg_toplevel * toplevel = (struct xdg_toplevel *)object_pool_alloc(OBJECT_POOL_XDG_TOPLEVEL, &xdg_toplevel_interface);
+
+  if (!toplevel)
+    return NULL;
+
+  toplevel->xdg_surface = (struct xdg_surface *)proxy;
+
+  ((struct xdg_surface *)proxy)->xdg_toplevel = toplevel;
+
+  LOG_DEBUG("XDG_SURFACE_GET_TOPLEVEL: %p", toplevel);
+
+  return (struct wl_proxy *)toplevel;
+}
+
+static struct wl_proxy * marshal_xdg_surface_ack_configure(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  LOG_DEBUG("XDG_SURFACE_ACK_CONFIGURE");
+
+  /*EM_ASM({*/
+
+  const char * fun = 
+
+    "window.requestAnimationFrame(Module['wayland'].render);";
+
+  /*});*/
+
+  static int xdg_surface_ack_configure_handle = -1;
+
+  if (xdg_surface_ack_configure_handle < 0)
+    xdg_surface_ack_configure_handle = emscripten_load_fun(fun, "v");
+
+  js_run(xdg_surface_ack_configure_handle);
+
+  return NULL;
+}
+
+static struct wl_proxy * marshal_xdg_toplevel_set_title(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
+
+  char * title = (char *)va_arg(ap, char *);
+
+  if (title)
+    strcpy(((struct xdg_toplevel *)proxy)->title, title);
+  else
+    ((struct xdg_toplevel *)proxy)->title[0] = 0;
+
+  const char * fun =
+
+    //"console.log($0);"
+    //"console.log(Module['surfaces'][$0-1]);"
+
+	"let w = Module['surfaces'][$0-1].parentElement;"
+
+    //"console.log(w);"
+
+	"let deco = w.firstElementChild;"
+
+    //"console.log(deco);"
+
+	"if (deco) {"
+
+	    "let titles = deco.getElementsByClassName('title');"
+
+	    "if (titles && (titles.length > 0)) {"
+
+	      "let title = titles[0];"
 
-static const struct wl_message wl_display_events[] = {
-	{ "error", "ous", wayland_types + 0 },
-	{ "delete_id", "u", wayland_types + 0 },
-};
+	      "if (title) {"
 
-const struct wl_interface wl_display_interface = {
-	"wl_display", 1,
-	2, wl_display_requests,
-	2, wl_display_events,
-};
+		  "title.innerHTML = UTF8ToString($1);"
+	      "}"
+	    "}"
+	"}";
 
-static const struct wl_message wl_registry_requests[] = {
-	{ "bind", "usun", wayland_types + 0 },
-};
+    static int toplevel_set_title_handle = -1;
 
-static const struct wl_message wl_registry_events[] = {
-	{ "global", "usu", wayland_types + 0 },
-	{ "global_remove", "u", wayland_types + 0 },
-};
+  if (toplevel_set_title_handle < 0)
+    toplevel_set_title_handle = emscripten_load_fun(fun, "vip");
 
-const struct wl_interface wl_registry_interface = {
-	"wl_registry", 1,
-	1, wl_registry_requests,
-	2, wl_registry_events,
-};
+  js_run(toplevel_set_title_handle, ((struct xdg_toplevel *)proxy)->xdg_surface->wl_surface->id, ((struct xdg_toplevel *)proxy)->title);
 
-static const struct wl_message wl_callback_events[] = {
-	{ "done", "u", wayland_types + 0 },
-};
+  return NULL;
+}
 
-const struct wl_interface wl_callback_interface = {
-	"wl_callback", 1,
-	0, NULL,
-	1, wl_callback_events,
-};
+static struct wl_proxy * marshal_xdg_toplevel_destroy(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-static const struct wl_message wl_compositor_requests[] = {
-	{ "create_surface", "n", wayland_types + 10 },
-	{ "create_region", "n", wayland_types + 11 },
-};
+  LOG_DEBUG("XDG_TOPLEVEL_DESTROY");
 
-const struct wl_interface wl_compositor_interface = {
-	"wl_compositor", 6,
-	2, wl_compositor_requests,
-	0, NULL,
-};
+  return NULL;
+}
 
-static const struct wl_message wl_shm_pool_requests[] = {
-	{ "create_buffer", "niiiiu", wayland_types + 12 },
-	{ "destroy", "", wayland_types + 0 },
-	{ "resize", "i", wayland_types + 0 },
-};
+static void damage_add(struct damage * damage, int x, int y, int width, int height);
+static void damage_finish(struct damage * damage, int width, int height);
 
-const struct wl_interface wl_shm_pool_interface = {
-	"wl_shm_pool", 1,
-	3, wl_shm_pool_requests,
-	0, NULL,
-};
+/* The input region goes to the canvas, whose listeners drop the pointer events out of it
+   before they reach the event ring. No boxes (-1) for the whole surface */
 
-static const struct wl_message wl_shm_requests[] = {
-	{ "create_pool", "nhi", wayland_types + 18 },
-};
+static void surface_send_input_region(struct wl_surface * surface) {
 
-static const struct wl_message wl_shm_events[] = {
-	{ "format", "u", wayland_types + 0 },
-};
+  /*EM_ASM({*/
 
-const struct wl_interface wl_shm_interface = {
-	"wl_shm", 1,
-	1, wl_shm_requests,
-	1, wl_shm_events,
-};
+  const char * fun =
 
+    "const canvas = Module['surfaces'][$0-1];"
 
-static const struct wl_message wl_surface_requests[] = {
-	{ "destroy", "", wayland_types + 0 },
-	{ "attach", "?oii", wayland_types + 58 },
-	{ "damage", "iiii", wayland_types + 0 },
-	{ "frame", "n", wayland_types + 61 },
-	{ "set_opaque_region", "?o", wayland_types + 62 },
-	{ "set_input_region", "?o", wayland_types + 63 },
-	{ "commit", "", wayland_types + 0 },
-	{ "set_buffer_transform", "2i", wayland_types + 0 },
-	{ "set_buffer_scale", "3i", wayland_types + 0 },
-	{ "damage_buffer", "4iiii", wayland_types + 0 },
-	{ "offset", "5ii", wayland_types + 0 },
-};
+    "if (canvas)"
+      "canvas.wlInput = ($1 < 0)?null:Module.HEAP32.slice($2 >> 2, ($2 >> 2) + $1 * 4);";
 
-static const struct wl_message wl_surface_events[] = {
-	{ "enter", "o", wayland_types + 64 },
-	{ "leave", "o", wayland_types + 65 },
-	{ "preferred_buffer_scale", "6i", wayland_types + 0 },
-	{ "preferred_buffer_transform", "6u", wayland_types + 0 },
-};
+  //}, surface->id, nb_boxes, boxes);*/
 
-const struct wl_interface wl_surface_interface = {
-	"wl_surface", 6,
-	11, wl_surface_requests,
-	4, wl_surface_events,
-};
+  static int surface_send_input_region_handle = -1;
 
-static const struct wl_message wl_buffer_requests[] = {
-	{ "destroy", "", wayland_types + 0 },
-};
+  if (surface_send_input_region_handle < 0)
+    surface_send_input_region_handle = emscripten_load_fun(fun, "viip");
 
-static const struct wl_message wl_buffer_events[] = {
-	{ "release", "", wayland_types + 0 },
-};
+  int nb_boxes = (surface->input_set)?surface->input_region.nb_boxes:-1;
 
-const struct wl_interface wl_buffer_interface = {
-	"wl_buffer", 1,
-	1, wl_buffer_requests,
-	1, wl_buffer_events,
-};
+  js_run(surface_send_input_region_handle, surface->id, nb_boxes, surface->input_region.boxes);
 
-static const struct wl_interface *xdg_shell_types[] = {
-	NULL,
-	NULL,
-	NULL,
-	NULL,
-	/*&xdg_positioner_interface*/NULL,
-	/*&xdg_surface_interface*/NULL,
-	/*&wl_surface_interface*/NULL,
-	/*&xdg_toplevel_interface*/NULL,
-	#if 0
-	&xdg_popup_interface,
-	&xdg_surface_interface,
-	&xdg_positioner_interface,
-	&xdg_toplevel_interface,
-	&wl_seat_interface,
-	NULL,
-	NULL,
-	NULL,
-	&wl_seat_interface,
-	NULL,
-	&wl_seat_interface,
-	NULL,
-	NULL,
-	&wl_output_interface,
-	&wl_seat_interface,
-	NULL,
-	&xdg_positioner_interface,
-	NULL,
-	#endif
-};
+  surface->input_changed = 0;
+}
 
-static const struct wl_message xdg_wm_base_requests[] = {
-	{ "destroy", "", xdg_shell_types + 0 },
-	{ "create_positioner", "n", xdg_shell_types + 4 },
-	{ "get_xdg_surface", "no", xdg_shell_types + 5 },
-	{ "pong", "u", xdg_shell_types + 0 },
-};
+static int shm_get_mem(int fd) {
 
-static const struct wl_message xdg_wm_base_events[] = {
-	{ "ping", "u", xdg_shell_types + 0 },
-};
+  /*EM_ASM({*/
 
-const struct wl_interface xdg_wm_base_interface = {
-	"xdg_wm_base", 6,
-	4, xdg_wm_base_requests,
-	1, xdg_wm_base_events,
-};
+  const char * fun =
 
-static const struct wl_message xdg_surface_requests[] = {
-	{ "destroy", "", xdg_shell_types + 0 },
-	{ "get_toplevel", "n", xdg_shell_types + 7 },
-	{ "get_popup", "n?oo", xdg_shell_types + 8 },
-	{ "set_window_geometry", "iiii", xdg_shell_types + 0 },
-	{ "ack_configure", "u", xdg_shell_types + 0 },
-};
+    "const shm = Module['shm'].fds[$0-0x7f000000];"
 
-static const struct wl_message xdg_surface_events[] = {
-	{ "configure", "u", xdg_shell_types + 0 },
-};
+    "return (shm)?shm.mem:0;";
 
-const struct wl_interface xdg_surface_interface = {
-	"xdg_surface", 6,
-	5, xdg_surface_requests,
-	1, xdg_surface_events,
-};
+  //}, fd);*/
 
-static const struct wl_message xdg_toplevel_requests[] = {
-	{ "destroy", "", xdg_shell_types + 0 },
-	{ "set_parent", "?o", xdg_shell_types + 11 },
-	{ "set_title", "s", xdg_shell_types + 0 },
-	{ "set_app_id", "s", xdg_shell_types + 0 },
-	{ "show_window_menu", "ouii", xdg_shell_types + 12 },
-	{ "move", "ou", xdg_shell_types + 16 },
-	{ "resize", "ouu", xdg_shell_types + 18 },
-	{ "set_max_size", "ii", xdg_shell_types + 0 },
-	{ "set_min_size", "ii", xdg_shell_types + 0 },
-	{ "set_maximized", "", xdg_shell_types + 0 },
-	{ "unset_maximized", "", xdg_shell_types + 0 },
-	{ "set_fullscreen", "?o", xdg_shell_types + 21 },
-	{ "unset_fullscreen", "", xdg_shell_types + 0 },
-	{ "set_minimized", "", xdg_shell_types + 0 },
-};
+  static int shm_get_mem_handle = -1;
 
-static const struct wl_message xdg_toplevel_events[] = {
-	{ "configure", "iia", xdg_shell_types + 0 },
-	{ "close", "", xdg_shell_types + 0 },
-	{ "configure_bounds", "4ii", xdg_shell_types + 0 },
-	{ "wm_capabilities", "5a", xdg_shell_types + 0 },
-};
+  if (shm_get_mem_handle < 0)
+    shm_get_mem_handle = emscripten_load_fun(fun, "ii");
 
-const struct wl_interface xdg_toplevel_interface = {
-	"xdg_toplevel", 6,
-	14, xdg_toplevel_requests,
-	4, xdg_toplevel_events,
-};
+  return js_run(shm_get_mem_handle, fd);
+}
 
-static const struct wl_message wl_data_offer_requests[] = {
-	{ "accept", "u?s", wayland_types + 0 },
-	{ "receive", "sh", wayland_types + 0 },
-	{ "destroy", "", wayland_types + 0 },
-	{ "finish", "3", wayland_types + 0 },
-	{ "set_actions", "3uu", wayland_types + 0 },
-};
+/* For clients damaging the whole surface at each frame: the buffer is compared to a copy of
+   the last frame by tiles of TILE_SIZE, the damage becomes the changed tiles (merged in spans
+   along each row of tiles), or nothing at all for an identical frame. Damage given by the client
+   is trusted, then only its boxes are copied */
 
-static const struct wl_message wl_data_offer_events[] = {
-	{ "offer", "s", wayland_types + 0 },
-	{ "source_actions", "3u", wayland_types + 0 },
-	{ "action", "3u", wayland_types + 0 },
-};
+static void surface_diff_tiles(struct wl_surface * surface, struct wl_buffer * buffer, const uint8_t * pixels) {
 
-const struct wl_interface wl_data_offer_interface = {
-	"wl_data_offer", 3,
-	5, wl_data_offer_requests,
-	3, wl_data_offer_events,
-};
+  struct damage * damage = &surface->damage;
+
+  int width = buffer->width, height = buffer->height;
+  size_t row_bytes = (size_t)width * 4;
+
+  int full = region_empty(&damage->region) || region_contains_box(&damage->region, (struct region_box){ 0, 0, width, height });
+
+  if ( !surface->shadow || (surface->shadow_width != width) || (surface->shadow_height != height) ) {
+
+    free(surface->shadow);
+
+    surface->shadow = (uint8_t *)malloc(row_bytes * height);
+    surface->shadow_width = width;
+    surface->shadow_height = height;
+
+    if (surface->shadow) {
+
+      for (int y = 0; y < height; ++y)
+	memcpy(surface->shadow + y * row_bytes, pixels + (size_t)y * buffer->stride, row_bytes);
+    }
+
+    return;
+  }
+
+  if (!full) {
+
+    for (int i = 0; i < damage->region.nb_boxes; ++i) {
+
+      const struct region_box * box = &damage->region.boxes[i];
+
+      int x0 = (box->x1 < 0)?0:box->x1;
+      int x1 = (box->x2 > width)?width:box->x2;
+      int y0 = (box->y1 < 0)?0:box->y1;
+      int y1 = (box->y2 > height)?height:box->y2;
+
+      for (int y = y0; (y < y1) && (x1 > x0); ++y)
+	memcpy(surface->shadow + y * row_bytes + x0 * 4, pixels + (size_t)y * buffer->stride + x0 * 4, (size_t)(x1 - x0) * 4);
+    }
+
+    return;
+  }
+
+  region_clear(&damage->region);
+
+  int changed = 0;
+
+  for (int ty = 0; ty < height; ty += TILE_SIZE) {
+
+    int th = (height - ty < TILE_SIZE)?height - ty:TILE_SIZE;
+    int span = -1; // first changed tile of the current span
+
+    for (int tx = 0; tx < width; tx += TILE_SIZE) {
+
+      int tw = (width - tx < TILE_SIZE)?width - tx:TILE_SIZE;
+      int tile_changed = 0;
+
+      for (int y = ty; y < ty + th; ++y) {
+
+	const uint8_t * src = pixels + (size_t)y * buffer->stride + tx * 4;
+	uint8_t * dst = surface->shadow + y * row_bytes + tx * 4;
+
+	if (tile_changed) {
+
+	  memcpy(dst, src, tw * 4);
+	}
+	else if (!pixel_equal(src, dst, tw * 4)) {
+
+	  tile_changed = 1;
+	  memcpy(dst, src, tw * 4);
+	}
+      }
+
+      if (tile_changed) {
+
+	changed += tw * th;
+
+	if (span < 0)
+	  span = tx;
+      }
+      else if (span >= 0) {
+
+	damage_add(damage, span, ty, tx - span, th);
+	span = -1;
+      }
+    }
+
+    if (span >= 0)
+      damage_add(damage, span, ty, width - span, th);
+  }
+
+  if (!changed) {
+
+    damage->unchanged = 1;
+    ++client_stats.frames_unchanged;
+  }
 
-static const struct wl_message wl_data_source_requests[] = {
-	{ "offer", "s", wayland_types + 0 },
-	{ "destroy", "", wayland_types + 0 },
-	{ "set_actions", "3u", wayland_types + 0 },
-};
+  client_stats.upload_bytes_saved += ((uint64_t)width * height - changed) * 4;
+}
 
-static const struct wl_message wl_data_source_events[] = {
-	{ "target", "?s", wayland_types + 0 },
-	{ "send", "sh", wayland_types + 0 },
-	{ "cancelled", "", wayland_types + 0 },
-	{ "dnd_drop_performed", "3", wayland_types + 0 },
-	{ "dnd_finished", "3", wayland_types + 0 },
-	{ "action", "3u", wayland_types + 0 },
-};
+/* Rows of the buffer converted to RGBA at commit: the damaged ones, plus those of the
+   commits not rendered yet as JS draws their damage from the latest buffer. The whole
+   buffer when the damage is unknown, the size changed, rgba was never filled or the
+   surface last converted another buffer: damage is relative to the previous frame, so
+   with buffers in rotation the rows changed since this one was converted are unknown */
 
-const struct wl_interface wl_data_source_interface = {
-	"wl_data_source", 3,
-	3, wl_data_source_requests,
-	6, wl_data_source_events,
-};
+static int surface_convert(struct wl_surface * surface, struct wl_buffer * buffer, const uint8_t * pixels, enum pixel_kernel kernel) {
 
-static const struct wl_message wl_data_device_requests[] = {
-	{ "start_drag", "?oo?ou", wayland_types + 21 },
-	{ "set_selection", "?ou", wayland_types + 25 },
-	{ "release", "2", wayland_types + 0 },
-};
+  struct damage * damage = &surface->damage;
 
-static const struct wl_message wl_data_device_events[] = {
-	{ "data_offer", "n", wayland_types + 27 },
-	{ "enter", "uoff?o", wayland_types + 28 },
-	{ "leave", "", wayland_types + 0 },
-	{ "motion", "uff", wayland_types + 0 },
-	{ "drop", "", wayland_types + 0 },
-	{ "selection", "?o", wayland_types + 33 },
-};
+  int y0 = 0, y1 = buffer->height;
+  int queued = 0;
 
-const struct wl_interface wl_data_device_interface = {
-	"wl_data_device", 3,
-	3, wl_data_device_requests,
-	6, wl_data_device_events,
-};
+  int current = buffer->converted && (buffer->kernel == kernel) && (surface->converted_buffer == buffer);
 
-static const struct wl_message wl_data_device_manager_requests[] = {
-	{ "create_data_source", "n", wayland_types + 34 },
-	{ "get_data_device", "no", wayland_types + 35 },
-};
+  if (damage->unchanged && current) {
 
-const struct wl_interface wl_data_device_manager_interface = {
-	"wl_data_device_manager", 3,
-	2, wl_data_device_manager_requests,
-	0, NULL,
-};
+    y0 = y1 = 0;
+  }
+  else if ( current && !damage->unchanged && !region_empty(&damage->region) && (surface->width == buffer->width) && (surface->height == buffer->height) ) {
 
-static const struct wl_message wl_seat_requests[] = {
-	{ "get_pointer", "n", wayland_types + 66 },
-	{ "get_keyboard", "n", wayland_types + 67 },
-	{ "get_touch", "n", wayland_types + 68 },
-	{ "release", "5", wayland_types + 0 },
-};
+    // Clipped to the buffer by damage_finish
 
-static const struct wl_message wl_seat_events[] = {
-	{ "capabilities", "u", wayland_types + 0 },
-	{ "name", "2s", wayland_types + 0 },
-};
+    y0 = damage->region.extents.y1;
+    y1 = damage->region.extents.y2;
+  }
 
-const struct wl_interface wl_seat_interface = {
-	"wl_seat", 6,
-	4, wl_seat_requests,
-	2, wl_seat_events,
-};
+  if (surface->commits_pending) {
 
-static const struct wl_message wl_pointer_requests[] = {
-	{ "set_cursor", "u?oii", wayland_types + 69 },
-	{ "release", "3", wayland_types + 0 },
-};
+    if (surface->pending_y0 < y0)
+      y0 = surface->pending_y0;
+    if (surface->pending_y1 > y1)
+      y1 = (surface->pending_y1 > buffer->height)?buffer->height:surface->pending_y1;
+  }
 
-static const struct wl_message wl_pointer_events[] = {
-	{ "enter", "uoff", wayland_types + 73 },
-	{ "leave", "uo", wayland_types + 77 },
-	{ "motion", "uff", wayland_types + 0 },
-	{ "button", "uuuu", wayland_types + 0 },
-	{ "axis", "uuf", wayland_types + 0 },
-	{ "frame", "5", wayland_types + 0 },
-	{ "axis_source", "5u", wayland_types + 0 },
-	{ "axis_stop", "5uu", wayland_types + 0 },
-	{ "axis_discrete", "5ui", wayland_types + 0 },
-};
+  if (y1 > y0) {
 
-const struct wl_interface wl_pointer_interface = {
-	"wl_pointer", 6,
-	2, wl_pointer_requests,
-	9, wl_pointer_events,
-};
+#ifdef EXA_WAYLAND_THREADS
+    convert_wait(buffer);
 
-static const struct wl_message wl_keyboard_requests[] = {
-	{ "release", "3", wayland_types + 0 },
-};
+    queued = convert_bands(buffer, pixels, kernel, y0, y1);
 
-static const struct wl_message wl_keyboard_events[] = {
-	{ "keymap", "uhu", wayland_types + 0 },
-	{ "enter", "uoa", wayland_types + 79 },
-	{ "leave", "uo", wayland_types + 82 },
-	{ "key", "uuuu", wayland_types + 0 },
-	{ "modifiers", "uuuuu", wayland_types + 0 },
-	{ "repeat_info", "4ii", wayland_types + 0 },
-};
+    if (!queued)
+#endif
+    pixel_convert(kernel, buffer->rgba, pixels, buffer->stride, buffer->width, y0, y1);
 
-const struct wl_interface wl_keyboard_interface = {
-	"wl_keyboard", 6,
-	1, wl_keyboard_requests,
-	6, wl_keyboard_events,
-};
+    client_stats.rows_converted += y1 - y0;
+  }
 
-static const struct wl_message wl_touch_requests[] = {
-	{ "release", "3", wayland_types + 0 },
-};
+  if ( (y0 == 0) && (y1 == buffer->height) )
+    buffer->converted = 1;
 
-static const struct wl_message wl_touch_events[] = {
-	{ "down", "uuoiff", wayland_types + 84 },
-	{ "up", "uui", wayland_types + 0 },
-	{ "motion", "uiff", wayland_types + 0 },
-	{ "frame", "", wayland_types + 0 },
-	{ "cancel", "", wayland_types + 0 },
-	{ "shape", "6iff", wayland_types + 0 },
-	{ "orientation", "6if", wayland_types + 0 },
-};
+  buffer->kernel = kernel;
 
-const struct wl_interface wl_touch_interface = {
-	"wl_touch", 6,
-	1, wl_touch_requests,
-	7, wl_touch_events,
-};
+  surface->converted_buffer = buffer;
+  surface->pending_y0 = y0;
+  surface->pending_y1 = y1;
+  ++surface->commits_pending;
 
-static const struct wl_message wl_output_requests[] = {
-	{ "release", "3", wayland_types + 0 },
-};
+  surface->width = buffer->width;
+  surface->height = buffer->height;
 
-static const struct wl_message wl_output_events[] = {
-	{ "geometry", "iiiiissi", wayland_types + 0 },
-	{ "mode", "uiii", wayland_types + 0 },
-	{ "done", "2", wayland_types + 0 },
-	{ "scale", "2i", wayland_types + 0 },
-	{ "name", "4s", wayland_types + 0 },
-	{ "description", "4s", wayland_types + 0 },
-};
+  return queued;
+}
 
-WL_EXPORT const struct wl_interface wl_output_interface = {
-	"wl_output", 4,
-	1, wl_output_requests,
-	6, wl_output_events,
-	};
+static struct wl_proxy * marshal_wl_surface_commit(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-extern const struct wl_interface zwp_primary_selection_device_v1_interface;
-extern const struct wl_interface zwp_primary_selection_offer_v1_interface;
-extern const struct wl_interface zwp_primary_selection_source_v1_interface;
+  LOG_TRACE("WL_SURFACE_COMMIT: %p", proxy);
 
-static const struct wl_interface *wp_primary_selection_unstable_v1_types[] = {
-	NULL,
-	NULL,
-	&zwp_primary_selection_source_v1_interface,
-	&zwp_primary_selection_device_v1_interface,
-	&wl_seat_interface,
-	&zwp_primary_selection_source_v1_interface,
-	NULL,
-	&zwp_primary_selection_offer_v1_interface,
-	&zwp_primary_selection_offer_v1_interface,
-};
+  if (((struct wl_surface *)proxy)->input_changed)
+    surface_send_input_region((struct wl_surface *)proxy);
 
-static const struct wl_message zwp_primary_selection_device_manager_v1_requests[] = {
-	{ "create_source", "n", wp_primary_selection_unstable_v1_types + 2 },
-	{ "get_device", "no", wp_primary_selection_unstable_v1_types + 3 },
-	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
-};
+  // A destroyed buffer is detached by wl_proxy_destroy, a freed proxy has no interface
 
-const struct wl_interface zwp_primary_selection_device_manager_v1_interface = {
-	"zwp_primary_selection_device_manager_v1", 1,
-	3, zwp_primary_selection_device_manager_v1_requests,
-	0, NULL,
-};
+  if ( ((struct wl_surface *)proxy)->buffer && !((struct wl_surface *)proxy)->buffer->proxy.interface )
+    ((struct wl_surface *)proxy)->buffer = NULL;
 
-static const struct wl_message zwp_primary_selection_device_v1_requests[] = {
-	{ "set_selection", "?ou", wp_primary_selection_unstable_v1_types + 5 },
-	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
-};
+  if ( ((struct wl_surface *)proxy)->buffer && ((struct wl_surface *)proxy)->buffer->invalid ) {
 
-static const struct wl_message zwp_primary_selection_device_v1_events[] = {
-	{ "data_offer", "n", wp_primary_selection_unstable_v1_types + 7 },
-	{ "selection", "?o", wp_primary_selection_unstable_v1_types + 8 },
-};
+    LOG_ERROR("WL_SURFACE_COMMIT: invalid buffer %d not drawn", ((struct wl_surface *)proxy)->buffer->id);
 
-const struct wl_interface zwp_primary_selection_device_v1_interface = {
-	"zwp_primary_selection_device_v1", 1,
-	2, zwp_primary_selection_device_v1_requests,
-	2, zwp_primary_selection_device_v1_events,
-};
+    region_clear(&((struct wl_surface *)proxy)->damage.region);
+  }
+  else if (((struct wl_surface *)proxy)->buffer) {
 
-static const struct wl_message zwp_primary_selection_offer_v1_requests[] = {
-	{ "receive", "sh", wp_primary_selection_unstable_v1_types + 0 },
-	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
-};
+    /*EM_ASM({*/
 
-static const struct wl_message zwp_primary_selection_offer_v1_events[] = {
-	{ "offer", "s", wp_primary_selection_unstable_v1_types + 0 },
-};
+    const char * fun = 
 
-const struct wl_interface zwp_primary_selection_offer_v1_interface = {
-	"zwp_primary_selection_offer_v1", 1,
-	2, zwp_primary_selection_offer_v1_requests,
-	1, zwp_primary_selection_offer_v1_events,
-};
+	"Module['wayland'].requests.push({"
+
+	  "'type': 'commit',"
+	  "'surface_id': $0,"
+	  "'buffer_id': $1,"
+	  "'pixels': $3,"
+	  "'width': $4,"
+	  "'height': $5,"
+	  "'damage': ($6 > 0)?Module['wayland'].boxRects($7, $6):(($6 < 0)?[]:null),"
+	  "'ready': $8,"
+	  "'seq': $9,"
+	  "'opaque': $10"
+	  "});"
 
-static const struct wl_message zwp_primary_selection_source_v1_requests[] = {
-	{ "offer", "s", wp_primary_selection_unstable_v1_types + 0 },
-	{ "destroy", "", wp_primary_selection_unstable_v1_types + 0 },
-};
+	"if (!Module.iframeShown) {"
 
-static const struct wl_message zwp_primary_selection_source_v1_events[] = {
-	{ "send", "sh", wp_primary_selection_unstable_v1_types + 0 },
-	{ "cancelled", "", wp_primary_selection_unstable_v1_types + 0 },
-};
+	  "Module.iframeShown = true;"
 
-const struct wl_interface zwp_primary_selection_source_v1_interface = {
-	"zwp_primary_selection_source_v1", 1,
-	2, zwp_primary_selection_source_v1_requests,
-	2, zwp_primary_selection_source_v1_events,
-};
+	  "let m = new Object();"
 
+	  "m.type = 7;" // show iframe and hide body
+	  "m.pid = Module.getpid() & 0x0000ffff;"
 
-extern const struct wl_interface xdg_toplevel_interface;
-extern const struct wl_interface zxdg_toplevel_decoration_v1_interface;
+	  "window.parent.postMessage(m);"
+	    "}"
 
-static const struct wl_interface *xdg_decoration_unstable_v1_types[] = {
-	NULL,
-	&zxdg_toplevel_decoration_v1_interface,
-	&xdg_toplevel_interface,
-};
+	// Address of the pool in the heap, the pixels are converted from there
 
-static const struct wl_message zxdg_decoration_manager_v1_requests[] = {
-	{ "destroy", "", xdg_decoration_unstable_v1_types + 0 },
-	{ "get_toplevel_decoration", "no", xdg_decoration_unstable_v1_types + 1 },
-};
+	"const shm = Module['shm'].fds[$2-0x7f000000];"
 
-const struct wl_interface zxdg_decoration_manager_v1_interface = {
-	"zxdg_decoration_manager_v1", 1,
-	2, zxdg_decoration_manager_v1_requests,
-	0, NULL,
-};
+	"return (shm)?shm.mem:0;";
 
-static const struct wl_message zxdg_toplevel_decoration_v1_requests[] = {
-	{ "destroy", "", xdg_decoration_unstable_v1_types + 0 },
-	{ "set_mode", "u", xdg_decoration_unstable_v1_types + 0 },
-	{ "unset_mode", "", xdg_decoration_unstable_v1_types + 0 },
-};
+	  //}, ((struct wl_surface *)proxy)->id, ((struct wl_surface *)proxy)->buffer->fd, ((struct wl_surface *)proxy)->buffer->width, ((struct wl_surface *)proxy)->buffer->height);*/
 
-static const struct wl_message zxdg_toplevel_decoration_v1_events[] = {
-	{ "configure", "u", xdg_decoration_unstable_v1_types + 0 },
-};
+    static int wl_surface_commit_handle = -1;
 
-const struct wl_interface zxdg_toplevel_decoration_v1_interface = {
-	"zxdg_toplevel_decoration_v1", 1,
-	3, zxdg_toplevel_decoration_v1_requests,
-	1, zxdg_toplevel_decoration_v1_events,
-};
+  if (wl_surface_commit_handle < 0)
+    wl_surface_commit_handle = emscripten_load_fun(fun, "iiiipiiippii");
 
+  struct wl_surface * surface = (struct wl_surface *)proxy;
+  struct damage * damage = &surface->damage;
+  struct wl_buffer * buffer = surface->buffer;
 
+#ifdef EXA_WAYLAND_THREADS
+  uint32_t * ready = (convert_pool.nb_threads)?&buffer->ready:NULL; // JS waits for the convert pool
+#else
+  uint32_t * ready = NULL;
+#endif
 
+  ++buffer->seq;
 
-static struct wl_compositor compositor = {
+  // Opaque surfaces skip the alpha conversion, and blending in a canvas without alpha
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_compositor_interface,
-  },
-};
+  enum pixel_kernel kernel = pixel_kernel_from_format(buffer->format);
 
-static struct wl_shm shm = {
+  int opaque = (kernel == PIXEL_KERNEL_XRGB8888) || (kernel == PIXEL_KERNEL_XBGR8888) || region_contains_box(&surface->opaque_region, (struct region_box){ 0, 0, buffer->width, buffer->height });
 
-  .proxy = {
+  if (opaque && (kernel == PIXEL_KERNEL_ARGB8888))
+    kernel = PIXEL_KERNEL_XRGB8888;
+  else if (opaque && (kernel == PIXEL_KERNEL_ABGR8888))
+    kernel = PIXEL_KERNEL_XBGR8888;
 
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_shm_interface,
-  },
-};
+  if (!buffer->rgba)
+    buffer->rgba = (uint8_t *)malloc((size_t)buffer->width * buffer->height * 4);
 
-static struct wl_output output = {
+  if (!buffer->rgba)
+    LOG_ERROR("WL_SURFACE_COMMIT: cannot allocate %dx%d pixels", buffer->width, buffer->height);
 
-  .proxy = {
+  if (tile_diff && buffer->rgba) {
 
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_output_interface,
-  },
-};
+    int pool = shm_get_mem(buffer->fd);
+
+    if (pool)
+      surface_diff_tiles(surface, buffer, (const uint8_t *)(intptr_t)pool + buffer->offset);
+  }
 
-static struct xdg_wm_base xdg_wm_base = {
+  damage_finish(damage, buffer->width, buffer->height);
 
-  .proxy = {
+  int nb_boxes = (damage->unchanged)?-1:damage->region.nb_boxes;
 
-    .version = XDG_WM_BASE_VERSION,
-    .wl_display = &display,
-    .interface = &xdg_wm_base_interface,
-  },
-};
+  int mem = js_run(wl_surface_commit_handle, surface->id, buffer->id, buffer->fd, buffer->rgba, buffer->width, buffer->height, nb_boxes, damage->region.boxes, ready, buffer->seq, opaque);
 
-static struct wl_seat seat = {
+  // JS draws later, from rgba: the client does not touch the buffer until it is released
 
-  .proxy = {
-    
-    .version = WL_SEAT_VERSION,
-    .wl_display = &display,
-    .interface = &wl_seat_interface,
-  },
-};
+  int queued = 0;
 
-static struct wl_keyboard keyboard = {
+  if (mem && buffer->rgba)
+    queued = surface_convert(surface, buffer, (const uint8_t *)(intptr_t)mem + buffer->offset, kernel);
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_keyboard_interface,
-  },
-  .serial = 0,
-};
+  if (!queued)
+    __atomic_store_n(&buffer->ready, buffer->seq, __ATOMIC_RELEASE);
 
-static struct wl_pointer pointer = {
+  region_clear(&damage->region);
+  damage->unchanged = 0;
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_pointer_interface,
-  },
-  .serial = 0,
-};
+  buffer_set_busy(buffer);
 
-static struct zxdg_decoration_manager_v1 decoration_manager = {
+  ++client_stats.commits;
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &zxdg_decoration_manager_v1_interface,
-  },
-};
+  if (TRACE_ENABLED())
+    trace_commit((struct wl_surface *)proxy);
+  }
+  else {
 
-/*static struct zxdg_toplevel_decoration_v1 toplevel_decoration = {
+    struct xdg_surface * xdg_surface = ((struct wl_surface *)proxy)->xdg_surface;
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &zxdg_toplevel_decoration_v1_interface,
-  },
-  };*/
+    if (xdg_surface) {
 
-static struct wl_data_device_manager data_device_manager = {
+      printf("WL_SURFACE_COMMIT: xdg_surface found\n");
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_data_device_manager_interface,
-  },
-};
+      if (((struct wl_proxy *)xdg_surface)->listeners) {
 
-static struct wl_data_device data_device = {
+	queue_xdg_surface_configure(xdg_surface, 0);
+      }
+    }
+  }
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_data_device_interface,
-  },
-};
+  return NULL;
+}
 
-static struct wl_data_offer data_source = {
+static struct wl_proxy * marshal_wl_surface_attach(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_data_source_interface,
-  },
-};
+  struct wl_buffer * buffer = (struct wl_buffer *)va_arg(ap, struct wl_buffer*);
 
-static struct wl_data_offer data_offer = {
+  int x = va_arg(ap, int);
+  int y = va_arg(ap, int);
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &wl_data_offer_interface,
-  },
-};
+  printf("WL_SURFACE_ATTACH: %p %d %d\n", buffer, x, y);
 
-static struct zwp_primary_selection_device_manager_v1 primary_selection_device_manager = {
+  ((struct wl_surface *)proxy)->buffer = buffer;
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &zwp_primary_selection_device_manager_v1_interface,
-  },
-};
+  return NULL;
+}
 
-static struct zwp_primary_selection_device_v1 primary_selection_device = {
+static struct wl_proxy * marshal_wl_surface_frame(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &zwp_primary_selection_device_v1_interface,
-  },
-};
+  LOG_TRACE("WL_SURFACE_FRAME");
 
-static struct zwp_primary_selection_source_v1 primary_selection_source = {
+  struct wl_callback * callback = (struct wl_callback *)object_pool_alloc(OBJECT_POOL_CALLBACK, &wl_callback_interface);
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &zwp_primary_selection_source_v1_interface,
-  },
-};
+  if (!callback)
+    return NULL;
 
-static struct zwp_primary_selection_offer_v1 primary_data_offer = {
+  callback->wl_surface = (struct wl_surface *)proxy;
 
-  .proxy = {
-    
-    .version = 0,
-    .wl_display = &display,
-    .interface = &zwp_primary_selection_offer_v1_interface,
-  },
-};
+  // Appended: callbacks are done in the order they were requested
 
-struct wl_proxy *
-wl_proxy_marshal_flags(struct wl_proxy *proxy, uint32_t opcode,
-		       const struct wl_interface *interface, uint32_t version,
-		       uint32_t flags, ...) {
+  struct wl_callback ** last = &((struct wl_surface *)proxy)->frame_callbacks;
 
-  emscripten_log(EM_LOG_CONSOLE, "wl_proxy_marshal_flags: %p %p %p %d", proxy, proxy->interface, interface, opcode);
+  while (*last)
+    last = &(*last)->next;
 
-  if (!proxy || !proxy->interface || !proxy->interface->name)
-    return NULL;
+  *last = callback;
 
-  emscripten_log(EM_LOG_CONSOLE, "wl_proxy_marshal_flags: %s %d", proxy->interface->name, opcode);
+  ++client_stats.frame_callbacks;
 
-  if ( (strcmp(proxy->interface->name, "wl_display") == 0) &&
-       (opcode == WL_DISPLAY_GET_REGISTRY) ) {
+  return (struct wl_proxy *)callback;
+}
 
-    int i = 1;
-    
-    send_event((struct wl_proxy *) &registry, "global", i++, "wl_compositor", 5);
-    send_event((struct wl_proxy *) &registry, "global", i++, "wl_shm", 1);
-    send_event((struct wl_proxy *) &registry, "global", i++, "wl_output", 3);
-    send_event((struct wl_proxy *) &registry, "global", i++, "xdg_wm_base", XDG_WM_BASE_VERSION);
-    send_event((struct wl_proxy *) &registry, "global", i++, "wl_seat", WL_SEAT_VERSION);
-    send_event((struct wl_proxy *) &registry, "global", i++, "zxdg_decoration_manager_v1", 1);
-    send_event((struct wl_proxy *) &registry, "global", i++, "wl_data_device_manager", 2);
-    send_event((struct wl_proxy *) &registry, "global", i++, "zwp_primary_selection_device_manager_v1", 1);
-    
-    return (struct wl_proxy *)&registry;
+static void damage_add(struct damage * damage, int x, int y, int width, int height) {
+
+  if ( (width <= 0) || (height <= 0) )
+    return;
+
+  if (region_union_box(&damage->region, region_box_make(x, y, width, height)) < 0) {
+
+    // The region has room for one box at least: everything is damaged
+
+    LOG_ERROR("damage_add: out of memory");
+    region_set_box(&damage->region, (struct region_box){ INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX });
   }
-  else if ( (strcmp(proxy->interface->name, "wl_registry") == 0) &&
-       (opcode == WL_REGISTRY_BIND) ) {
+}
 
-    if (!interface)
-      return NULL;
-    
-    if (strcmp(interface->name, "wl_compositor") == 0) {
-      
-      return (struct wl_proxy *)&compositor;
-    }
-    else if (strcmp(interface->name, "wl_shm") == 0) {
+/* Damage as sent to JS: clipped to the buffer, none for the whole buffer, and the bounding box
+   beyond DAMAGE_RECTS_MAX boxes as each one is a separate upload */
 
-      return (struct wl_proxy *)&shm;
-    }
-    else if (strcmp(interface->name, "wl_output") == 0) {
+static void damage_finish(struct damage * damage, int width, int height) {
 
-      return (struct wl_proxy *)&output;
-    }
-    else if (strcmp(interface->name, "xdg_wm_base") == 0) {
+  struct region_box buffer_box = { 0, 0, width, height };
 
-      return (struct wl_proxy *)&xdg_wm_base;
-    }
-    else if (strcmp(interface->name, "wl_seat") == 0) {
+  if ( damage->unchanged || region_empty(&damage->region) )
+    return;
 
-      return (struct wl_proxy *)&seat;
-    }
-    else if (strcmp(interface->name, "zxdg_decoration_manager_v1") == 0) {
+  region_intersect_box(&damage->region, buffer_box);
 
-      return (struct wl_proxy *)&decoration_manager;
-    }
-    else if (strcmp(interface->name, "wl_data_device_manager") == 0) {
+  if (region_empty(&damage->region))
+    damage->unchanged = 1; // all out of the buffer
+  else if (region_contains_box(&damage->region, buffer_box))
+    region_clear(&damage->region);
+  else if (damage->region.nb_boxes > DAMAGE_RECTS_MAX)
+    region_set_box(&damage->region, damage->region.extents);
+}
 
-      return (struct wl_proxy *)&data_device_manager;
-    }
-    else if (strcmp(interface->name, "zwp_primary_selection_device_manager_v1") == 0) {
+static struct wl_proxy * marshal_wl_surface_damage_buffer(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-      return (struct wl_proxy *)&primary_selection_device_manager;
-    }
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_compositor") == 0) &&
-       (opcode == WL_COMPOSITOR_CREATE_SURFACE) ) {
+  int x = va_arg(ap, int);
+  int y = va_arg(ap, int);
+  int width = va_arg(ap, int);
+  int height = va_arg(ap, int);
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_COMPOSITOR_CREATE_SURFACE");
+  LOG_TRACE("WL_SURFACE_DAMAGE_BUFFER: %d %d %d %d", x, y, width, height);
 
-    //int id = 0 /*EM_ASM_INT({*/
+  damage_add(&((struct wl_surface *)proxy)->damage, x, y, width, height);
 
-    const char * fun =
+  return NULL;
+}
 
-	//console.log("degas client: Create surface");
+// Surface coordinates, the same as buffer ones as the buffer scale is always 1
 
-	"const newCanvas = document.createElement(\"canvas\");"
+static struct wl_proxy * marshal_wl_surface_damage(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	"newCanvas.setAttribute(\"tabIndex\", \"1\");"
-	"newCanvas.style.outline = \"none\";"
+  int x = va_arg(ap, int);
+  int y = va_arg(ap, int);
+  int width = va_arg(ap, int);
+  int height = va_arg(ap, int);
 
-	"if (!Module['surfaces'])"
-	  "Module['surfaces'] = new Array();"
+  LOG_TRACE("WL_SURFACE_DAMAGE: %d %d %d %d", x, y, width, height);
 
-	"Module['surfaces'].push(newCanvas);"
+  damage_add(&((struct wl_surface *)proxy)->damage, x, y, width, height);
 
-	"const id = Module['surfaces'].length;"
+  return NULL;
+}
 
-	"newCanvas.addEventListener(\"mouseenter\", (event) => {"
+static struct wl_proxy * marshal_wl_compositor_create_region(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	    //console.log("mouseenter");
+  struct wl_region * region = (struct wl_region *)object_pool_alloc(OBJECT_POOL_REGION, &wl_region_interface);
 
-	    "Module['wayland'].events.push({"
+  LOG_DEBUG("WL_COMPOSITOR_CREATE_REGION: %p", region);
 
-		"'type': 10," // mouseenter
-		"'id': id,"
-		"'x': event.offsetX * window.devicePixelRatio,"
-		"'y': event.offsetY * window.devicePixelRatio"
-		"});"
+  return (struct wl_proxy *)region;
+}
 
-	      "setTimeout(() => {"
+static struct wl_proxy * marshal_wl_region_add(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+  int x = va_arg(ap, int);
+  int y = va_arg(ap, int);
+  int width = va_arg(ap, int);
+  int height = va_arg(ap, int);
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	    
-      "});"
+  LOG_TRACE("WL_REGION_ADD: %d %d %d %d", x, y, width, height);
 
-      "newCanvas.addEventListener(\"mouseleave\", (event) => {"
+  if ( (width > 0) && (height > 0) && (region_union_box(&((struct wl_region *)proxy)->region, region_box_make(x, y, width, height)) < 0) )
+    LOG_ERROR("WL_REGION_ADD: out of memory");
 
-	    //console.log("mouseleave");
+  return NULL;
+}
 
-	    "Module['wayland'].events.push({"
+static struct wl_proxy * marshal_wl_region_subtract(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		"'type': 11," // mouseleave
-		"'id': id,"
-		"'x': event.offsetX * window.devicePixelRatio,"
-		"'y': event.offsetY * window.devicePixelRatio"
-		"});"
+  int x = va_arg(ap, int);
+  int y = va_arg(ap, int);
+  int width = va_arg(ap, int);
+  int height = va_arg(ap, int);
 
-	      "setTimeout(() => {"
+  LOG_TRACE("WL_REGION_SUBTRACT: %d %d %d %d", x, y, width, height);
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+  if ( (width > 0) && (height > 0) && (region_subtract_box(&((struct wl_region *)proxy)->region, region_box_make(x, y, width, height)) < 0) )
+    LOG_ERROR("WL_REGION_SUBTRACT: out of memory");
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	  "});"
+  return NULL;
+}
 
-	"newCanvas.addEventListener(\"mousemove\", (event) => {"
+// The regions are copied, the client may destroy them right after
 
-	    "if (Module.selected_toplevel)"
-	      "return;"
+static struct wl_proxy * marshal_wl_surface_set_opaque_region(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	    "if (Module.pointerListener) {"
+  struct wl_region * region = va_arg(ap, struct wl_region *);
 
-	      "event.preventDefault();"
-	      "event.stopPropagation();"
+  LOG_DEBUG("WL_SURFACE_SET_OPAQUE_REGION: %p %p", proxy, region);
 
-	      //console.log(event);
-	      //console.log("id="+id);
-	      
-              "Module['wayland'].events.push({"
+  struct wl_surface * surface = (struct wl_surface *)proxy;
 
-		"'type': 9," // mousemove
-		"'id': id,"
-		"'x': event.offsetX * window.devicePixelRatio,"
-		"'y': event.offsetY * window.devicePixelRatio"
-		"});"
+  if (!region)
+    region_clear(&surface->opaque_region);
+  else if (region_copy(&surface->opaque_region, &region->region) < 0)
+    region_clear(&surface->opaque_region); // not opaque, which is always correct
 
-	      "setTimeout(() => {"
+  return NULL;
+}
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+// No region means the whole surface, as for a new one
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	    "}"
-	    
-	  "});"
-	
-	"newCanvas.addEventListener(\"mousedown\", (event) => {"
+static struct wl_proxy * marshal_wl_surface_set_input_region(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-            "console.log(event);"
+  struct wl_region * region = va_arg(ap, struct wl_region *);
 
-	    "if (Module.selected_toplevel)"
-	      "return;"
-	    
-	    "if (Module.pointerListener) {"
+  LOG_DEBUG("WL_SURFACE_SET_INPUT_REGION: %p %p", proxy, region);
 
-	      "event.target.focus();"
+  struct wl_surface * surface = (struct wl_surface *)proxy;
 
-	      "event.preventDefault();"
-	      "event.stopPropagation();"
-      
-      //"console.log(\"Mouse Down\");"
-      //"console.log(event);"
-	      //console.log("id="+id);
-	      
-	      "Module['wayland'].events.push({"
+  surface->input_set = (region != NULL);
+  surface->input_changed = 1;
 
-		"'type': 8," // button
-		"'id': id,"
-		"'state': 1," // pressed
-		"'button': event.button"
-		"});"
+  if ( region && (region_copy(&surface->input_region, &region->region) < 0) ) {
 
-	      "setTimeout(() => {"
+    LOG_ERROR("WL_SURFACE_SET_INPUT_REGION: out of memory");
+    surface->input_set = 0;
+  }
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+  return NULL;
+}
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	    "}"
-	    
-	  "});"
+static struct wl_proxy * marshal_wl_shm_create_pool(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	"newCanvas.addEventListener(\"mouseup\", (event) => {"
+  struct wl_shm * wl_shm = va_arg(ap, struct wl_shm*);
+  int fd = va_arg(ap, int);
+  int size = va_arg(ap, int);
 
-	    "if (Module.selected_toplevel)"
-	      "return;"
-	    
-	    "if (Module.pointerListener) {"
+  struct wl_shm_pool * pool = (struct wl_shm_pool *)object_pool_alloc(OBJECT_POOL_SHM_POOL, &wl_shm_pool_interface);
 
-	      "event.preventDefault();"
-	      "event.stopPropagation();"
+  if (!pool)
+    return NULL;
 
-	      //console.log("Mouse Up");
-	      //console.log(event);
-	      //console.log("id="+id);
+  pool->fd = fd;
+  pool->size = size;
 
-	      "Module['wayland'].events.push({"
+  LOG_DEBUG("WL_SHM_CREATE_POOL: fd=%d size=%d -> %p", fd, size, pool);
 
-		"'type': 8," // button
-		"'id': id,"
-		"'state': 0," // released
-		"'button': event.button"
-		"});"
+  return (struct wl_proxy *)pool;
+}
 
-	      "setTimeout(() => {"
+static struct wl_proxy * marshal_wl_shm_pool_create_buffer(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+  printf("WL_SHM_POOL_CREATE_BUFFER: %p\n", proxy);
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	    "}"
-	    
-	  "});"
+  struct wl_shm_pool* dummy1 = va_arg(ap, struct wl_shm_pool*); // it is NULL !!
+  int offset = va_arg(ap, int);
+  int width = va_arg(ap, int);
+  int height = va_arg(ap, int);
+  int stride = va_arg(ap, int);
+  int format = va_arg(ap, int);
 
-	"newCanvas.addEventListener(\"wheel\", (event) => {"
+  printf("WL_SHM_POOL_CREATE_BUFFER: %d %d %d %d %d\n", offset, width, height, stride, format);
 
-	    "if (Module.selected_toplevel)"
-	      "return;"
-	    
-	    "if (Module.pointerListener) {"
+  struct wl_shm_pool * pool = (struct wl_shm_pool *)proxy;
 
-	      //console.log("wheel");
-	      //console.log(event);
+  struct wl_buffer * buffer = (struct wl_buffer *)object_pool_alloc(OBJECT_POOL_BUFFER, &wl_buffer_interface);
 
-	      "Module['wayland'].events.push({"
+  if (!buffer)
+    return NULL;
 
-		"'type': 7," // wheel
-		"'id': id,"
-		"'deltaX': event.deltaX * window.devicePixelRatio,"
-		"'deltaY': event.deltaY * window.devicePixelRatio,"
-		"'deltaMode': event.deltaMode"
-		"});"
+  // Still created, as the client adds its listener, but commits of it are ignored
 
-	      "setTimeout(() => {"
+  if ( (offset < 0) || (width <= 0) || (height <= 0) || ((int64_t)stride < (int64_t)width * 4) || ((int64_t)offset + (int64_t)stride * height > pool->size) ) {
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+    LOG_ERROR("WL_SHM_POOL_CREATE_BUFFER: invalid buffer offset=%d %dx%d stride=%d in a pool of %d bytes", offset, width, height, stride, pool->size);
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	      
-	    "}"
-	    
-	  "});"
+    buffer->invalid = 1;
+  }
 
-	"newCanvas.addEventListener(\"focusin\", (event) => {"
+  buffer->width = width;
+  buffer->height = height;
+  buffer->stride = stride;
+  buffer->format = format;
+  buffer->fd = pool->fd;
+  buffer->offset = offset;
+  buffer->id = next_buffer_id++;
 
-	    //console.log("focusin");
-	    //console.log(event);
+  return (struct wl_proxy *)buffer;
+}
 
-	    "Module['wayland'].events.push({"
+static struct wl_proxy * marshal_wl_shm_pool_destroy(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		"'type': 12," // keyboard focus in
-		"'id': id"
-		"});"
+  // Buffers keep the fd of the pool, which is closed by the client
 
-	      "setTimeout(() => {"
+  return NULL;
+}
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+static struct wl_proxy * marshal_wl_shm_pool_resize(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	  "});"
+  int size = va_arg(ap, int);
 
-	"newCanvas.addEventListener(\"focusout\", (event) => {"
+  LOG_DEBUG("WL_SHM_POOL_RESIZE: %p %d", proxy, size);
 
-	    //console.log("focusout");
-	    //console.log(event);
+  if (size > ((struct wl_shm_pool *)proxy)->size)
+    ((struct wl_shm_pool *)proxy)->size = size; // pools can only grow
 
-	    "Module['wayland'].events.push({"
+  return NULL;
+}
 
-		"'type': 13," // keyboard focus out
-		"'id': id"
-		"});"
+static struct wl_proxy * marshal_wl_seat_get_keyboard(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	      "setTimeout(() => {"
+  return (struct wl_proxy *)&keyboard;
+}
 
-		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+static struct wl_proxy * marshal_wl_seat_get_pointer(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		    // TODO check rw
-		      
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		  "}"
-		    
-		"}, 0);"
-	    
-		"});"
+  pointer.proxy.version = version; // wl_pointer.frame and axis_source need version 5
 
-        "newCanvas.addEventListener(\"contextmenu\", event => event.preventDefault());"
-	
-	"return id;"
-      /*})*/;
+  return (struct wl_proxy *)&pointer;
+}
 
-  static int create_surface_handle = -1;
+static struct wl_proxy * marshal_zxdg_decoration_manager_v1_get_toplevel_decoration(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-  if (create_surface_handle < 0)
-    create_surface_handle = emscripten_load_fun(fun, "i");
-  
-  int id = emscripten_run_fun(create_surface_handle);
-    
-    emscripten_log(EM_LOG_CONSOLE, "WL_COMPOSITOR_CREATE_SURFACE: %d", id);
+  void * dummy = va_arg(ap, void *);
+  struct xdg_toplevel * toplevel = (struct xdg_toplevel *)va_arg(ap, struct xdg_toplevel *);
 
-    for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+  printf("ZXDG_DECORATION_MANAGER_V1_GET_TOPLEVEL_DECORATION: toplevel=%p decoration=%p\n", toplevel, &(toplevel->decoration));
 
-      if (surfaces[i].id < 0) {
+  toplevel->decoration.proxy.version = 0;
+  toplevel->decoration.proxy.wl_display = &display;
+  toplevel->decoration.proxy.interface = &zxdg_toplevel_decoration_v1_interface;
 
-	surfaces[i].id = id;
-	surfaces[i].buffer = NULL;
-	surfaces[i].proxy.version = 0;
-	surfaces[i].proxy.wl_display = &display;
-	surfaces[i].proxy.interface = &wl_surface_interface;
+  toplevel->decoration.mode = ZXDG_TOPLEVEL_DECORATION_V1_MODE_CLIENT_SIDE;
 
-	emscripten_log(EM_LOG_CONSOLE, "WL_COMPOSITOR_CREATE_SURFACE: wl_surface=%p", &surfaces[i]);
+  return (struct wl_proxy *)&(toplevel->decoration);
+}
 
-	return (struct wl_proxy *)&surfaces[i];
-      }
-    }
-  }
-  else if ( (strcmp(proxy->interface->name, "xdg_wm_base") == 0) &&
-       (opcode == XDG_WM_BASE_GET_XDG_SURFACE) ) {
+static struct wl_proxy * marshal_zxdg_toplevel_decoration_v1_set_mode(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-    va_list ap;
+  uint32_t mode = va_arg(ap, uint32_t);
 
-    va_start(ap, flags);
+  ((struct zxdg_toplevel_decoration_v1 *)proxy)->mode = mode;
 
-    void * dummy = va_arg(ap, void*);
+  if (mode == ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE) {
 
-    struct wl_surface * wl_surface = va_arg(ap, struct wl_surface*);
-    
-    va_end(ap);
+    char * ptr = ((char *)proxy)-sizeof(struct xdg_surface *)-sizeof(struct wl_proxy);
 
-    for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+    struct xdg_toplevel * toplevel = (struct xdg_toplevel *)ptr;
 
-      if (xdg_surfaces[i].wl_surface == wl_surface) {
+    printf("ZXDG_TOPLEVEL_DECORATION_V1_SET_MODE: decoration=%p toplevel=%p xdg_surface=%p wl_surface=%p\n", proxy, toplevel, toplevel->xdg_surface, toplevel->xdg_surface->wl_surface);
 
-	emscripten_log(EM_LOG_CONSOLE, "XDG_WM_BASE_GET_XDG_SURFACE: %p", &xdg_surfaces[i]);
+    char defaultInnerHTMLDeco[] = "<div id='innerDeco' style='height:25px;background-color:#ddfffb;display:flex;align-items:center'><img id='close' src='/netfs/usr/share/close_icon.png' style='width:15px;height:13px;margin-left:5px;user-select:none'></img><img id='min' src='/netfs/usr/share/min_icon.png' style='width:15px;height:15px;margin-left:5px;user-select:none'></img><span class='title' style='margin:auto; font-family:sans-serif; user-select:none'>[TITLE]</span></div>\0";
 
-	return (struct wl_proxy *)&xdg_surfaces[i];
-      }
-      else if (xdg_surfaces[i].wl_surface == NULL) {
+    char * innerHTMLDeco = &defaultInnerHTMLDeco[0];
 
-	xdg_surfaces[i].wl_surface = wl_surface;
-	xdg_surfaces[i].proxy.version = 0;
-	xdg_surfaces[i].proxy.wl_display = &display;
-	xdg_surfaces[i].proxy.interface = &xdg_surface_interface;
+    FILE * f = fopen("/home/.config/xdg/deco.html", "r");
 
-	emscripten_log(EM_LOG_CONSOLE, "XDG_WM_BASE_GET_XDG_SURFACE: %p (wl_surface=%p)", &xdg_surfaces[i], wl_surface);
+    if (!f) {
 
-	return (struct wl_proxy *)&xdg_surfaces[i];
-      }
+      f = fopen("/etc/xdg/system/deco.html", "r");
     }
-  }
-  else if ( (strcmp(proxy->interface->name, "xdg_surface") == 0) &&
-       (opcode == XDG_SURFACE_GET_TOPLEVEL) ) {
-
-    emscripten_log(EM_LOG_CONSOLE, "XDG_SURFACE_GET_TOPLEVEL: xdg_surface=%p wl_surface=%p id=%d", proxy, ((struct xdg_surface *)proxy)->wl_surface, ((struct xdg_surface *)proxy)->wl_surface->id);
 
-    /*EM_ASM({*/
+    if (f) {
 
-    const char * fun = 
+      fseek(f, 0, SEEK_END);
 
-	"let div = document.createElement(\"div\");"
+      long size = ftell(f);
 
-	"div.style.position = \"absolute\";"
+      fseek(f, 0, SEEK_SET);
 
-	"div.style.left = Math.floor(Math.random() * 100) + \"px\";"
-	"div.style.top = Math.floor(Math.random() * 100) + \"px\";"
+      innerHTMLDeco = (char *)malloc(size+1);
 
-	"div.style.width = Module['surfaces'][$0-1].style.width;"
-	"div.style.height = Module['surfaces'][$0-1].style.height;"
+      if (innerHTMLDeco) {
 
-	"let deco = document.createElement(\"div\");"
-	"deco.id = \"deco\";"
+	fread(innerHTMLDeco, 1, size, f);
+	innerHTMLDeco[size] = 0;
+      }
+      else {
 
-	"div.appendChild(deco);"
+	innerHTMLDeco = &defaultInnerHTMLDeco[0];
+      }
 
-	"div.appendChild(Module['surfaces'][$0-1]);"
-	  
-	"document.body.appendChild(div);"
+      fclose(f);
+    }
 
-	"if (!Module.listenersRegistered) {"
+    /*EM_ASM({*/
 
-	  "Module.listenersRegistered = true;"
+    const char * fun =
 
-	  "window.addEventListener('message', (event) => {"
+	//console.log($0);
+	//console.log(Module['surfaces'][$0-1]);
 
-	      "if (event.data.type == 8) {" // mouse down
+	"let w = Module['surfaces'][$0-1].parentElement;"
 
-		"for (const div of document.getElementsByTagName(\"div\")) {"
+	"let deco = w.firstChild;"
 
-		  "const rect = div.getBoundingClientRect();"
+	"let decoHTML = UTF8ToString($2);"
 
-		  //console.log("Bingo ? ");
-		  //console.log("x="+event.data.x+", y="+event.data.y);
-		  //console.log(rect);
-		  
-		  "if ( (event.data.x >= rect.left) && (event.data.x <= rect.right) && (event.data.y >= rect.top) && (event.data.y <= rect.bottom) ) {"
+      "deco.innerHTML += decoHTML.replace(\"[TITLE]\", UTF8ToString($1));"
 
-		    "let m = new Object();"
-	
-		    "m.type = 10;" // ask focus
-		    "m.pid = Module.getpid() & 0x0000ffff;"
-		    
-		    "window.parent.postMessage(m);"
+      "deco.addEventListener(\"mousedown\", (event) => {"
 
-		    //console.log("Bingo !!");
-		    //console.log(rect);
+      //"console.log(\"Decoration mouse down: \"+event.target.id);"
 
-		    "return;"
-		  "}"
-		"}"
+		"if (event.target.id == 'close') {"
 
-		"let m = new Object();"
-		
-		"m.type = 9;" // continue searching clicked window
-		"m.pid = Module.getpid() & 0x0000ffff;"
-		"m.x = event.data.x;"
-		"m.y = event.data.y;"
-		    
-		"window.parent.postMessage(m);"
-	      "}"
-	    "});"
+		  "Module['wayland'].pushEvent({"
 
-	  "document.body.addEventListener(\"mousemove\", (event) => {"
+		    "'type': 5," // close button pressed
+		    "'surface_id': $0"
+		    "});"
 
-      //"console.log(\"Body mouse move\");"
+		  "setTimeout(() => {"
 
-	      "if (Module.selected_toplevel) {"
+		      "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
-		"Module.selected_toplevel.style.left = (Module.start_x+event.clientX-Module.selected_x)+\"px\";"
-		"Module.selected_toplevel.style.top = (Module.start_y+event.clientY-Module.selected_y)+\"px\";"
-	      "}"
-	      
-	    "}, false);"
+			"Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		      "}"
 
-          "document.body.addEventListener(\"mousedown\", (event) => {"
+		    "}, 0);"
 
-      //"console.log(\"Body mouse down: click outside window !\");"
-      //"console.log(event);"
+		  "event.stopPropagation();"
+		"}"
+		"else if (event.target.id == 'max') {"
 
-	      "let m = new Object();"
-	
-	      "m.type = 8;" // mouse down
-	      "m.pid = Module.getpid() & 0x0000ffff;"
-	      "m.x = event.clientX;"
-	      "m.y = event.clientY;"
+		  "let canvas = Module['surfaces'][$0-1];"
 
-	      "window.parent.postMessage(m);"
-	      
-	    "}, false);"
+		  "let w;"
+		  "let h;"
 
-	  "document.body.addEventListener(\"mouseup\", (event) => {"
+		  "if (!canvas.maximized) {"
 
-      //"console.log(\"Body mouse up\");"
+		    "canvas.maximized = 1;"
 
-	      "Module.selected_toplevel = null;"
-	      
-	    "}, false);"
-      "}";
+		    "canvas.old_width = canvas.width;"
+		    "canvas.old_height = canvas.height;"
 
-    //}
-    //, ((struct xdg_surface *)proxy)->wl_surface->id);*/
+		    "w = window.devicePixelRatio * window.parent.innerWidth;" // window.innerWidth return 0
+		    "h = window.devicePixelRatio * window.parent.innerHeight;"
 
-    static int xdg_surface_get_toplevel_handle = -1;
+		    "if (canvas.parentElement && canvas.parentElement.firstChild) {"
 
-    if (xdg_surface_get_toplevel_handle < 0)
-      xdg_surface_get_toplevel_handle = emscripten_load_fun(fun, "vi");
-  
-    emscripten_run_fun(xdg_surface_get_toplevel_handle, ((struct xdg_surface *)proxy)->wl_surface->id);
+		      //Remove decoration height
+		      "  h -= window.devicePixelRatio * canvas.parentElement.firstChild.offsetHeight;"
+		    "}"
+		  "}"
+		  "else {"
 
-    for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+		    "canvas.maximized = 0;"
 
-      if (xdg_toplevels[i].xdg_surface == NULL) {
+		    "w = canvas.old_width;"
+		    "h = canvas.old_height;"
+		  "}"
 
-	xdg_toplevels[i].xdg_surface = (struct xdg_surface *)proxy;
-	xdg_toplevels[i].proxy.version = 0;
-	xdg_toplevels[i].proxy.wl_display = &display;
-	xdg_toplevels[i].proxy.interface = &xdg_toplevel_interface;
-	
-	emscripten_log(EM_LOG_CONSOLE, "XDG_SURFACE_GET_TOPLEVEL: %p", &xdg_toplevels[i]);
+		  "canvas.width = w;"
+		  "canvas.height = h;"
 
-	return (struct wl_proxy *)&xdg_toplevels[i];
-      }
-    }
-  }
-  else if ( (strcmp(proxy->interface->name, "xdg_surface") == 0) &&
-       (opcode == XDG_SURFACE_ACK_CONFIGURE) ) {
+		  "canvas.style.width = w/window.devicePixelRatio + \"px\";"
+		  "canvas.style.height = h/window.devicePixelRatio + \"px\";"
 
-    emscripten_log(EM_LOG_CONSOLE, "XDG_SURFACE_ACK_CONFIGURE");
-    
-    /*EM_ASM({*/
+		  "if (canvas.parentElement) {"
+		      "canvas.parentElement.style.width = w/window.devicePixelRatio + \"px\";"
+		      "canvas.parentElement.style.left = '0px';"
+		      "canvas.parentElement.style.top = '0px';"
 
-    const char * fun = 
+		   "}"
 
-      "window.requestAnimationFrame(Module['wayland'].render);";
-    
-    /*});*/
+		   "Module['wayland'].pushEvent({"
 
-    static int xdg_surface_ack_configure_handle = -1;
+		    "'type': 16," // window resized
+		    "'surface_id': $0,"
+		    "'width': w,"
+		    "'height': h"
+		    "});"
 
-    if (xdg_surface_ack_configure_handle < 0)
-      xdg_surface_ack_configure_handle = emscripten_load_fun(fun, "v");
-  
-    emscripten_run_fun(xdg_surface_ack_configure_handle);
-  }
-  else if ( (strcmp(proxy->interface->name, "xdg_toplevel") == 0) &&
-       (opcode == XDG_TOPLEVEL_SET_TITLE) ) {
+		  "setTimeout(() => {"
 
-    va_list ap;
+		      "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
-    va_start(ap, flags);
+			"Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		      "}"
 
-    char * title = (char *)va_arg(ap, char *);
-    
-    va_end(ap);
+		      "}, 0);"
 
-    if (title)
-      strcpy(((struct xdg_toplevel *)proxy)->title, title);
-    else
-      ((struct xdg_toplevel *)proxy)->title[0] = 0;
+		  "event.stopPropagation();"
+		"}"
+		"else if (event.target.id == 'min') {"
 
-    const char * fun =
-	
-      //"console.log($0);"
-      //"console.log(Module['surfaces'][$0-1]);"
+		  "let m = new Object();"
 
-	  "let w = Module['surfaces'][$0-1].parentElement;"
+		  "m.type = 12;" // minimize
+		  "m.pid = Module.getpid() & 0x0000ffff;"
 
-      //"console.log(w);"
+		  "window.parent.postMessage(m);"
 
-	  "let deco = w.firstElementChild;"
+		  "event.stopPropagation();"
+		"}"
+		"else if (event.target.id == 'axel') {"
 
-      //"console.log(deco);"
- 
-          "if (deco) {"
+		  "let m = new Object();"
 
-              "let titles = deco.getElementsByClassName('title');"
+		  "m.type = 14;" // axel
+		  "m.pid = Module.getpid() & 0x0000ffff;"
 
-              "if (titles && (titles.length > 0)) {"
+		  "window.parent.postMessage(m);"
 
-                "let title = titles[0];"
+		  "event.stopPropagation();"
+		"}"
+		"else {"
 
-                "if (title) {"
+		  "if (!Module.selected_toplevel) {"
 
-                    "title.innerHTML = UTF8ToString($1);"
-                "}"
-              "}"
-          "}";
+      //"console.log(\"Select toplevel\");"
 
-      static int toplevel_set_title_handle = -1;
+		    "Module.selected_toplevel = deco.parentElement;"
 
-    if (toplevel_set_title_handle < 0)
-      toplevel_set_title_handle = emscripten_load_fun(fun, "vip");
-  
-    emscripten_run_fun(toplevel_set_title_handle, ((struct xdg_toplevel *)proxy)->xdg_surface->wl_surface->id, ((struct xdg_toplevel *)proxy)->title);
-    
-  }
-  else if ( (strcmp(proxy->interface->name, "xdg_toplevel") == 0) &&
-       (opcode == XDG_TOPLEVEL_DESTROY) ) {
+		    "Module.selected_x = event.clientX;"
+		    "Module.selected_y = event.clientY;"
+		    "Module.start_x = parseInt(Module.selected_toplevel.style.left);"
+		    "Module.start_y = parseInt(Module.selected_toplevel.style.top);"
+		  "}"
 
-    emscripten_log(EM_LOG_CONSOLE, "XDG_TOPLEVEL_DESTROY");
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_surface") == 0) &&
-       (opcode == WL_SURFACE_COMMIT) ) {
+		  "const canvas = Module.selected_toplevel.getElementsByTagName(\"canvas\")[0];"
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_SURFACE_COMMIT: %p", proxy);
+		  "if (canvas) {"
+		    "canvas.focus();"
+		  "}"
 
-    if (((struct wl_surface *)proxy)->buffer) {
+		  "event.stopPropagation();"
+		  "event.preventDefault();"
 
-      /*EM_ASM({*/
+		"}"
 
-      const char * fun = 
+	      "}, false);"
 
-	  "Module['wayland'].requests.push({"
+	"w.addEventListener(\"mousedown\", (event) => {"
 
-	    "'type': 'commit',"
-	    "'surface_id': $0,"
-	    "'shm_fd': $1,"
-	    "'width': $2,"
-	    "'height': $3"
-	    "});"
+	    //console.log("Window mouse down");
+	    //console.log(event);
 
-	  "if (!Module.iframeShown) {"
+	    "event.stopPropagation();"
 
-	    "Module.iframeShown = true;"
+	"}, false);";
 
-	    "let m = new Object();"
-	
-	    "m.type = 7;" // show iframe and hide body
-	    "m.pid = Module.getpid() & 0x0000ffff;"
+	/*if (false) {
 
-	    "window.parent.postMessage(m);"
-	      "}";
-	
-	    //}, ((struct wl_surface *)proxy)->id, ((struct wl_surface *)proxy)->buffer->fd, ((struct wl_surface *)proxy)->buffer->width, ((struct wl_surface *)proxy)->buffer->height);*/
+	window.addEventListener('message', (event) => {
 
-      static int wl_surface_commit_handle = -1;
+	    if (event.data.type == 8) { // mouse down
 
-    if (wl_surface_commit_handle < 0)
-      wl_surface_commit_handle = emscripten_load_fun(fun, "viiii");
-  
-    emscripten_run_fun(wl_surface_commit_handle, ((struct wl_surface *)proxy)->id, ((struct wl_surface *)proxy)->buffer->fd, ((struct wl_surface *)proxy)->buffer->width, ((struct wl_surface *)proxy)->buffer->height);
-    }
-    else {
+	      for (const div of document.getElementsByTagName("div")) {
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+		const rect = div.getBoundingClientRect();
 
-	if (xdg_surfaces[i].wl_surface == (struct wl_surface *)proxy) {
+		//console.log("Bingo ? ");
+		//console.log("x="+event.data.x+", y="+event.data.y);
+		//console.log(rect);
 
-	  printf("WL_SURFACE_COMMIT: xdg_surface found\n");
+		if ( (event.data.x >= rect.left) && (event.data.x <= rect.right) && (event.data.y >= rect.top) && (event.data.y <= rect.bottom) ) {
 
-	  if (((struct wl_proxy *)(&xdg_surfaces[i]))->listeners) {
+		  let m = new Object();
 
-	    send_event(&xdg_surfaces[i], "configure", 0);
-	  }
+		  m.type = 10; // ask focus
+		  m.pid = Module.getpid() & 0x0000ffff;
 
-	  break;
-	}
-      }
+		  window.parent.postMessage(m);
 
-    }
+		  //console.log("Bingo !!");
+		  //console.log(rect);
 
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_surface") == 0) &&
-       (opcode == WL_SURFACE_ATTACH) ) {
+		  return;
+		}
+	      }
 
-    va_list ap;
+	      let m = new Object();
 
-    va_start(ap, flags);
+	      m.type = 9; // continue searching clicked window
+	      m.pid = Module.getpid() & 0x0000ffff;
+	      m.x = event.data.x;
+	      m.y = event.data.y;
 
-    struct wl_buffer * buffer = (struct wl_buffer *)va_arg(ap, struct wl_buffer*);
+	      window.parent.postMessage(m);
+	    }
+	  });
 
-    int x = va_arg(ap, int);
-    int y = va_arg(ap, int);
-    
-    va_end(ap);
+	document.body.addEventListener("mousemove", (event) => {
 
-    printf("WL_SURFACE_ATTACH: %p %d %d\n", buffer, x, y);
+	    //console.log("Body mouse move");
 
-    ((struct wl_surface *)proxy)->buffer = buffer;
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_surface") == 0) &&
-       (opcode == WL_SURFACE_FRAME) ) {
+	    if (Module.selected_toplevel) {
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_SURFACE_FRAME");
+	      Module.selected_toplevel.style.left = (Module.start_x+event.clientX-Module.selected_x)+"px";
+	      Module.selected_toplevel.style.top = (Module.start_y+event.clientY-Module.selected_y)+"px";
+	    }
 
-    for (int i = 0; i < NB_CALLBACK_MAX; ++i) {
+	  }, false);
 
-      if (frame_callbacks[i].wl_surface == NULL) {
+	document.body.addEventListener("mousedown", (event) => {
 
-	frame_callbacks[i].wl_surface = (struct wl_surface *)proxy;
-	frame_callbacks[i].proxy.version = 0;
-	frame_callbacks[i].proxy.wl_display = &display;
-	frame_callbacks[i].proxy.interface = &wl_callback_interface;
+	    //console.log("Body mouse down: click outside window !");
+	    //console.log(event);
 
-	return (struct wl_proxy *)&frame_callbacks[i];
-      }
-    }
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_surface") == 0) &&
-       (opcode == WL_SURFACE_DAMAGE_BUFFER) ) {
+	    let m = new Object();
 
-    va_list ap;
+	    m.type = 8; // mouse down
+	    m.pid = Module.getpid() & 0x0000ffff;
+	    m.x = event.clientX;
+	    m.y = event.clientY;
 
-    va_start(ap, flags);
+	    window.parent.postMessage(m);
 
-    int x = va_arg(ap, int);
-    int y = va_arg(ap, int);
-    int width = va_arg(ap, int);
-    int height = va_arg(ap, int);
+	    }, false);
 
-    va_end(ap);
+	document.body.addEventListener("mouseup", (event) => {
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_SURFACE_DAMAGE_BUFFER: %d %d %d %d", x, y, width, height);
+	    //console.log("Body mouse up");
 
-    /*EM_ASM({*/
+	    Module.selected_toplevel = null;
 
-    const char * fun = 
+	    }, false);
+	    }*/
 
-	  "Module['wayland'].requests.push({"
+	/*}, toplevel->xdg_surface->wl_surface->id, toplevel->title, innerHTMLDeco);*/
 
-	    "'type': 'damage_buffer',"
-	    "'surface_id': $0,"
-	    "'x': $1,"
-	    "'y': $2,"
-	    "'width': $3,"
-	    "'height': $4"
-      "});";
-	
-    //}, ((struct wl_surface *)proxy)->id, x, y, width, height);*/
+    static int toplevel_deco_handle = -1;
 
-    static int wl_surface_dammage_buffer_handle = -1;
+  if (toplevel_deco_handle < 0)
+    toplevel_deco_handle = emscripten_load_fun(fun, "vipp");
 
-    if (wl_surface_dammage_buffer_handle < 0)
-      wl_surface_dammage_buffer_handle = emscripten_load_fun(fun, "viiiii");
-  
-    emscripten_run_fun(wl_surface_dammage_buffer_handle, ((struct wl_surface *)proxy)->id, x, y, width, height);
-  } 
-  else if ( (strcmp(proxy->interface->name, "wl_shm") == 0) &&
-       (opcode == WL_SHM_CREATE_POOL) ) {
+  js_run(toplevel_deco_handle, toplevel->xdg_surface->wl_surface->id, toplevel->title, innerHTMLDeco);
 
-    va_list ap;
+    if (innerHTMLDeco != &defaultInnerHTMLDeco[0])
+      free(innerHTMLDeco);
+  }
 
-    va_start(ap, flags);
+  return NULL;
+}
 
-    struct wl_shm * wl_shm = va_arg(ap, struct wl_shm*);
-    int fd = va_arg(ap, int);
-    int size = va_arg(ap, int);
-    
-    va_end(ap);
+static struct wl_proxy * marshal_wl_data_device_manager_get_data_device(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-    wl_shm_pools[0].fd = fd;
-    wl_shm_pools[0].size = size;
-    wl_shm_pools[0].proxy.version = 0;
-    wl_shm_pools[0].proxy.wl_display = &display;
-    wl_shm_pools[0].proxy.interface = &wl_shm_pool_interface;
+  const char * fun =
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_SHM_CREATE_POOL: fd=%d size=%d -> %p", fd, size, &wl_shm_pools[0]);
+    "let bc_name = \"wayland_data_selection.\"+Module.getpid()+\".peer\";"
 
-    return (struct wl_proxy *)&wl_shm_pools[0];
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_shm_pool") == 0) &&
-       (opcode == WL_SHM_POOL_CREATE_BUFFER) ) {
+    "if (!(bc_name in Module['bc_channels'])) {"
 
-    printf("WL_SHM_POOL_CREATE_BUFFER: %p\n", proxy);
+    "  let bc = Module.get_broadcast_channel(bc_name);"
 
-    va_list ap;
+    "  bc.onmessage = (messageEvent) => {"
 
-    va_start(ap, flags);
+    //"    console.log(messageEvent);"
 
-    struct wl_shm_pool* dummy1 = va_arg(ap, struct wl_shm_pool*); // it is NULL !!
-    int dummy2 = va_arg(ap, int);
-    int width = va_arg(ap, int);
-    int height = va_arg(ap, int);
-    int stride = va_arg(ap, int);
-    int format = va_arg(ap, int);
-    
-    va_end(ap);
+    "    let msg2 = messageEvent.data;"
 
-    printf("WL_SHM_POOL_CREATE_BUFFER: %d %d %d %d\n", width, height, stride, format);
+    "    if (msg2.buf[0] == (68|0x80)) {"
 
-    wl_buffers[0].width = width;
-    wl_buffers[0].height = height;
-    wl_buffers[0].stride = stride;
-    wl_buffers[0].format = format;
-    wl_buffers[0].fd = ((struct wl_shm_pool *)proxy)->fd;
-    wl_buffers[0].proxy.version = 0;
-    wl_buffers[0].proxy.wl_display = &display;
-    wl_buffers[0].proxy.interface = &wl_buffer_interface;
+    "       let new_fd = msg2.buf[20] | (msg2.buf[21] << 8) | (msg2.buf[22] << 16) |  (msg2.buf[23] << 24);"
 
-    return (struct wl_proxy *)&wl_buffers[0];
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_shm_pool") == 0) &&
-       (opcode == WL_SHM_POOL_DESTROY) ) {
+    "       navigator.clipboard.readText().then(function(data) {"
+    //"       console.log(\"Clipboard read: \", data);"
 
-    
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_seat") == 0) &&
-       (opcode == WL_SEAT_GET_KEYBOARD) ) {
+    "            Module['wayland'].pushEvent({"
 
-    return (struct wl_proxy *)&keyboard;
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_seat") == 0) &&
-       (opcode == WL_SEAT_GET_POINTER) ) {
+		    "'type': 15," // data receive
+		    "'fd': new_fd,"
+		    "'data': data"
+		  "});"
 
-    return (struct wl_proxy *)&pointer;
-  }
-  else if ( (strcmp(proxy->interface->name, "zxdg_decoration_manager_v1") == 0) &&
-       (opcode == ZXDG_DECORATION_MANAGER_V1_GET_TOPLEVEL_DECORATION) ) {
+		  "setTimeout(() => {"
 
-    va_list ap;
+		      "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
-    va_start(ap, flags);
+			  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		       "}"
 
-    void * dummy = va_arg(ap, void *);
-    struct xdg_toplevel * toplevel = (struct xdg_toplevel *)va_arg(ap, struct xdg_toplevel *);
+		      "}, 0);"
+    "});"
 
-    printf("ZXDG_DECORATION_MANAGER_V1_GET_TOPLEVEL_DECORATION: toplevel=%p decoration=%p\n", toplevel, &(toplevel->decoration));
-    
-    va_end(ap);
-    
-    toplevel->decoration.proxy.version = 0;
-    toplevel->decoration.proxy.wl_display = &display;
-    toplevel->decoration.proxy.interface = &zxdg_toplevel_decoration_v1_interface;
+    "     }"
+    "  };"
+    "}";
 
-    toplevel->decoration.mode = ZXDG_TOPLEVEL_DECORATION_V1_MODE_CLIENT_SIDE;
+  static int get_device_handle = -1;
 
-    return (struct wl_proxy *)&(toplevel->decoration);
-  }
-  else if ( (strcmp(proxy->interface->name, "zxdg_toplevel_decoration_v1") == 0) &&
-       (opcode == ZXDG_TOPLEVEL_DECORATION_V1_SET_MODE) ) {
+  if (get_device_handle < 0)
+    get_device_handle = emscripten_load_fun(fun, "v");
 
-    va_list ap;
+  js_run(get_device_handle);
 
-    va_start(ap, flags);
+  return (struct wl_proxy *)&data_device;
+}
 
-    uint32_t mode = va_arg(ap, uint32_t);
-    
-    va_end(ap);
+static struct wl_proxy * marshal_zwp_primary_selection_device_manager_v1_get_device(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-    ((struct zxdg_toplevel_decoration_v1 *)proxy)->mode = mode;
+  const char * fun = 
 
-    if (mode == ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE) {
+    "let bc_name = \"wayland_primary_selection.peer\";"
 
-      char * ptr = ((char *)proxy)-sizeof(struct xdg_surface *)-sizeof(struct wl_proxy);
+    "Module.wayland_ps_pid = -1;"
 
-      struct xdg_toplevel * toplevel = (struct xdg_toplevel *)ptr;
-      
-      printf("ZXDG_TOPLEVEL_DECORATION_V1_SET_MODE: decoration=%p toplevel=%p xdg_surface=%p wl_surface=%p\n", proxy, toplevel, toplevel->xdg_surface, toplevel->xdg_surface->wl_surface);
+    "if (!(bc_name in Module['bc_channels'])) {"
 
-      char defaultInnerHTMLDeco[] = "<div id='innerDeco' style='height:25px;background-color:#ddfffb;display:flex;align-items:center'><img id='close' src='/netfs/usr/share/close_icon.png' style='width:15px;height:13px;margin-left:5px;user-select:none'></img><img id='min' src='/netfs/usr/share/min_icon.png' style='width:15px;height:15px;margin-left:5px;user-select:none'></img><span class='title' style='margin:auto; font-family:sans-serif; user-select:none'>[TITLE]</span></div>\0";
+    "  let bc = Module.get_broadcast_channel(bc_name);"
 
-      char * innerHTMLDeco = &defaultInnerHTMLDeco[0];
+    "  bc.onmessage = (messageEvent) => {"
+    //"     console.log(messageEvent);"
 
-      FILE * f = fopen("/home/.config/xdg/deco.html", "r");
+    "     if (messageEvent.data.type == \"selection\") {" // another wayland client performed selection
+    "        Module.wayland_primary_selection = 0;"
+    "        Module.wayland_ps_pid = messageEvent.data.pid;"
+    "     }"
+    "     else if (messageEvent.data.type == \"receive\") {" // another wayland client performed receive
 
-      if (!f) {
+    "        if (Module.wayland_primary_selection) {" // if our selection is active
 
-	f = fopen("/etc/xdg/system/deco.html", "r");
-      }
+		"Module['wayland'].pushEvent({"
 
-      if (f) {
+		   "'type': 14," // ps receive
+		   "'fd': messageEvent.data.fd"
 
-	fseek(f, 0, SEEK_END);
+	       "});"
 
-	long size = ftell(f);
+	       "setTimeout(() => {"
 
-	fseek(f, 0, SEEK_SET);
+		  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
-	innerHTMLDeco = (char *)malloc(size+1);
+		  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
+		  "}"
 
-	if (innerHTMLDeco) {
+		"}, 0);"
+    "        }"
+    "     }"
+    "  };"
+    "}"
 
-	  fread(innerHTMLDeco, 1, size, f);
-	  innerHTMLDeco[size] = 0;
-	}
-	else {
+    "bc_name = \"wayland_primary_selection.\"+Module.getpid()+\".peer\";"
 
-	  innerHTMLDeco = &defaultInnerHTMLDeco[0];
-	}
-	
-	fclose(f);
-      }
+    "if (!(bc_name in Module['bc_channels'])) {"
 
-      /*EM_ASM({*/
+    "  let bc = Module.get_broadcast_channel(bc_name);"
 
-      const char * fun =
-	
-	  //console.log($0);
-	  //console.log(Module['surfaces'][$0-1]);
+    "  bc.onmessage = (messageEvent) => {"
 
-	  "let w = Module['surfaces'][$0-1].parentElement;"
+    //"    console.log(messageEvent);"
 
-	  "let deco = w.firstChild;"
+    "    let msg2 = messageEvent.data;"
 
-	  "let decoHTML = UTF8ToString($2);"
+    "    if (msg2.buf[0] == (68|0x80)) {"
 
-	"deco.innerHTML += decoHTML.replace(\"[TITLE]\", UTF8ToString($1));"
+    "       let new_fd = msg2.buf[20] | (msg2.buf[21] << 8) | (msg2.buf[22] << 16) |  (msg2.buf[23] << 24);"
 
-	"deco.addEventListener(\"mousedown\", (event) => {"
+    "       if (Module.wayland_primary_selection) {"
 
-	//"console.log(\"Decoration mouse down: \"+event.target.id);"
+    "            Module['wayland'].pushEvent({"
 
-		  "if (event.target.id == 'close') {"
-	
-		    "Module['wayland'].events.push({"
+		    "'type': 14," // ps receive
+		    "'fd': new_fd"
 
-		      "'type': 5," // close button pressed
-		      "'surface_id': $0"
-		      "});"
+		  "});"
 
-		    "setTimeout(() => {"
+		  "setTimeout(() => {"
 
-			"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+		      "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
 			  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-			"}"
-		    
+		       "}"
+
 		      "}, 0);"
+    "        }"
+    "        else {"
+    //"           console.log(\"Wayland ps pid = \"+Module.wayland_ps_pid);"
+    "           const bc_name2 = \"wayland_primary_selection.peer\";"
+    "           let bc2 = Module.get_broadcast_channel(bc_name2);"
+    "           bc2.postMessage({"
+		       "'type':\"receive\","
+		       "'fd':new_fd"
+		   "})"
+    "        }"
+    "     }"
+    "  };"
+    "}";
 
-		    "event.stopPropagation();"
-		  "}"
-	          "else if (event.target.id == 'max') {"
+  static int primary_get_device_handle = -1;
 
-	            "let canvas = Module['surfaces'][$0-1];"
+  if (primary_get_device_handle < 0)
+    primary_get_device_handle = emscripten_load_fun(fun, "v");
 
-	            "let w;"
-	            "let h;"
+  js_run(primary_get_device_handle);
 
-	            "if (!canvas.maximized) {"
+  return (struct wl_proxy *)&primary_selection_device;
+}
 
-	              "canvas.maximized = 1;"
+static struct wl_proxy * marshal_zwp_primary_selection_device_manager_v1_create_source(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	              "canvas.old_width = canvas.width;"
-	              "canvas.old_height = canvas.height;"
+  return (struct wl_proxy *)&primary_selection_source;
+}
 
-	              "w = window.devicePixelRatio * window.parent.innerWidth;" // window.innerWidth return 0
-	              "h = window.devicePixelRatio * window.parent.innerHeight;"
-	            
-	              "if (canvas.parentElement && canvas.parentElement.firstChild) {"
+static struct wl_proxy * marshal_zwp_primary_selection_device_v1_set_selection(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	                //Remove decoration height
-	                "  h -= window.devicePixelRatio * canvas.parentElement.firstChild.offsetHeight;"
-	              "}"
-	            "}"
-	            "else {"
+  struct zwp_primary_selection_source_v1 * source = (struct zwp_primary_selection_source_v1 *)va_arg(ap, void *);
 
-	              "canvas.maximized = 0;"
+  uint32_t serial = va_arg(ap, uint32_t);
 
-	              "w = canvas.old_width;"
-	              "h = canvas.old_height;"
-	            "}"
+  ((struct zwp_primary_selection_device_v1 *) proxy)->source = source;
 
-	            "canvas.width = w;"
-                    "canvas.height = h;"
+  LOG_DEBUG("ZWP_PRIMARY_SELECTION_DEVICE_V1_SET_SELECTION: %p", source);
 
-                    "canvas.style.width = w/window.devicePixelRatio + \"px\";"
-                    "canvas.style.height = h/window.devicePixelRatio + \"px\";"
+  const char * fun = 
 
-                    "if (canvas.parentElement) {"
-	                "canvas.parentElement.style.width = w/window.devicePixelRatio + \"px\";"
-	                "canvas.parentElement.style.left = '0px';"
-	                "canvas.parentElement.style.top = '0px';"
-	                
-	             "}"
+    "const bc_name = \"wayland_primary_selection.peer\";"
+    "let bc = Module.get_broadcast_channel(bc_name);"
 
-	             "Module['wayland'].events.push({"
+    "Module.wayland_primary_selection = 1;"
+    "Module.wayland_ps_pid = Module.getpid();"
 
-		      "'type': 16," // window resized
-		      "'surface_id': $0,"
-		      "'width': w,"
-	              "'height': h"
-		      "});"
+    "bc.postMessage({'type':\"selection\", 'pid': Module.getpid()});";
 
-		    "setTimeout(() => {"
+  static int set_selection_handle = -1;
 
-			"if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+  if (set_selection_handle < 0)
+    set_selection_handle = emscripten_load_fun(fun, "v");
 
-			  "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-			"}"
-		    
-			"}, 0);"
+  js_run(set_selection_handle);
 
-		    "event.stopPropagation();"
-		  "}"
-		  "else if (event.target.id == 'min') {"
+  return NULL;
+}
 
-		    "let m = new Object();"
-	
-		    "m.type = 12;" // minimize
-		    "m.pid = Module.getpid() & 0x0000ffff;"
-		    
-		    "window.parent.postMessage(m);"
-		
-		    "event.stopPropagation();"
-		  "}"
-		  "else if (event.target.id == 'axel') {"
+static struct wl_proxy * marshal_zwp_primary_selection_offer_v1_receive(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		    "let m = new Object();"
-	
-		    "m.type = 14;" // axel
-		    "m.pid = Module.getpid() & 0x0000ffff;"
-		    
-		    "window.parent.postMessage(m);"
-		
-		    "event.stopPropagation();"
-		  "}"
-		  "else {"
-		  
-		    "if (!Module.selected_toplevel) {"
+  char * mime = va_arg(ap, char *);
+  int fd = va_arg(ap, int);
 
-	//"console.log(\"Select toplevel\");"
+  struct zwp_primary_selection_offer_v1 * offer = (struct zwp_primary_selection_offer_v1 *)proxy;
+  struct zwp_primary_selection_device_v1 * device = offer->device;
 
-		      "Module.selected_toplevel = deco.parentElement;"
-		
-		      "Module.selected_x = event.clientX;"
-		      "Module.selected_y = event.clientY;"
-		      "Module.start_x = parseInt(Module.selected_toplevel.style.left);"
-		      "Module.start_y = parseInt(Module.selected_toplevel.style.top);"
-		    "}"
-		    
-		    "const canvas = Module.selected_toplevel.getElementsByTagName(\"canvas\")[0];"
+  LOG_DEBUG("ZWP_PRIMARY_SELECTION_OFFER_V1_RECEIVE: %s %d -> %p %p", mime, fd, device, device->source);
 
-		    "if (canvas) {"
-		      "canvas.focus();"
-		    "}"
+  const char * fun = 
 
-		    "event.stopPropagation();"
-		    "event.preventDefault();"
-		    
-		  "}"
-	      
-		"}, false);"
+    "let buf_size = 24;"
 
-	  "w.addEventListener(\"mousedown\", (event) => {"
+    "let buf2 = new Uint8Array(buf_size);"
 
-	      //console.log("Window mouse down");
-	      //console.log(event);
-		
-	      "event.stopPropagation();"
-	      
-	  "}, false);";
+    "buf2[0] = 68;" // CLONEFD
 
-	  /*if (false) {
+    "let pid = Module.getpid();"
 
-	  window.addEventListener('message', (event) => {
+    // pid
+    "buf2[4] = pid & 0xff;"
+    "buf2[5] = (pid >> 8) & 0xff;"
+    "buf2[6] = (pid >> 16) & 0xff;"
+    "buf2[7] = (pid >> 24) & 0xff;"
 
-	      if (event.data.type == 8) { // mouse down
+    // fd
+    "buf2[12] = $0 & 0xff;"
+    "buf2[13] = ($0 >> 8) & 0xff;"
+    "buf2[14] = ($0 >> 16) & 0xff;"
+    "buf2[15] = ($0 >> 24) & 0xff;"
 
-		for (const div of document.getElementsByTagName("div")) {
+    "if (Module.wayland_ps_pid == -1)"
+    "   Module.wayland_ps_pid = Module.getpid();"
 
-		  const rect = div.getBoundingClientRect();
+    // pid_dest
+    "buf2[16] = Module.wayland_ps_pid & 0xff;"
+    "buf2[17] = (Module.wayland_ps_pid >> 8) & 0xff;"
+    "buf2[18] = (Module.wayland_ps_pid >> 16) & 0xff;"
+    "buf2[19] = (Module.wayland_ps_pid >> 24) & 0xff;"
 
-		  //console.log("Bingo ? ");
-		  //console.log("x="+event.data.x+", y="+event.data.y);
-		  //console.log(rect);
-		  
-		  if ( (event.data.x >= rect.left) && (event.data.x <= rect.right) && (event.data.y >= rect.top) && (event.data.y <= rect.bottom) ) {
+    "let msg = {"
 
-		    let m = new Object();
-	
-		    m.type = 10; // ask focus
-		    m.pid = Module.getpid() & 0x0000ffff;
-		    
-		    window.parent.postMessage(m);
+	"from: \"wayland_primary_selection.\"+Module.getpid()+\".peer\","
+	"buf: buf2,"
+	"len: buf_size"
+     "};"
 
-		    //console.log("Bingo !!");
-		    //console.log(rect);
+     "let bc = Module.get_broadcast_channel(\"/var/resmgr.peer\");"
 
-		    return;
-		  }
-		}
+       "bc.postMessage(msg);";
 
-		let m = new Object();
-		
-		m.type = 9; // continue searching clicked window
-		m.pid = Module.getpid() & 0x0000ffff;
-		m.x = event.data.x;
-		m.y = event.data.y;
-		    
-		window.parent.postMessage(m);
-	      }
-	    });
+  static int offer_receive_handle = -1;
 
-	  document.body.addEventListener("mousemove", (event) => {
+  if (offer_receive_handle < 0)
+    offer_receive_handle = emscripten_load_fun(fun, "vi");
 
-	      //console.log("Body mouse move");
+  js_run(offer_receive_handle, fd);
 
-	      if (Module.selected_toplevel) {
+  return NULL;
+}
 
-		Module.selected_toplevel.style.left = (Module.start_x+event.clientX-Module.selected_x)+"px";
-		Module.selected_toplevel.style.top = (Module.start_y+event.clientY-Module.selected_y)+"px";
-	      }
-	      
-	    }, false);
+static struct wl_proxy * marshal_wl_data_offer_receive(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	  document.body.addEventListener("mousedown", (event) => {
+  char * mime = va_arg(ap, char *);
+  int fd = va_arg(ap, int);
 
-	      //console.log("Body mouse down: click outside window !");
-	      //console.log(event);
+  struct wl_data_offer * offer = (struct wl_data_offer *)proxy;
+  struct wl_data_device * device = offer->device;
 
-	      let m = new Object();
-	
-	      m.type = 8; // mouse down
-	      m.pid = Module.getpid() & 0x0000ffff;
-	      m.x = event.clientX;
-	      m.y = event.clientY;
+  LOG_DEBUG("WL_DATA_OFFER_RECEIVE: %s %d -> %p %p", mime, fd, device, device->source);
 
-	      window.parent.postMessage(m);
-	      
-	      }, false);
+  const char * fun = 
 
-	  document.body.addEventListener("mouseup", (event) => {
+    "let buf_size = 24;"
 
-	      //console.log("Body mouse up");
+    "let buf2 = new Uint8Array(buf_size);"
 
-	      Module.selected_toplevel = null;
-	      
-	      }, false);
-	      }*/
-	
-	  /*}, toplevel->xdg_surface->wl_surface->id, toplevel->title, innerHTMLDeco);*/
+    "buf2[0] = 68;" // CLONEFD
 
-      static int toplevel_deco_handle = -1;
+    "let pid = Module.getpid();"
 
-    if (toplevel_deco_handle < 0)
-      toplevel_deco_handle = emscripten_load_fun(fun, "vipp");
-  
-    emscripten_run_fun(toplevel_deco_handle, toplevel->xdg_surface->wl_surface->id, toplevel->title, innerHTMLDeco);
+    // pid
+    "buf2[4] = pid & 0xff;"
+    "buf2[5] = (pid >> 8) & 0xff;"
+    "buf2[6] = (pid >> 16) & 0xff;"
+    "buf2[7] = (pid >> 24) & 0xff;"
 
-      if (innerHTMLDeco != &defaultInnerHTMLDeco[0])
-	free(innerHTMLDeco);
-    }
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_data_device_manager") == 0) &&
-       (opcode == WL_DATA_DEVICE_MANAGER_GET_DATA_DEVICE) ) {
+    // fd
+    "buf2[12] = $0 & 0xff;"
+    "buf2[13] = ($0 >> 8) & 0xff;"
+    "buf2[14] = ($0 >> 16) & 0xff;"
+    "buf2[15] = ($0 >> 24) & 0xff;"
 
-    const char * fun =
+    // pid_dest = pid
+    "buf2[16] = pid & 0xff;"
+    "buf2[17] = (pid >> 8) & 0xff;"
+    "buf2[18] = (pid >> 16) & 0xff;"
+    "buf2[19] = (pid >> 24) & 0xff;"
 
-      "let bc_name = \"wayland_data_selection.\"+Module.getpid()+\".peer\";"
-      
-      "if (!(bc_name in Module['bc_channels'])) {"
-      
-      "  let bc = Module.get_broadcast_channel(bc_name);"
-      
-      "  bc.onmessage = (messageEvent) => {"
+    "let msg = {"
 
-      //"    console.log(messageEvent);"
+	"from: \"wayland_data_selection.\"+Module.getpid()+\".peer\","
+	"buf: buf2,"
+	"len: buf_size"
+     "};"
 
-      "    let msg2 = messageEvent.data;"
+     "let bc = Module.get_broadcast_channel(\"/var/resmgr.peer\");"
 
-      "    if (msg2.buf[0] == (68|0x80)) {"
+       "bc.postMessage(msg);";
 
-      "       let new_fd = msg2.buf[20] | (msg2.buf[21] << 8) | (msg2.buf[22] << 16) |  (msg2.buf[23] << 24);"
+  static int offer_receive_handle = -1;
 
-      "       navigator.clipboard.readText().then(function(data) {"
-      //"       console.log(\"Clipboard read: \", data);"
-      
-      "            Module['wayland'].events.push({"
+  if (offer_receive_handle < 0)
+    offer_receive_handle = emscripten_load_fun(fun, "vi");
 
-		      "'type': 15," // data receive
-                      "'fd': new_fd,"
-                      "'data': data"
-	            "});"
+  js_run(offer_receive_handle, fd);
 
-	            "setTimeout(() => {"
+  return NULL;
+}
 
-		        "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+static struct wl_proxy * marshal_wl_data_device_manager_create_data_source(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-		            "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		         "}"
-		    
-		        "}, 0);"
-      "});"
-     
-      "     }"
-      "  };"
-      "}";
-	  
-    static int get_device_handle = -1;
+  return (struct wl_proxy *)&data_source;
+}
 
-    if (get_device_handle < 0)
-      get_device_handle = emscripten_load_fun(fun, "v");
-  
-    emscripten_run_fun(get_device_handle);
+static struct wl_proxy * marshal_wl_data_device_set_selection(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-    return (struct wl_proxy *)&data_device;
-  }
-  else if ( (strcmp(proxy->interface->name, "zwp_primary_selection_device_manager_v1") == 0) &&
-       (opcode == ZWP_PRIMARY_SELECTION_DEVICE_MANAGER_V1_GET_DEVICE) ) {
+  struct wl_data_source * source = (struct wl_data_source *)va_arg(ap, void *);
 
-    const char * fun = 
+  uint32_t serial = va_arg(ap, uint32_t);
 
-      "let bc_name = \"wayland_primary_selection.peer\";"
+  ((struct wl_data_device *) proxy)->source = source;
 
-      "Module.wayland_ps_pid = -1;"
-      
-      "if (!(bc_name in Module['bc_channels'])) {"
-      
-      "  let bc = Module.get_broadcast_channel(bc_name);"
-      
-      "  bc.onmessage = (messageEvent) => {"
-      //"     console.log(messageEvent);"
-      
-      "     if (messageEvent.data.type == \"selection\") {" // another wayland client performed selection
-      "        Module.wayland_primary_selection = 0;"
-      "        Module.wayland_ps_pid = messageEvent.data.pid;"
-      "     }"
-      "     else if (messageEvent.data.type == \"receive\") {" // another wayland client performed receive
+  LOG_DEBUG("WL_DATA_DEVICE_SET_SELECTION: %p", source);
 
-      "        if (Module.wayland_primary_selection) {" // if our selection is active
+  queue_wl_data_source_send(source, "text/plain", 0x7e000001); // reserved fd for wayland virtual pipe
 
-                  "Module['wayland'].events.push({"
+  return NULL;
+}
 
-		     "'type': 14," // ps receive
-                     "'fd': messageEvent.data.fd"
-		
-	         "});"
+static struct wl_proxy * marshal_xdg_toplevel_set_maximized(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-	         "setTimeout(() => {"
+  LOG_DEBUG("XDG_TOPLEVEL_SET_MAXIMIZED");
 
-		    "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+  int width, height;
 
-		    "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		    "}"
-		    
-		  "}, 0);"
-      "        }"
-      "     }"
-      "  };"
-      "}"
+  /*EM_ASM({*/
 
-      "bc_name = \"wayland_primary_selection.\"+Module.getpid()+\".peer\";"
-      
-      "if (!(bc_name in Module['bc_channels'])) {"
-      
-      "  let bc = Module.get_broadcast_channel(bc_name);"
-      
-      "  bc.onmessage = (messageEvent) => {"
+  const char * fun =
 
-      //"    console.log(messageEvent);"
+      "let w = window.devicePixelRatio * window.parent.innerWidth;" // window.innerWidth return 0
+      "let h = window.devicePixelRatio * window.parent.innerHeight;"
 
-      "    let msg2 = messageEvent.data;"
+      "let canvas = Module['surfaces'][$2-1];"
 
-      "    if (msg2.buf[0] == (68|0x80)) {"
+      "if (canvas.parentElement && canvas.parentElement.firstChild) {"
 
-      "       let new_fd = msg2.buf[20] | (msg2.buf[21] << 8) | (msg2.buf[22] << 16) |  (msg2.buf[23] << 24);"
+      //Remove decoration height
+      "  h -= window.devicePixelRatio * canvas.parentElement.firstChild.offsetHeight;"
+      "}"
 
-      "       if (Module.wayland_primary_selection) {"
-      
-      "            Module['wayland'].events.push({"
+      "Module.HEAPU8[$0] =  w & 0xff;"
+      "Module.HEAPU8[$0+1] = (w >> 8) & 0xff;"
+      "Module.HEAPU8[$0+2] = (w >> 16) & 0xff;"
+      "Module.HEAPU8[$0+3] = (w >> 24) & 0xff;"
 
-		      "'type': 14," // ps receive
-                      "'fd': new_fd"
-		
-	            "});"
+      "Module.HEAPU8[$1] =  h & 0xff;"
+      "Module.HEAPU8[$1+1] = (h >> 8) & 0xff;"
+      "Module.HEAPU8[$1+2] = (h >> 16) & 0xff;"
+      "Module.HEAPU8[$1+3] = (h >> 24) & 0xff;"
 
-	            "setTimeout(() => {"
+      "canvas.width = w;"
+      "canvas.height = h;"
 
-		        "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+      "canvas.style.width = w/window.devicePixelRatio + \"px\";"
+      "canvas.style.height = h/window.devicePixelRatio + \"px\";"
 
-		            "Module['fd_table'][0x7e000000].notif_select(0x7e000000, 0);"
-		         "}"
-		    
-		        "}, 0);"
-      "        }"
-      "        else {"
-      //"           console.log(\"Wayland ps pid = \"+Module.wayland_ps_pid);"
-      "           const bc_name2 = \"wayland_primary_selection.peer\";"
-      "           let bc2 = Module.get_broadcast_channel(bc_name2);"
-      "           bc2.postMessage({"
-                         "'type':\"receive\","
-                         "'fd':new_fd"
-                     "})"
-      "        }"
-      "     }"
-      "  };"
+      "if (canvas.parentElement) {"
+	  "canvas.parentElement.style.width = w/window.devicePixelRatio + \"px\";"
+
+	  "canvas.parentElement.style.left = '0px';"
+	  "canvas.parentElement.style.top = '0px';"
       "}";
-	  
-    static int primary_get_device_handle = -1;
 
-    if (primary_get_device_handle < 0)
-      primary_get_device_handle = emscripten_load_fun(fun, "v");
-  
-    emscripten_run_fun(primary_get_device_handle);
+  /*}, &width, &height);*/
 
-    return (struct wl_proxy *)&primary_selection_device;
-  }
-  else if ( (strcmp(proxy->interface->name, "zwp_primary_selection_device_manager_v1") == 0) &&
-       (opcode == ZWP_PRIMARY_SELECTION_DEVICE_MANAGER_V1_CREATE_SOURCE) ) {
+  static int set_maximized_handle = -1;
 
-    return (struct wl_proxy *)&primary_selection_source;
-  }
-  else if ( (strcmp(proxy->interface->name, "zwp_primary_selection_device_v1") == 0) &&
-       (opcode == ZWP_PRIMARY_SELECTION_DEVICE_V1_SET_SELECTION) ) {
+  if (set_maximized_handle < 0)
+    set_maximized_handle = emscripten_load_fun(fun, "vppi");
 
-    va_list ap;
+  js_run(set_maximized_handle, &width, &height, ((struct xdg_toplevel *)proxy)->xdg_surface->wl_surface->id);
 
-    va_start(ap, flags);
+  LOG_DEBUG("XDG_TOPLEVEL_SET_MAXIMIZED: w=%d h=%d", width, height);
 
-    struct zwp_primary_selection_source_v1 * source = (struct zwp_primary_selection_source_v1 *)va_arg(ap, void *);
+  struct wl_array * states = event_states_new(XDG_TOPLEVEL_STATE_MAXIMIZED);
 
-    uint32_t serial = va_arg(ap, uint32_t);
-    
-    va_end(ap);
+  queue_xdg_toplevel_configure(proxy, width, height, states);
+
+  // TODO event not received immediately
+  queue_xdg_surface_configure(((struct xdg_toplevel *)proxy)->xdg_surface, 0);
 
-    ((struct zwp_primary_selection_device_v1 *) proxy)->source = source;
+  return NULL;
+}
 
-    emscripten_log(EM_LOG_CONSOLE, "ZWP_PRIMARY_SELECTION_DEVICE_V1_SET_SELECTION: %p", source);
+static struct wl_proxy * marshal_xdg_toplevel_set_fullscreen(struct wl_proxy * proxy, uint32_t opcode, const struct wl_interface * interface, uint32_t version, uint32_t flags, va_list ap) {
 
-    const char * fun = 
+  LOG_DEBUG("XDG_TOPLEVEL_SET_FULLSCREEN");
 
-      "const bc_name = \"wayland_primary_selection.peer\";"
-      "let bc = Module.get_broadcast_channel(bc_name);"
+  int width, height;
 
-      "Module.wayland_primary_selection = 1;"
-      "Module.wayland_ps_pid = Module.getpid();"
-      
-      "bc.postMessage({'type':\"selection\", 'pid': Module.getpid()});";
-	  
-    static int set_selection_handle = -1;
+  /*EM_ASM({*/
 
-    if (set_selection_handle < 0)
-      set_selection_handle = emscripten_load_fun(fun, "v");
-  
-    emscripten_run_fun(set_selection_handle);
-  }
-  else if ( (strcmp(proxy->interface->name, "zwp_primary_selection_offer_v1") == 0) &&
-       (opcode == ZWP_PRIMARY_SELECTION_OFFER_V1_RECEIVE) ) {
-    
-    va_list ap;
+  const char * fun =
 
-    va_start(ap, flags);
+      "const w = window.devicePixelRatio * window.parent.innerWidth;" // window.innerWidth return 0
+      "const h = window.devicePixelRatio * window.parent.innerHeight;"
 
-    char * mime = va_arg(ap, char *);
-    int fd = va_arg(ap, int);
-    
-    va_end(ap);
+      "Module.HEAPU8[$0] =  w & 0xff;"
+      "Module.HEAPU8[$0+1] = (w >> 8) & 0xff;"
+      "Module.HEAPU8[$0+2] = (w >> 16) & 0xff;"
+      "Module.HEAPU8[$0+3] = (w >> 24) & 0xff;"
 
-    struct zwp_primary_selection_offer_v1 * offer = (struct zwp_primary_selection_offer_v1 *)proxy;
-    struct zwp_primary_selection_device_v1 * device = offer->device;
+      "Module.HEAPU8[$1] =  h & 0xff;"
+      "Module.HEAPU8[$1+1] = (h >> 8) & 0xff;"
+      "Module.HEAPU8[$1+2] = (h >> 16) & 0xff;"
+      "Module.HEAPU8[$1+3] = (h >> 24) & 0xff;"
 
-    emscripten_log(EM_LOG_CONSOLE, "ZWP_PRIMARY_SELECTION_OFFER_V1_RECEIVE: %s %d -> %p %p", mime, fd, device, device->source);
+      "let canvas = Module['surfaces'][$2-1];"
 
-    const char * fun = 
+      "canvas.width = w;"
+      "canvas.height = h;"
 
-      "let buf_size = 24;"
-	
-      "let buf2 = new Uint8Array(buf_size);"
+      "canvas.style.width = w/window.devicePixelRatio + \"px\";"
+      "canvas.style.height = h/window.devicePixelRatio + \"px\";"
 
-      "buf2[0] = 68;" // CLONEFD
+      "if (canvas.parentElement) {"
+	  "canvas.parentElement.style.width = w/window.devicePixelRatio + \"px\";"
+	  "canvas.parentElement.style.left = '0px';"
+	  "canvas.parentElement.style.top = '0px';"
 
-      "let pid = Module.getpid();"
+    //"console.log(\"Fullscreen: hide decoration\");"
+    //"console.log(canvas.parentElement);"
+    //"console.log(canvas.parentElement.firstChild);"
 
-      // pid
-      "buf2[4] = pid & 0xff;"
-      "buf2[5] = (pid >> 8) & 0xff;"
-      "buf2[6] = (pid >> 16) & 0xff;"
-      "buf2[7] = (pid >> 24) & 0xff;"
+	  // Hide decoration
+	  "canvas.parentElement.firstChild.style.display = \"none\";"
+      "}";
 
-      // fd
-      "buf2[12] = $0 & 0xff;"
-      "buf2[13] = ($0 >> 8) & 0xff;"
-      "buf2[14] = ($0 >> 16) & 0xff;"
-      "buf2[15] = ($0 >> 24) & 0xff;"
+  /*}, &width, &height);*/
 
-      "if (Module.wayland_ps_pid == -1)"
-      "   Module.wayland_ps_pid = Module.getpid();"
+  static int set_fullscreen_handle = -1;
 
-      // pid_dest
-      "buf2[16] = Module.wayland_ps_pid & 0xff;"
-      "buf2[17] = (Module.wayland_ps_pid >> 8) & 0xff;"
-      "buf2[18] = (Module.wayland_ps_pid >> 16) & 0xff;"
-      "buf2[19] = (Module.wayland_ps_pid >> 24) & 0xff;"
+  if (set_fullscreen_handle < 0)
+    set_fullscreen_handle = emscripten_load_fun(fun, "vppi");
 
-      "let msg = {"
-		      
-          "from: \"wayland_primary_selection.\"+Module.getpid()+\".peer\","
-	  "buf: buf2,"
-	  "len: buf_size"
-       "};"
+  js_run(set_fullscreen_handle, &width, &height, ((struct xdg_toplevel *)proxy)->xdg_surface->wl_surface->id);
 
-       "let bc = Module.get_broadcast_channel(\"/var/resmgr.peer\");"
+  LOG_DEBUG("XDG_TOPLEVEL_SET_FULLSCREEN: w=%d h=%d", width, height);
 
-	 "bc.postMessage(msg);";
-	  
-    static int offer_receive_handle = -1;
+  struct wl_array * states = event_states_new(XDG_TOPLEVEL_STATE_FULLSCREEN);
 
-    if (offer_receive_handle < 0)
-      offer_receive_handle = emscripten_load_fun(fun, "vi");
+  queue_xdg_toplevel_configure(proxy, width, height, states);
 
-    emscripten_run_fun(offer_receive_handle, fd);
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_data_offer") == 0) &&
-       (opcode == WL_DATA_OFFER_RECEIVE) ) {
-    
-    va_list ap;
+  // TODO event not received immediately
+  queue_xdg_surface_configure(((struct xdg_toplevel *)proxy)->xdg_surface, 0);
 
-    va_start(ap, flags);
+  return NULL;
+}
 
-    char * mime = va_arg(ap, char *);
-    int fd = va_arg(ap, int);
-    
-    va_end(ap);
+static const request_handler wl_display_request_handlers[] = {
 
-    struct wl_data_offer * offer = (struct wl_data_offer *)proxy;
-    struct wl_data_device * device = offer->device;
+  [WL_DISPLAY_GET_REGISTRY] = marshal_wl_display_get_registry,
+};
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_DATA_OFFER_RECEIVE: %s %d -> %p %p", mime, fd, device, device->source);
+static const request_handler wl_registry_request_handlers[] = {
 
-    const char * fun = 
+  [WL_REGISTRY_BIND] = marshal_wl_registry_bind,
+};
 
-      "let buf_size = 24;"
-	
-      "let buf2 = new Uint8Array(buf_size);"
+static const request_handler wl_compositor_request_handlers[] = {
 
-      "buf2[0] = 68;" // CLONEFD
+  [WL_COMPOSITOR_CREATE_SURFACE] = marshal_wl_compositor_create_surface,
+  [WL_COMPOSITOR_CREATE_REGION] = marshal_wl_compositor_create_region,
+};
 
-      "let pid = Module.getpid();"
+static const request_handler wl_region_request_handlers[] = {
 
-      // pid
-      "buf2[4] = pid & 0xff;"
-      "buf2[5] = (pid >> 8) & 0xff;"
-      "buf2[6] = (pid >> 16) & 0xff;"
-      "buf2[7] = (pid >> 24) & 0xff;"
+  [WL_REGION_ADD] = marshal_wl_region_add,
+  [WL_REGION_SUBTRACT] = marshal_wl_region_subtract,
+};
 
-      // fd
-      "buf2[12] = $0 & 0xff;"
-      "buf2[13] = ($0 >> 8) & 0xff;"
-      "buf2[14] = ($0 >> 16) & 0xff;"
-      "buf2[15] = ($0 >> 24) & 0xff;"
+static const request_handler xdg_wm_base_request_handlers[] = {
 
-      // pid_dest = pid
-      "buf2[16] = pid & 0xff;"
-      "buf2[17] = (pid >> 8) & 0xff;"
-      "buf2[18] = (pid >> 16) & 0xff;"
-      "buf2[19] = (pid >> 24) & 0xff;"
+  [XDG_WM_BASE_GET_XDG_SURFACE] = marshal_xdg_wm_base_get_xdg_surface,
+};
 
-      "let msg = {"
-		      
-          "from: \"wayland_data_selection.\"+Module.getpid()+\".peer\","
-	  "buf: buf2,"
-	  "len: buf_size"
-       "};"
+static const request_handler xdg_surface_request_handlers[] = {
 
-       "let bc = Module.get_broadcast_channel(\"/var/resmgr.peer\");"
+  [XDG_SURFACE_ACK_CONFIGURE] = marshal_xdg_surface_ack_configure,
+  [XDG_SURFACE_GET_TOPLEVEL] = marshal_xdg_surface_get_toplevel,
+};
 
-	 "bc.postMessage(msg);";
-	  
-    static int offer_receive_handle = -1;
+static const request_handler xdg_toplevel_request_handlers[] = {
 
-    if (offer_receive_handle < 0)
-      offer_receive_handle = emscripten_load_fun(fun, "vi");
+  [XDG_TOPLEVEL_DESTROY] = marshal_xdg_toplevel_destroy,
+  [XDG_TOPLEVEL_SET_FULLSCREEN] = marshal_xdg_toplevel_set_fullscreen,
+  [XDG_TOPLEVEL_SET_MAXIMIZED] = marshal_xdg_toplevel_set_maximized,
+  [XDG_TOPLEVEL_SET_TITLE] = marshal_xdg_toplevel_set_title,
+};
 
-    emscripten_run_fun(offer_receive_handle, fd);
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_data_device_manager") == 0) &&
-       (opcode == WL_DATA_DEVICE_MANAGER_CREATE_DATA_SOURCE) ) {
+static const request_handler wl_surface_request_handlers[] = {
 
-    return (struct wl_proxy *)&data_source;
-  }
-  else if ( (strcmp(proxy->interface->name, "wl_data_device") == 0) &&
-       (opcode == WL_DATA_DEVICE_SET_SELECTION) ) {
+  [WL_SURFACE_ATTACH] = marshal_wl_surface_attach,
+  [WL_SURFACE_COMMIT] = marshal_wl_surface_commit,
+  [WL_SURFACE_DAMAGE] = marshal_wl_surface_damage,
+  [WL_SURFACE_DAMAGE_BUFFER] = marshal_wl_surface_damage_buffer,
+  [WL_SURFACE_FRAME] = marshal_wl_surface_frame,
+  [WL_SURFACE_SET_OPAQUE_REGION] = marshal_wl_surface_set_opaque_region,
+  [WL_SURFACE_SET_INPUT_REGION] = marshal_wl_surface_set_input_region,
+};
 
-    va_list ap;
+static const request_handler wl_shm_request_handlers[] = {
 
-    va_start(ap, flags);
+  [WL_SHM_CREATE_POOL] = marshal_wl_shm_create_pool,
+};
 
-    struct wl_data_source * source = (struct wl_data_source *)va_arg(ap, void *);
+static const request_handler wl_shm_pool_request_handlers[] = {
 
-    uint32_t serial = va_arg(ap, uint32_t);
-    
-    va_end(ap);
+  [WL_SHM_POOL_CREATE_BUFFER] = marshal_wl_shm_pool_create_buffer,
+  [WL_SHM_POOL_DESTROY] = marshal_wl_shm_pool_destroy,
+  [WL_SHM_POOL_RESIZE] = marshal_wl_shm_pool_resize,
+};
 
-    ((struct wl_data_device *) proxy)->source = source;
+static const request_handler wl_seat_request_handlers[] = {
 
-    emscripten_log(EM_LOG_CONSOLE, "WL_DATA_DEVICE_SET_SELECTION: %p", source);
-    
-    send_event(source, "send", "text/plain", 0x7e000001); // reserved fd for wayland virtual pipe
-  }
-  else if ( (strcmp(proxy->interface->name, "xdg_toplevel") == 0) &&
-       (opcode == XDG_TOPLEVEL_SET_MAXIMIZED) ) {
+  [WL_SEAT_GET_KEYBOARD] = marshal_wl_seat_get_keyboard,
+  [WL_SEAT_GET_POINTER] = marshal_wl_seat_get_pointer,
+};
 
-    emscripten_log(EM_LOG_CONSOLE, "XDG_TOPLEVEL_SET_MAXIMIZED");
-    
-    int width, height;
-      
-    /*EM_ASM({*/
+static const request_handler zxdg_decoration_manager_v1_request_handlers[] = {
 
-    const char * fun =
+  [ZXDG_DECORATION_MANAGER_V1_GET_TOPLEVEL_DECORATION] = marshal_zxdg_decoration_manager_v1_get_toplevel_decoration,
+};
 
-	"let w = window.devicePixelRatio * window.parent.innerWidth;" // window.innerWidth return 0
-	"let h = window.devicePixelRatio * window.parent.innerHeight;"
+static const request_handler zxdg_toplevel_decoration_v1_request_handlers[] = {
 
-        "let canvas = Module['surfaces'][$2-1];"
+  [ZXDG_TOPLEVEL_DECORATION_V1_SET_MODE] = marshal_zxdg_toplevel_decoration_v1_set_mode,
+};
 
-        "if (canvas.parentElement && canvas.parentElement.firstChild) {"
+static const request_handler wl_data_device_manager_request_handlers[] = {
 
-        //Remove decoration height
-        "  h -= window.devicePixelRatio * canvas.parentElement.firstChild.offsetHeight;"
-        "}"
+  [WL_DATA_DEVICE_MANAGER_CREATE_DATA_SOURCE] = marshal_wl_data_device_manager_create_data_source,
+  [WL_DATA_DEVICE_MANAGER_GET_DATA_DEVICE] = marshal_wl_data_device_manager_get_data_device,
+};
 
-        "Module.HEAPU8[$0] =  w & 0xff;"
-	"Module.HEAPU8[$0+1] = (w >> 8) & 0xff;"
-	"Module.HEAPU8[$0+2] = (w >> 16) & 0xff;"
-	"Module.HEAPU8[$0+3] = (w >> 24) & 0xff;"
+static const request_handler zwp_primary_selection_device_manager_v1_request_handlers[] = {
 
-	"Module.HEAPU8[$1] =  h & 0xff;"
-	"Module.HEAPU8[$1+1] = (h >> 8) & 0xff;"
-	"Module.HEAPU8[$1+2] = (h >> 16) & 0xff;"
-        "Module.HEAPU8[$1+3] = (h >> 24) & 0xff;"
+  [ZWP_PRIMARY_SELECTION_DEVICE_MANAGER_V1_CREATE_SOURCE] = marshal_zwp_primary_selection_device_manager_v1_create_source,
+  [ZWP_PRIMARY_SELECTION_DEVICE_MANAGER_V1_GET_DEVICE] = marshal_zwp_primary_selection_device_manager_v1_get_device,
+};
 
-	"canvas.width = w;"
-        "canvas.height = h;"
+static const request_handler zwp_primary_selection_device_v1_request_handlers[] = {
 
-        "canvas.style.width = w/window.devicePixelRatio + \"px\";"
-        "canvas.style.height = h/window.devicePixelRatio + \"px\";"
+  [ZWP_PRIMARY_SELECTION_DEVICE_V1_SET_SELECTION] = marshal_zwp_primary_selection_device_v1_set_selection,
+};
 
-        "if (canvas.parentElement) {"
-	    "canvas.parentElement.style.width = w/window.devicePixelRatio + \"px\";"
+static const request_handler zwp_primary_selection_offer_v1_request_handlers[] = {
 
-            "canvas.parentElement.style.left = '0px';"
-	    "canvas.parentElement.style.top = '0px';"
-        "}";
+  [ZWP_PRIMARY_SELECTION_OFFER_V1_RECEIVE] = marshal_zwp_primary_selection_offer_v1_receive,
+};
 
-    /*}, &width, &height);*/
+static const request_handler wl_data_offer_request_handlers[] = {
 
-    static int set_maximized_handle = -1;
+  [WL_DATA_OFFER_RECEIVE] = marshal_wl_data_offer_receive,
+};
 
-    if (set_maximized_handle < 0)
-      set_maximized_handle = emscripten_load_fun(fun, "vppi");
-  
-    emscripten_run_fun(set_maximized_handle, &width, &height, ((struct xdg_toplevel *)proxy)->xdg_surface->wl_surface->id);
+static const request_handler wl_data_device_request_handlers[] = {
 
-    emscripten_log(EM_LOG_CONSOLE, "XDG_TOPLEVEL_SET_MAXIMIZED: w=%d h=%d", width, height);
+  [WL_DATA_DEVICE_SET_SELECTION] = marshal_wl_data_device_set_selection,
+};
 
-    struct wl_array * states;
+#define REQUEST_TABLE(iface) { &iface##_interface, iface##_request_handlers, sizeof(iface##_request_handlers)/sizeof(iface##_request_handlers[0]) }
 
-    states = (struct wl_array *)malloc(sizeof(struct wl_array));
+static const struct request_table request_tables[] = {
 
-    states->size = 1 * sizeof(uint32_t);
+  REQUEST_TABLE(wl_display),
+  REQUEST_TABLE(wl_registry),
+  REQUEST_TABLE(wl_compositor),
+  REQUEST_TABLE(wl_region),
+  REQUEST_TABLE(xdg_wm_base),
+  REQUEST_TABLE(xdg_surface),
+  REQUEST_TABLE(xdg_toplevel),
+  REQUEST_TABLE(wl_surface),
+  REQUEST_TABLE(wl_shm),
+  REQUEST_TABLE(wl_shm_pool),
+  REQUEST_TABLE(wl_seat),
+  REQUEST_TABLE(zxdg_decoration_manager_v1),
+  REQUEST_TABLE(zxdg_toplevel_decoration_v1),
+  REQUEST_TABLE(wl_data_device_manager),
+  REQUEST_TABLE(zwp_primary_selection_device_manager_v1),
+  REQUEST_TABLE(zwp_primary_selection_device_v1),
+  REQUEST_TABLE(zwp_primary_selection_offer_v1),
+  REQUEST_TABLE(wl_data_offer),
+  REQUEST_TABLE(wl_data_device),
+};
 
-    states->data = malloc(states->size);
+// Selected by interface pointer, by name if the client links its own copy of the protocol code
 
-    ((uint32_t *)(states->data))[0] = XDG_TOPLEVEL_STATE_MAXIMIZED;
+static const struct request_table * find_request_table(const struct wl_interface * interface) {
 
-    send_event(proxy, "configure", width, height, states);
+  for (int i = 0; i < sizeof(request_tables)/sizeof(request_tables[0]); ++i) {
 
-    // TODO event not received immediately
-    send_event(((struct xdg_toplevel *)proxy)->xdg_surface, "configure", 0);
+    if (request_tables[i].interface == interface)
+      return &request_tables[i];
   }
-  else if ( (strcmp(proxy->interface->name, "xdg_toplevel") == 0) &&
-       (opcode == XDG_TOPLEVEL_SET_FULLSCREEN) ) {
 
-    emscripten_log(EM_LOG_CONSOLE, "XDG_TOPLEVEL_SET_FULLSCREEN");
+  for (int i = 0; i < sizeof(request_tables)/sizeof(request_tables[0]); ++i) {
 
-    int width, height;
-      
-    /*EM_ASM({*/
+    if (strcmp(request_tables[i].interface->name, interface->name) == 0)
+      return &request_tables[i];
+  }
 
-    const char * fun =
+  return NULL;
+}
 
-	"const w = window.devicePixelRatio * window.parent.innerWidth;" // window.innerWidth return 0
-	"const h = window.devicePixelRatio * window.parent.innerHeight;"
+struct wl_proxy *
+wl_proxy_marshal_flags(struct wl_proxy *proxy, uint32_t opcode,
+		       const struct wl_interface *interface, uint32_t version,
+		       uint32_t flags, ...) {
 
-	"Module.HEAPU8[$0] =  w & 0xff;"
-	"Module.HEAPU8[$0+1] = (w >> 8) & 0xff;"
-	"Module.HEAPU8[$0+2] = (w >> 16) & 0xff;"
-	"Module.HEAPU8[$0+3] = (w >> 24) & 0xff;"
+  LOG_TRACE("wl_proxy_marshal_flags: %p %p %p %d", proxy, proxy->interface, interface, opcode);
 
-	"Module.HEAPU8[$1] =  h & 0xff;"
-	"Module.HEAPU8[$1+1] = (h >> 8) & 0xff;"
-	"Module.HEAPU8[$1+2] = (h >> 16) & 0xff;"
-        "Module.HEAPU8[$1+3] = (h >> 24) & 0xff;"
+  if (!proxy || !proxy->interface || !proxy->interface->name)
+    return NULL;
 
-        "let canvas = Module['surfaces'][$2-1];"
+  LOG_TRACE("wl_proxy_marshal_flags: %s %d", proxy->interface->name, opcode);
 
-	"canvas.width = w;"
-        "canvas.height = h;"
+  const struct interface_descriptor * descriptor = proxy_get_descriptor(proxy);
 
-        "canvas.style.width = w/window.devicePixelRatio + \"px\";"
-        "canvas.style.height = h/window.devicePixelRatio + \"px\";"
+  const struct request_table * table = (descriptor)?descriptor->requests:find_request_table(proxy->interface);
 
-        "if (canvas.parentElement) {"
-	    "canvas.parentElement.style.width = w/window.devicePixelRatio + \"px\";"
-            "canvas.parentElement.style.left = '0px';"
-            "canvas.parentElement.style.top = '0px';"
+  struct wl_proxy * ret = NULL;
 
-      //"console.log(\"Fullscreen: hide decoration\");"
-      //"console.log(canvas.parentElement);"
-      //"console.log(canvas.parentElement.firstChild);"
-            
-            // Hide decoration
-            "canvas.parentElement.firstChild.style.display = \"none\";"
-        "}";
+  if (descriptor && (opcode < proxy->interface->method_count))
+    ++descriptor->request_counts[opcode];
 
-    /*}, &width, &height);*/
+  if (RECORD_ENABLED() || REPLAY_ENABLED()) {
 
-    static int set_fullscreen_handle = -1;
+    va_list ap;
 
-    if (set_fullscreen_handle < 0)
-      set_fullscreen_handle = emscripten_load_fun(fun, "vppi");
-  
-    emscripten_run_fun(set_fullscreen_handle, &width, &height, ((struct xdg_toplevel *)proxy)->xdg_surface->wl_surface->id);
+    va_start(ap, flags);
+
+    record_request(proxy, opcode, ap);
 
-    emscripten_log(EM_LOG_CONSOLE, "XDG_TOPLEVEL_SET_FULLSCREEN: w=%d h=%d", width, height);
+    va_end(ap);
+  }
 
-    struct wl_array * states;
+  if (table && (opcode < table->nb_handlers) && table->handlers[opcode]) {
 
-    states = (struct wl_array *)malloc(sizeof(struct wl_array));
+    va_list ap;
 
-    states->size = 1 * sizeof(uint32_t);
+    va_start(ap, flags);
 
-    states->data = malloc(states->size);
+    ++display.marshal_depth;
 
-    ((uint32_t *)(states->data))[0] = XDG_TOPLEVEL_STATE_FULLSCREEN;
+    ret = table->handlers[opcode](proxy, opcode, interface, version, flags, ap);
 
-    send_event(proxy, "configure", width, height, states);
+    --display.marshal_depth;
 
-    // TODO event not received immediately
-    send_event(((struct xdg_toplevel *)proxy)->xdg_surface, "configure", 0);
+    va_end(ap);
   }
-  
 
-  return NULL;
+  // Destructor requests
+
+  if (flags & WL_MARSHAL_FLAG_DESTROY)
+    wl_proxy_destroy(proxy);
+
+  return ret;
 }
 
 int wl_proxy_add_listener(struct wl_proxy * proxy,
 		      void (**implementation)(void), void *data) {
 
-  emscripten_log(EM_LOG_CONSOLE, "wl_proxy_add_listener: %p %p", proxy, proxy->interface->name);
+  LOG_TRACE("wl_proxy_add_listener: %p %p", proxy, proxy->interface->name);
   
   if (proxy && proxy->interface && proxy->interface->name) {
     
-    emscripten_log(EM_LOG_CONSOLE, "wl_proxy_add_listener: %s", proxy->interface->name);
+    LOG_TRACE("wl_proxy_add_listener: %s", proxy->interface->name);
+
+    proxy_get_descriptor(proxy);
     
     if (strcmp(proxy->interface->name, "wl_shm") == 0) {
 
-      send_event(proxy, "format", WL_SHM_FORMAT_ARGB8888);
+      queue_wl_shm_format(proxy, WL_SHM_FORMAT_ARGB8888);
+      queue_wl_shm_format(proxy, WL_SHM_FORMAT_XRGB8888);
     }
     else if (strcmp(proxy->interface->name, "wl_output") == 0) {
 
@@ -3602,14 +6436,14 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
       if (wl_output_handle < 0)
         wl_output_handle = emscripten_load_fun(fun, "vppppp");
   
-      emscripten_run_fun(wl_output_handle, &physical_width, &physical_height, &width, &height, &scale);
+      js_run(wl_output_handle, &physical_width, &physical_height, &width, &height, &scale);
 
-      emscripten_log(EM_LOG_CONSOLE, "wl_output: %d %d %d %d", physical_width, physical_height, width, height);
+      LOG_DEBUG("wl_output: %d %d %d %d", physical_width, physical_height, width, height);
 
-      send_event(proxy, "geometry", 0, 0, physical_width, physical_height, 0, "", "", 0);
-      send_event(proxy, "mode", 0, width, height, 60);
-      send_event(proxy, "scale", scale);
-      send_event(proxy, "done");
+      queue_wl_output_geometry(proxy, 0, 0, physical_width, physical_height, 0, "", "", 0);
+      queue_wl_output_mode(proxy, 0, width, height, 60);
+      queue_wl_output_scale(proxy, scale);
+      queue_wl_output_done(proxy);
     }
     else if (strcmp(proxy->interface->name, "xdg_toplevel") == 0) {
 
@@ -3636,29 +6470,21 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 	/*width = (4*width/5);
       height = (4*height/5);*/
 
-      struct wl_array * states;
-
-      states = (struct wl_array *)malloc(sizeof(struct wl_array));
-
-      states->size = 1 * sizeof(uint32_t);
-
-      states->data = malloc(states->size);
-
-      ((uint32_t *)(states->data))[0] = XDG_TOPLEVEL_STATE_ACTIVATED;
+      struct wl_array * states = event_states_new(XDG_TOPLEVEL_STATE_ACTIVATED);
 
       width = 0;
       height = 0;
       
-      send_event(proxy, "configure", width, height, states);
+      queue_xdg_toplevel_configure(proxy, width, height, states);
     }
     else if (strcmp(proxy->interface->name, "zxdg_toplevel_decoration_v1") == 0) {
       
-      send_event(proxy, "configure", ((struct zxdg_toplevel_decoration_v1 *)proxy)->mode);
+      queue_zxdg_toplevel_decoration_v1_configure(proxy, ((struct zxdg_toplevel_decoration_v1 *)proxy)->mode);
     }
     else if (strcmp(proxy->interface->name, "wl_seat") == 0) {
 
-      send_event(proxy, "capabilities", WL_SEAT_CAPABILITY_KEYBOARD | WL_SEAT_CAPABILITY_POINTER);
-      //send_event(proxy, "capabilities", WL_SEAT_CAPABILITY_POINTER);
+      queue_wl_seat_capabilities(proxy, WL_SEAT_CAPABILITY_KEYBOARD | WL_SEAT_CAPABILITY_POINTER);
+      //send_event(proxy, EVENT_OPCODE(wl_seat, capabilities), WL_SEAT_CAPABILITY_POINTER);
     }
     else if (strcmp(proxy->interface->name, "wl_keyboard") == 0) {
 
@@ -3746,7 +6572,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 				      "event.preventDefault();" // Cancel the native event
 				      "event.stopPropagation();" // Don't bubble/capture the event any further
 
-				      "console.log(event);"
+				      JS_LOG_TRACE("console.log(event);")
 
 				      "if (event.repeat)"
 					"return;"
@@ -3755,7 +6581,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 				      "const scancode = Module.computeKey(event);"
 
-	                              "console.log(\"scancode: \", scancode);"
+	                              JS_LOG_TRACE("console.log(\"scancode: \", scancode);")
 
 	                              // Workaround for AltGr on Windows where Ctrl key is received
 	                              "if (event.key == \"AltGraph\") {"
@@ -3766,7 +6592,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 	                                     "Module.no_ctrl = true;"
 
-	                                     "Module['wayland'].events.push({"
+	                                     "Module['wayland'].pushEvent({"
 
 					       "'type': 4," // keyup
 					       "'key': 0xffe3-8," // !! to simulate keyup ctrl key
@@ -3780,7 +6606,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 					       "Module.mods = mods;"
 
-					       "Module['wayland'].events.push({"
+					       "Module['wayland'].pushEvent({"
 					    
 					           "'type': 6," // mods
 					           "'mods': mods"
@@ -3789,7 +6615,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 	                                     "setTimeout(() => {"
 
-					       "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+					       "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
 					        // TODO check rw
 		      
@@ -3814,7 +6640,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 	                                  "Module.keyCode = event.keyCode;"
 	                              "}"
 	
-				      "Module['wayland'].events.push({"
+				      "Module['wayland'].pushEvent({"
 
 					"'type': 3," // keydown
 					"'key': scancode-8," // !! to simulate Linux evdev scancode
@@ -3828,7 +6654,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 					"Module.mods = mods;"
 
-					"Module['wayland'].events.push({"
+					"Module['wayland'].pushEvent({"
 					    
 					    "'type': 6," // mods
 					    "'mods': mods"
@@ -3837,7 +6663,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 				      "setTimeout(() => {"
 
-					  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+					  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
 					    // TODO check rw
 		      
@@ -3854,7 +6680,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 				      "event.preventDefault();" // Cancel the native event
 				      "event.stopPropagation();" // Don't bubble/capture the event any further
 
-				      "console.log(event);"
+				      JS_LOG_TRACE("console.log(event);")
 
 	                              "if (event.repeat)"
 					"return;"
@@ -3871,7 +6697,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 					"Module.mods = mods;"
 
-					"Module['wayland'].events.push({"
+					"Module['wayland'].pushEvent({"
 
 					    "'type': 6," // mods
 					    "'mods': mods"
@@ -3891,7 +6717,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
                                           "scancode = Module.scancode;"
 	                              "}"
 
-				      "Module['wayland'].events.push({"
+				      "Module['wayland'].pushEvent({"
 
 					"'type': 4," // keyup
 					"'key': scancode-8," // !! to simulate Linux evdev scancode
@@ -3901,7 +6727,7 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
 
 				      "setTimeout(() => {"
 
-					  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].events.length > 0) ) {"
+					  "if ( (Module['fd_table'][0x7e000000].notif_select) && (Module['wayland'].pending()) ) {"
 
 					    // TODO check rw
 		      
@@ -3919,13 +6745,13 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
       if (wl_keyboard_handle < 0)
         wl_keyboard_handle = emscripten_load_fun(fun, "v");
   
-      emscripten_run_fun(wl_keyboard_handle);
+      js_run(wl_keyboard_handle);
     
       int keymap_fd = open("/dev/shm/keymap", O_RDWR);
     
-      send_event(proxy, "keymap", WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd, 0);
+      queue_wl_keyboard_keymap(proxy, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, keymap_fd, 0);
 
-      send_event(proxy, "repeat_info", KEYBOARD_RATE, KEYBOARD_DELAY);
+      queue_wl_keyboard_repeat_info(proxy, KEYBOARD_RATE, KEYBOARD_DELAY);
     }
     else if (strcmp(proxy->interface->name, "wl_pointer") == 0) {
 
@@ -3939,27 +6765,27 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
     if (wl_pointer_handle < 0)
       wl_pointer_handle = emscripten_load_fun(fun, "v");
   
-    emscripten_run_fun(wl_pointer_handle);
+    js_run(wl_pointer_handle);
     }
     else if (strcmp(proxy->interface->name, "wl_data_device") == 0) {
 
       data_offer.device = (struct wl_data_device *)proxy;
 
-      send_event(proxy, "data_offer", &data_offer); 
+      queue_wl_data_device_data_offer(proxy, &data_offer); 
     }
     else if (strcmp(proxy->interface->name, "wl_data_offer") == 0) {
 
-      send_event(proxy, "offer", "text/plain"); 
+      queue_wl_data_offer_offer(proxy, "text/plain"); 
     }
     else if (strcmp(proxy->interface->name, "zwp_primary_selection_device_v1") == 0) {
 
       primary_data_offer.device = (struct zwp_primary_selection_device_v1 *)proxy;
 
-      send_event(proxy, "data_offer", &primary_data_offer);
+      queue_zwp_primary_selection_device_v1_data_offer(proxy, &primary_data_offer);
     }
     else if (strcmp(proxy->interface->name, "zwp_primary_selection_offer_v1") == 0) {
 
-      send_event(proxy, "offer", "text/plain"); 
+      queue_zwp_primary_selection_offer_v1_offer(proxy, "text/plain"); 
     }
   }
 
@@ -3971,452 +6797,289 @@ int wl_proxy_add_listener(struct wl_proxy * proxy,
   return 0;
 }
 
-int wl_display_dispatch(struct wl_display * display) {
+static void pointer_frame_flush(struct wl_pointer * pointer) {
 
-  while (1) {
+  struct pointer_frame * frame = &pointer->frame;
 
-    int arg1, arg2, arg3;
-    
-    /*int event_type = EM_ASM_INT({*/
+  if (frame->motion) {
 
-    const char * fun = 
+    queue_wl_pointer_motion(pointer, 0, frame->x, frame->y);
 
-	"if ( ('wayland' in Module) && (Module['wayland'].events.length > 0) ) {"
+    frame->motion = 0;
+    frame->pending = 1;
+  }
 
-	  "const event = Module['wayland'].events.shift();"
+  if (frame->axis) {
 
-	  //console.log("event received "+event.type);
+    if (pointer->proxy.version >= WL_POINTER_AXIS_SOURCE_SINCE_VERSION)
+      queue_wl_pointer_axis_source(pointer, WL_POINTER_AXIS_SOURCE_WHEEL);
 
-	  "if (event.type == 1) {" // buffer released
+    if (frame->dx)
+      queue_wl_pointer_axis(pointer, 0, WL_POINTER_AXIS_HORIZONTAL_SCROLL, frame->dx);
 
-	    "Module.HEAPU8[$0] =  event.surface_id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.surface_id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.surface_id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.surface_id >> 24) & 0xff;"
-	    
-	    "Module.HEAPU8[$1] = event.shm_fd & 0xff;"
-	    "Module.HEAPU8[$1+1] = (event.shm_fd >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (event.shm_fd >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (event.shm_fd >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 2) {" // frame done
+    if (frame->dy)
+      queue_wl_pointer_axis(pointer, 0, WL_POINTER_AXIS_VERTICAL_SCROLL, frame->dy);
 
-	    "Module.HEAPU8[$0] =  event.surface_id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.surface_id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.surface_id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.surface_id >> 24) & 0xff;"
-	    
-	    "Module.HEAPU8[$1] = event.timestamp & 0xff;"
-	    "Module.HEAPU8[$1+1] = (event.timestamp >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (event.timestamp >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (event.timestamp >> 24) & 0xff;"
-	  "}"
-	  "else if ( (event.type == 3) || (event.type == 4) ) {" // key down or up
-	    
-	    "Module.HEAPU8[$0] =  event.key & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.key >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.key >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.key >> 24) & 0xff;"
-	    
-	    "Module.HEAPU8[$1] = event.timestamp & 0xff;"
-	    "Module.HEAPU8[$1+1] = (event.timestamp >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (event.timestamp >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (event.timestamp >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 5) {" // close button pressed
+    frame->axis = 0;
+    frame->dx = 0;
+    frame->dy = 0;
+    frame->pending = 1;
+  }
+}
 
-	    //console.log("Close button pressed: "+event.surface_id);
+// Close the current input frame: flush merged motion and wheel, then group them with wl_pointer.frame
 
-	    "Module.HEAPU8[$0] =  event.surface_id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.surface_id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.surface_id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.surface_id >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 6) {" // mods updated
+static void pointer_frame_end(struct wl_pointer * pointer) {
 
-	    "Module.HEAPU8[$0] =  event.mods & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.mods >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.mods >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.mods >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 7) {" // wheel
+  pointer_frame_flush(pointer);
 
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
+  if (pointer->frame.pending && (pointer->proxy.version >= WL_POINTER_FRAME_SINCE_VERSION))
+    queue_wl_pointer_frame(pointer);
 
-	    "let dx = event.deltaX * 256;" // convert to fixed
-	    
-	    "Module.HEAPU8[$1] =  dx & 0xff;"
-	    "Module.HEAPU8[$1+1] = (dx >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (dx >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (dx >> 24) & 0xff;"
+  pointer->frame.pending = 0;
+}
 
-	    "let dy = event.deltaY * 256;" // convert to fixed
-	    
-	    "Module.HEAPU8[$2] =  dy & 0xff;"
-	    "Module.HEAPU8[$2+1] = (dy >> 8) & 0xff;"
-	    "Module.HEAPU8[$2+2] = (dy >> 16) & 0xff;"
-	    "Module.HEAPU8[$2+3] = (dy >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 8) {" // button
-
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
-
-	    "Module.HEAPU8[$1] =  event.state & 0xff;"
-	    "Module.HEAPU8[$1+1] = (event.state >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (event.state >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (event.state >> 24) & 0xff;"
-            
-	    "let button = 0x110;"
-
-            "if (event.button == 2)" // right
-            "   button = 0x111;"
-            "else if (event.button == 1)" // middle
-            "   button = 0x112;"
-
-	    "Module.HEAPU8[$2] =  button & 0xff;"
-	    "Module.HEAPU8[$2+1] = (button >> 8) & 0xff;"
-	    "Module.HEAPU8[$2+2] = (button >> 16) & 0xff;"
-	    "Module.HEAPU8[$2+3] = (button >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 9) {" // move
+// Moves the events waiting in the JS overflow array into the ring, only needed when it was full
 
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
+static void js_event_ring_refill(void) {
 
-	    "let x = event.x * 256;" // convert to fixed
-	    
-	    "Module.HEAPU8[$1] =  x & 0xff;"
-	    "Module.HEAPU8[$1+1] = (x >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (x >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (x >> 24) & 0xff;"
+  const char * fun = "Module['wayland'].refill();";
 
-	    "let y = event.y * 256;" // convert to fixed
-	    
-	    "Module.HEAPU8[$2] =  y & 0xff;"
-	    "Module.HEAPU8[$2+1] = (y >> 8) & 0xff;"
-	    "Module.HEAPU8[$2+2] = (y >> 16) & 0xff;"
-	    "Module.HEAPU8[$2+3] = (y >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 10) {" // mouse enter
+  static int js_event_ring_refill_handle = -1;
 
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
+  if (js_event_ring_refill_handle < 0)
+    js_event_ring_refill_handle = emscripten_load_fun(fun, "v");
 
-	    "let x = event.x * 256;" // convert to fixed
-	    
-	    "Module.HEAPU8[$1] =  x & 0xff;"
-	    "Module.HEAPU8[$1+1] = (x >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (x >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (x >> 24) & 0xff;"
+  js_run(js_event_ring_refill_handle);
+}
 
-	    "let y = event.y * 256;" // convert to fixed
-	    
-	    "Module.HEAPU8[$2] =  y & 0xff;"
-	    "Module.HEAPU8[$2+1] = (y >> 8) & 0xff;"
-	    "Module.HEAPU8[$2+2] = (y >> 16) & 0xff;"
-	    "Module.HEAPU8[$2+3] = (y >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 11) {" // mouse leave
+static int js_event_ring_next(struct js_event_ring * ring, int * arg1, int * arg2, int * arg3, double * timestamp) {
 
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 12) {" // keyboard enter (focus in)
+  if ( (ring->head == ring->tail) && ring->overflow ) {
 
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
-	  "}"
-	  "else if (event.type == 13) {" // keyboard leave (focus out)
+    js_event_ring_refill();
+    ++client_stats.ring_refills;
+  }
 
-	    "Module.HEAPU8[$0] =  event.id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.id >> 24) & 0xff;"
-	  "}"
-          "else if (event.type == 14) {" // ps receive
+  if (ring->head == ring->tail) {
 
-	    "Module.HEAPU8[$0] =  event.fd & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.fd >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.fd >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.fd >> 24) & 0xff;"
-	  "}"
-          "else if (event.type == 15) {" // data receive
+    if (RECORD_ENABLED())
+      record_event(0, 0, 0, 0, 0);
 
-	    "Module.HEAPU8[$0] =  event.fd & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.fd >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.fd >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.fd >> 24) & 0xff;"
+    return 0;
+  }
 
-            "let len = lengthBytesUTF8(event.data)+1;"
+  if ((ring->head - ring->tail) > client_stats.ring_high_water)
+    client_stats.ring_high_water = ring->head - ring->tail;
 
-            "let ptr = Module._malloc(len);"
+  ++client_stats.js_events;
 
-            "Module.HEAPU8[$1] =  ptr & 0xff;"
-	    "Module.HEAPU8[$1+1] = (ptr >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (ptr >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (ptr >> 24) & 0xff;"
+  const struct js_event * record = &ring->records[ring->tail & (ring->size - 1)];
 
-            "stringToUTF8Array(event.data, Module.HEAPU8, ptr, len);"
-    
-	  "}"
-          "else if (event.type == 16) {" // window resized
-
-	    "Module.HEAPU8[$0] =  event.surface_id & 0xff;"
-	    "Module.HEAPU8[$0+1] = (event.surface_id >> 8) & 0xff;"
-	    "Module.HEAPU8[$0+2] = (event.surface_id >> 16) & 0xff;"
-	    "Module.HEAPU8[$0+3] = (event.surface_id >> 24) & 0xff;"
-
-            "Module.HEAPU8[$1] =  event.width & 0xff;"
-	    "Module.HEAPU8[$1+1] = (event.width >> 8) & 0xff;"
-	    "Module.HEAPU8[$1+2] = (event.width >> 16) & 0xff;"
-	    "Module.HEAPU8[$1+3] = (event.width >> 24) & 0xff;"
-
-            "Module.HEAPU8[$2] =  event.height & 0xff;"
-	    "Module.HEAPU8[$2+1] = (event.height >> 8) & 0xff;"
-	    "Module.HEAPU8[$2+2] = (event.height >> 16) & 0xff;"
-	    "Module.HEAPU8[$2+3] = (event.height >> 24) & 0xff;"
-    
-	  "}"
-	  
-	  "return event.type;"
-	"}"
-	
-	  "return 0;";
-	
-	  //}, &arg1, &arg2, &arg3)*/;
+  int type = record->type;
 
-       static int wl_display_dispatch_handle = -1;
+  *arg1 = record->args[0];
+  *arg2 = record->args[1];
+  *arg3 = record->args[2];
+  *timestamp = record->timestamp;
 
-    if (wl_display_dispatch_handle < 0)
-      wl_display_dispatch_handle = emscripten_load_fun(fun, "ippp");
-  
-    int event_type = emscripten_run_fun(wl_display_dispatch_handle, &arg1, &arg2, &arg3);
+  ++ring->tail;
+
+  if (RECORD_ENABLED())
+    record_event(type, *arg1, *arg2, *arg3, *timestamp);
+
+  return type;
+}
+
+int wl_display_dispatch(struct wl_display * display) {
+
+  if (REPLAY_ENABLED())
+    replay_pump(&js_event_ring);
+
+  while (1) {
+
+    int arg1, arg2, arg3;
+    double timestamp;
+
+    int event_type = js_event_ring_next(&js_event_ring, &arg1, &arg2, &arg3, &timestamp);
+
+    if (TRACE_ENABLED() && ( (event_type == 3) || (event_type == 4) || ((event_type >= 7) && (event_type <= 9)) ))
+      trace_input(event_type, timestamp);
+
+    // Motion and wheel are merged until any other event, which keeps the ordering
+
+    if ( (event_type != 7) && (event_type != 9) )
+      pointer_frame_end(&pointer);
 
     if (event_type == 1) { // buffer released
 
-      for (int i = 0; i < 16; ++i) {
+      struct wl_buffer * buffer = buffer_release(arg2);
 
-	if (wl_buffers[i].fd == arg2) {
+      if (buffer) {
 
-	  send_event(&wl_buffers[i], "release");
-	  break;
-	}
+	queue_wl_buffer_release(buffer);
+
+	++client_stats.buffers_released;
       }
     }
     else if (event_type == 2) { // frame done
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+      struct wl_surface * surface = surface_from_id(arg1);
 
-	if (surfaces[i].id == arg1) {
+      if (TRACE_ENABLED() && surface)
+	trace_render(surface, timestamp, arg3 / 1000.0f);
 
-	  for (int j = 0; j < NB_CALLBACK_MAX; ++j) {
+      if (surface && surface->commits_pending)
+	--surface->commits_pending;
 
-	    if (frame_callbacks[j].wl_surface == &surfaces[i]) {
+      struct wl_callback * callback = (surface)?surface->frame_callbacks:NULL;
 
-	      send_event(&frame_callbacks[j], "done", arg2);
+      if (surface)
+	surface->frame_callbacks = NULL;
 
-	      frame_callbacks[j].wl_surface = NULL;
-	  
-	      break;
-	    }
-	  }
+      while (callback) {
 
-	  break;
-	}
+	struct wl_callback * next = callback->next;
+
+	queue_wl_callback_done(callback, arg2);
+
+	++client_stats.frames_done;
+
+	// Done: the client destroys the callback from its listener
+
+	callback->wl_surface = NULL;
+	callback->next = NULL;
+
+	callback = next;
       }
     }
     else if (event_type == 3) { // key down
 
       ++keyboard.serial;
 
-      send_event(&keyboard, "key", keyboard.serial, arg2, arg1, WL_KEYBOARD_KEY_STATE_PRESSED);
+      queue_wl_keyboard_key(&keyboard, keyboard.serial, arg2, arg1, WL_KEYBOARD_KEY_STATE_PRESSED);
     }
     else if (event_type == 4) { // key up
 
       ++keyboard.serial;
 
-      send_event(&keyboard, "key", keyboard.serial, arg2, arg1, WL_KEYBOARD_KEY_STATE_RELEASED);
+      queue_wl_keyboard_key(&keyboard, keyboard.serial, arg2, arg1, WL_KEYBOARD_KEY_STATE_RELEASED);
     }
     else if (event_type == 5) { // close button pressed
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
-
-	if (surfaces[i].id == arg1) {
+      struct xdg_toplevel * toplevel = surface_get_toplevel(surface_from_id(arg1));
 
-	  for (int j = 0; j < NB_SURFACE_MAX; ++j) {
-
-	    if (xdg_surfaces[j].wl_surface == &surfaces[i]) {
-	      
-	      for (int k = 0; k < NB_SURFACE_MAX; ++k) {
-
-		if (xdg_toplevels[k].xdg_surface == &xdg_surfaces[j]) {
-
-		  send_event(&xdg_toplevels[k], "close");
-		  
-		  break;
-		}
-	      }
-	      break;
-	    }
-	  }
-	  
-	  break;
-	}
-      }
+      if (toplevel)
+	queue_xdg_toplevel_close(toplevel);
     }
     else if (event_type == 6) { // mods
 
       ++keyboard.serial;
 
-      send_event(&keyboard, "modifiers", keyboard.serial, arg1, 0, 0, 0);
+      queue_wl_keyboard_modifiers(&keyboard, keyboard.serial, arg1, 0, 0, 0);
     }
     else if (event_type == 7) { // wheel
 
-      if (arg2)
-	send_event(&pointer, "axis", 0, WL_POINTER_AXIS_HORIZONTAL_SCROLL, arg2);
+      if (pointer.frame.axis)
+	++display->queue_stats.merged_axes;
 
-      if (arg3)
-	send_event(&pointer, "axis", 0, WL_POINTER_AXIS_VERTICAL_SCROLL, arg3);
+      pointer.frame.axis = 1;
+      pointer.frame.dx += arg2;
+      pointer.frame.dy += arg3;
     }
     else if (event_type == 8) { // button
 
       ++pointer.serial;
 
-      send_event(&pointer, "button", pointer.serial, 0, arg3, arg2);
+      queue_wl_pointer_button(&pointer, pointer.serial, 0, arg3, arg2);
+
+      pointer.frame.pending = 1;
+      pointer_frame_end(&pointer);
     }
     else if (event_type == 9) { // mousemove
 
-      send_event(&pointer, "motion", 0, arg2, arg3);
+      if (pointer.frame.motion)
+	++display->queue_stats.merged_motions;
+
+      pointer.frame.motion = 1;
+      pointer.frame.x = arg2;
+      pointer.frame.y = arg3;
     }
     else if (event_type == 10) { // mouseenter
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+      struct wl_surface * surface = surface_from_id(arg1);
 
-	if (surfaces[i].id == arg1) {
-	  
-	  struct wl_surface * surface = &surfaces[i];
+      if (surface) {
 
-	  send_event(&pointer, "enter", 0, surface, arg2, arg3);
+	queue_wl_pointer_enter(&pointer, 0, surface, arg2, arg3);
 
-	  break;
-	}
+	pointer.frame.pending = 1;
+	pointer_frame_end(&pointer);
       }
     }
     else if (event_type == 11) { // mouseleave
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+      struct wl_surface * surface = surface_from_id(arg1);
 
-	if (surfaces[i].id == arg1) {
-	  
-	  struct wl_surface * surface = &surfaces[i];
-	  
-	  send_event(&pointer, "leave", 0, surface);
+      if (surface) {
 
-	  break;
-	}
+	queue_wl_pointer_leave(&pointer, 0, surface);
+
+	pointer.frame.pending = 1;
+	pointer_frame_end(&pointer);
       }
     }
     else if (event_type == 12) { // focus in
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+      struct wl_surface * surface = surface_from_id(arg1);
 
-	if (surfaces[i].id == arg1) {
-	  
-	  struct wl_surface * surface = &surfaces[i];
+      if (surface) {
 
-	  ++keyboard.serial;
-	  
-	  send_event(&keyboard, "enter", keyboard.serial, surface, NULL);
+	++keyboard.serial;
 
-	  break;
-	}
+	queue_wl_keyboard_enter(&keyboard, keyboard.serial, surface, NULL);
       }
     }
     else if (event_type == 13) { // focus out
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
+      struct wl_surface * surface = surface_from_id(arg1);
 
-	if (surfaces[i].id == arg1) {
-	  
-	  struct wl_surface * surface = &surfaces[i];
+      if (surface) {
 
-	  ++keyboard.serial;
-	  
-	  send_event(&keyboard, "leave", keyboard.serial, surface);
+	++keyboard.serial;
 
-	  break;
-	}
+	queue_wl_keyboard_leave(&keyboard, keyboard.serial, surface);
       }
     }
     else if (event_type == 14) { // ps receive
 
-      emscripten_log(EM_LOG_CONSOLE, "ps receive");
+      LOG_DEBUG("ps receive");
 
-      send_event(&primary_selection_source, "send", "text/plain", arg1);
+      queue_zwp_primary_selection_source_v1_send(&primary_selection_source, "text/plain", arg1);
     }
     else if (event_type == 15) { // data receive
 
-      emscripten_log(EM_LOG_CONSOLE, "data receive");
+      LOG_DEBUG("data receive");
 
       write(arg1, (const char *)arg2, strlen((const char *)arg2));
       close(arg1);
+
+      free((void *)arg2);
     }
     else if (event_type == 16) { // window resized
 
-      for (int i = 0; i < NB_SURFACE_MAX; ++i) {
-
-	if (surfaces[i].id == arg1) {
-	  
-	  for (int j = 0; j < NB_SURFACE_MAX; ++j) {
-
-	    if (xdg_surfaces[j].wl_surface == &surfaces[i]) {
-
-	      for (int k = 0; k < NB_SURFACE_MAX; ++k) {
-
-		if (xdg_toplevels[k].xdg_surface == &xdg_surfaces[j]) {
-
-		  struct wl_array * states;
-
-		  states = (struct wl_array *)malloc(sizeof(struct wl_array));
+      struct xdg_toplevel * toplevel = surface_get_toplevel(surface_from_id(arg1));
 
-		  states->size = 1 * sizeof(uint32_t);
+      if (toplevel) {
 
-		  states->data = malloc(states->size);
+	struct wl_array * states = event_states_new(XDG_TOPLEVEL_STATE_RESIZING);
 
-		  ((uint32_t *)(states->data))[0] = XDG_TOPLEVEL_STATE_RESIZING;
+	LOG_DEBUG("Resizing window: id=%d w=%d h=%d", arg1, arg2, arg3);
 
-		  emscripten_log(EM_LOG_CONSOLE, "Resizing window: id=%d w=%d h=%d", arg1, arg2, arg3);
+	queue_xdg_toplevel_configure(toplevel, arg2, arg3, states);
 
-		  send_event(&xdg_toplevels[k], "configure", arg2, arg3, states);
-
-		  free(states);
-
-		  // TODO event not received immediately
-		  send_event(xdg_toplevels[k].xdg_surface, "configure", 0);
-		  break;
-		}
-	      }
-	      
-	      break;
-	    }
-	  }
-
-	  break;
-	}
+	// TODO event not received immediately
+	queue_xdg_surface_configure(toplevel->xdg_surface, 0);
       }
     }
     else if (event_type == 0) {
@@ -4425,8 +7088,21 @@ int wl_display_dispatch(struct wl_display * display) {
     }
   }
 
+  pointer_frame_end(&pointer);
+
   wl_display_roundtrip(display);
 
+  if (TRACE_ENABLED() && tracer.undispatched) {
+
+    trace_mark(TRACE_DISPATCH, emscripten_get_now(), 0, 0, tracer.undispatched, 0);
+    tracer.undispatched = 0;
+  }
+
+  // Next batch ready before the client waits again
+
+  if (REPLAY_ENABLED())
+    replay_pump(&js_event_ring);
+
   //usleep(1000);
 
   return 1;
@@ -4441,25 +7117,9 @@ wl_display_dispatch_pending(struct wl_display *display) {
 int
 wl_display_prepare_read(struct wl_display *display) {
   
-  /*int ret = EM_ASM_INT({*/
-
-  const char * fun =
-    
-      "if ( ('wayland' in Module) && (Module['wayland'].events.length > 0) ) {"
-
-	"return -1;"
-      "}"
-
-    "return 0;";
-  
-      /*})*/;
+  // JS events are visible in the ring, no need to cross into JS
 
-  static int wl_display_prepare_read_handle = -1;
-
-    if (wl_display_prepare_read_handle < 0)
-      wl_display_prepare_read_handle = emscripten_load_fun(fun, "i");
-  
-    int ret = emscripten_run_fun(wl_display_prepare_read_handle);
+  int ret = ( (js_event_ring.head != js_event_ring.tail) || js_event_ring.overflow )?-1:0;
 
     if (display->head != display->tail)
       ret = 1;
@@ -4565,7 +7225,7 @@ enum xkb_compose_feed_result
 xkb_compose_state_feed(struct xkb_compose_state *state,
                        xkb_keysym_t keysym) {
 
-  emscripten_log(EM_LOG_CONSOLE, "xkb_compose_state_feed: %x status=%d", keysym, state->status);
+  LOG_TRACE("xkb_compose_state_feed: %x status=%d", keysym, state->status);
   
   if (keysym == 0xff5e) {
     state->circumflex = 1;
@@ -4587,7 +7247,7 @@ xkb_compose_state_feed(struct xkb_compose_state *state,
     state->status = XKB_COMPOSE_COMPOSED;
   }
 
-  emscripten_log(EM_LOG_CONSOLE, "xkb_compose_state_feed: new status=%d", state->status);
+  LOG_TRACE("xkb_compose_state_feed: new status=%d", state->status);
   
   return XKB_COMPOSE_FEED_ACCEPTED;
 }
@@ -4595,7 +7255,7 @@ xkb_compose_state_feed(struct xkb_compose_state *state,
 xkb_keysym_t
 xkb_compose_state_get_one_sym(struct xkb_compose_state *state) {
 
-  emscripten_log(EM_LOG_CONSOLE, "xkb_compose_state_get_one_sym: %x", state->keysym);
+  LOG_TRACE("xkb_compose_state_get_one_sym: %x", state->keysym);
 
   xkb_keysym_t keysym = state->keysym;
 
@@ -4607,7 +7267,7 @@ xkb_compose_state_get_one_sym(struct xkb_compose_state *state) {
 enum xkb_compose_status
 xkb_compose_state_get_status(struct xkb_compose_state *state) {
 
-  emscripten_log(EM_LOG_CONSOLE, "xkb_compose_state_get_status: %x", state->status);
+  LOG_TRACE("xkb_compose_state_get_status: %x", state->status);
   
   return state->status;
 }
@@ -4749,7 +7409,7 @@ xkb_keysym_to_lower(xkb_keysym_t ks) {
 xkb_keysym_t
 xkb_state_key_get_one_sym(struct xkb_state *state, xkb_keycode_t key) {
 
-  emscripten_log(EM_LOG_CONSOLE, "xkb_state_key_get_one_sym: %x", key);
+  LOG_TRACE("xkb_state_key_get_one_sym: %x", key);
   
   return key;
 }
@@ -4868,7 +7528,7 @@ wl_egl_window_create(struct wl_surface *surface,
   wl_egl_window.width = width;
   wl_egl_window.height = height;*/
 
-  emscripten_log(EM_LOG_CONSOLE, "--> wl_egl_window_create: w=%d h=%d", width, height);
+  LOG_DEBUG("--> wl_egl_window_create: w=%d h=%d", width, height);
 
   /*EM_ASM({*/
 
@@ -4895,7 +7555,7 @@ wl_egl_window_create(struct wl_surface *surface,
   if (egl_window_create_handle < 0)
     egl_window_create_handle = emscripten_load_fun(fun, "viii");
   
-  emscripten_run_fun(egl_window_create_handle, surface->id, width, height);
+  js_run(egl_window_create_handle, surface->id, width, height);
     
   return /*&wl_egl_window*/(struct wl_egl_window *)surface->id;
 }
@@ -4910,7 +7570,7 @@ wl_egl_window_resize(struct wl_egl_window *egl_window,
 		     int width, int height,
 		     int dx, int dy) {
 
-  emscripten_log(EM_LOG_CONSOLE, "--> wl_egl_window_resize: egl_window=%d w=%d h=%d dx=%d dy=%d", egl_window, width, height, dx, dy);
+  LOG_DEBUG("--> wl_egl_window_resize: egl_window=%d w=%d h=%d dx=%d dy=%d", egl_window, width, height, dx, dy);
       
   /*EM_ASM({*/
 
@@ -4951,67 +7611,19 @@ wl_egl_window_resize(struct wl_egl_window *egl_window,
   if (window_resize_handle < 0)
     window_resize_handle = emscripten_load_fun(fun, "viii");
   
-  emscripten_run_fun(window_resize_handle, width, height, egl_window);
+  js_run(window_resize_handle, width, height, egl_window);
 
-  struct wl_array * states;
+  struct xdg_toplevel * toplevel = surface_get_toplevel(surface_from_id((int)(intptr_t)egl_window)); // egl window is the surface id
 
-  states = (struct wl_array *)malloc(sizeof(struct wl_array));
+  if (toplevel) {
 
-  states->size = 1 * sizeof(uint32_t);
+    LOG_DEBUG("--> wl_egl_window_resize: send event: %d %d %d", egl_window, width, height);
 
-  states->data = malloc(states->size);
+    struct wl_array * states = event_states_new(XDG_TOPLEVEL_STATE_RESIZING);
 
-  ((uint32_t *)(states->data))[0] = XDG_TOPLEVEL_STATE_RESIZING;
+    queue_xdg_toplevel_configure(toplevel, width, height, states);
 
-  int i;
-  
-  for (i = 0; i < NB_SURFACE_MAX; ++i) {
-
-    if (surfaces[i].id == egl_window) {
-	  
-      break;
-    }
-  }
-
-  if (i < NB_SURFACE_MAX) {
-
-    emscripten_log(EM_LOG_CONSOLE, "--> wl_egl_window_resize: wl_surface found %d", i);
-
-    int j;
-
-    for (j = 0; j < NB_SURFACE_MAX; ++j) {
-
-      if (xdg_surfaces[j].wl_surface == &surfaces[i]) {
-
-	break;
-      }
-    }
-
-    if (j < NB_SURFACE_MAX) {
-
-      emscripten_log(EM_LOG_CONSOLE, "--> wl_egl_window_resize: xdg_surface found %d", j);
-
-      int k;
-
-      for (k = 0; k < NB_SURFACE_MAX; ++k) {
-
-	if (xdg_toplevels[k].xdg_surface == &xdg_surfaces[j]) {
-
-	  break;
-	}
-      }
-
-      if (k < NB_SURFACE_MAX) {
-
-	emscripten_log(EM_LOG_CONSOLE, "--> wl_egl_window_resize: send event: %d %d %d %d %d ", i , j, k, width, height);
-
-	send_event(&xdg_toplevels[k], "configure", width, height, states);
-
-	// TODO event not received immediately
-	send_event(xdg_toplevels[k].xdg_surface, "configure", 0);
-      }
-    }
+    // TODO event not received immediately
+    queue_xdg_surface_configure(toplevel->xdg_surface, 0);
   }
-
-  free(states);
 }
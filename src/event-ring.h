@@ -0,0 +1,30 @@
+#ifndef EXA_WAYLAND_EVENT_RING_H
+#define EXA_WAYLAND_EVENT_RING_H
+
+#include <stdint.h>
+
+/* Input and compositor events written by the JS glue, read by wl_display_dispatch.
+   head and tail are free running counters, records waiting for room stay in Module['wayland'].events */
+
+#define JS_EVENT_RING_SIZE 256 // records, must be a power of two
+
+struct js_event {
+
+  int32_t type;
+  int32_t args[4];
+  int32_t reserved;
+  double timestamp; // performance.now() when the JS glue produced the event
+};
+
+struct js_event_ring {
+
+  volatile uint32_t head;     // written by JS
+  uint32_t tail;              // written by C
+  uint32_t size;
+  volatile uint32_t overflow; // records kept in the JS overflow array
+  struct js_event records[JS_EVENT_RING_SIZE];
+};
+
+_Static_assert(sizeof(struct js_event) == 32, "the JS glue writes 8 words per record");
+
+#endif
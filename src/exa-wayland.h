@@ -0,0 +1,79 @@
+#ifndef EXA_WAYLAND_H
+#define EXA_WAYLAND_H
+
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Runtime statistics of the exa-wayland client library. Counters are always on
+   and only count, they never reset while the process runs */
+
+struct exa_wayland_stats {
+
+  // Protocol
+
+  uint32_t requests;          // marshalled by the client
+  uint32_t events;            // dispatched to a live proxy
+
+  // Event queue
+
+  uint32_t queue_size;
+  uint32_t queue_high_water;
+  uint32_t queue_overflows;
+  uint32_t queue_grows;
+  uint32_t events_coalesced;
+  uint32_t motions_dropped;
+  uint32_t events_lost;
+  uint32_t motions_merged;    // folded into a wl_pointer frame
+  uint32_t axes_merged;
+  uint32_t wakeups;
+  uint32_t wakeups_coalesced;
+
+  // JS crossings
+
+  uint32_t js_calls;          // C -> JS, emscripten_run_fun
+  uint32_t js_events;         // JS -> C, records read from the event ring
+  uint32_t js_ring_high_water;
+  uint32_t js_ring_refills;   // ring found full by JS, records kept aside
+
+  // Frames
+
+  uint32_t commits;           // buffers presented to the compositor
+  uint32_t frame_callbacks;
+  uint32_t frames_done;
+  uint32_t buffers_released;
+  uint32_t rows_converted;    // wl_shm pixels converted to RGBA for the canvas
+  uint32_t frames_unchanged;  // skipped by the tile change detection (EXA_WAYLAND_TILE_DIFF)
+  uint64_t upload_bytes_saved;
+
+  // Allocations
+
+  uint32_t objects_allocated;
+  uint32_t objects_in_use;
+  uint32_t arena_allocs;
+  uint32_t heap_allocs;       // malloc done by the event arena and the object pools
+};
+
+int exa_wayland_get_stats(struct exa_wayland_stats * stats);
+
+// Per opcode counts, index runs from 0 until NULL is returned
+
+const char * exa_wayland_get_interface_stats(int index, const uint32_t ** requests, uint32_t * nb_requests, const uint32_t ** events, uint32_t * nb_events);
+
+const char * exa_wayland_get_pool_stats(int index, unsigned int * in_use, unsigned int * capacity, unsigned int * high_water);
+
+// Text dump, one "name value" per line. Also written at disconnect to the file named by EXA_WAYLAND_STATS
+
+int exa_wayland_dump_stats(int fd);
+
+// Chrome trace event JSON of the input to photon timeline, when EXA_WAYLAND_TRACE names the output file
+
+int exa_wayland_dump_trace(int fd);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
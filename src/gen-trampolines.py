@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+
+# Generates the typed event trampolines of client.c from the protocol XMLs given to wayland-scanner:
+#
+#  - queue_<interface>_<event>(proxy, args...): queues the event without going through a va_list
+#  - <interface>_<event>_call(): calls the listener with the exact argument types
+#  - event_trampoline_tables[]: the calls of each interface, indexed by event opcode
+#
+# usage: gen-trampolines.py protocol.xml... > build/exa-wayland-trampolines.h
+
+import sys
+import xml.etree.ElementTree as ET
+
+# wire type -> (signature letter, C type, wl_argument field)
+
+TYPES = {
+    'int': ('i', 'int32_t', 'i'),
+    'uint': ('u', 'uint32_t', 'u'),
+    'fixed': ('f', 'wl_fixed_t', 'f'),
+    'string': ('s', 'const char *', 's'),
+    'object': ('o', 'void *', 'o'),
+    'new_id': ('n', 'void *', 'o'),
+    'array': ('a', 'struct wl_array *', 'a'),
+    'fd': ('h', 'int32_t', 'h'),
+}
+
+RESERVED = { 'proxy', 'args', 'handler', 'data' }
+
+
+def arg_name(name):
+
+    return name + '_' if name in RESERVED else name
+
+
+def queue_function(out, interface, opcode, event):
+
+    name = '%s_%s' % (interface, event.get('name'))
+    args = event.findall('arg')
+
+    params = ''.join(', %s %s' % (TYPES[a.get('type')][1], arg_name(a.get('name'))) for a in args)
+
+    out.append('static inline void queue_%s(void * proxy%s) {\n' % (name, params))
+    out.append('\n')
+
+    if args:
+        out.append('  union wl_argument * args = event_push((struct wl_proxy *)proxy, %d);\n' % opcode)
+        out.append('\n')
+        out.append('  if (!args)\n')
+        out.append('    return;\n')
+        out.append('\n')
+
+        for i, a in enumerate(args):
+
+            letter, ctype, field = TYPES[a.get('type')]
+
+            if letter == 's':
+                out.append('  args[%d].s = event_string(%s);\n' % (i, arg_name(a.get('name'))))
+            elif letter in 'on':
+                out.append('  args[%d].o = (struct wl_object *)%s;\n' % (i, arg_name(a.get('name'))))
+            else:
+                out.append('  args[%d].%s = %s;\n' % (i, field, arg_name(a.get('name'))))
+
+        out.append('\n')
+    else:
+        out.append('  if (!event_push((struct wl_proxy *)proxy, %d))\n' % opcode)
+        out.append('    return;\n')
+        out.append('\n')
+
+    out.append('  event_notify();\n')
+    out.append('}\n\n')
+
+
+def call_function(out, interface, event):
+
+    name = '%s_%s' % (interface, event.get('name'))
+    args = event.findall('arg')
+
+    types = ''.join(', %s' % TYPES[a.get('type')][1] for a in args)
+    values = ''.join(', (%s)args[%d].%s' % (TYPES[a.get('type')][1], i, TYPES[a.get('type')][2]) for i, a in enumerate(args))
+
+    out.append('static void %s_call(void (*handler)(void), void * data, struct wl_proxy * proxy, const union wl_argument * args) {\n' % name)
+    out.append('\n')
+    out.append('  ((void (*)(void *, void *%s))handler)(data, proxy%s);\n' % (types, values))
+    out.append('}\n\n')
+
+
+def main():
+
+    out = []
+    tables = []
+
+    out.append('/* Generated by gen-trampolines.py from %s, do not edit */\n\n' % ' '.join(sys.argv[1:]))
+
+    for path in sys.argv[1:]:
+
+        protocol = ET.parse(path).getroot()
+
+        for interface in protocol.findall('interface'):
+
+            name = interface.get('name')
+            events = interface.findall('event')
+
+            if not events:
+                continue
+
+            out.append('// %s\n\n' % name)
+
+            for opcode, event in enumerate(events):
+                queue_function(out, name, opcode, event)
+                call_function(out, name, event)
+
+            out.append('static const event_trampoline %s_event_trampolines[] = {\n\n' % name)
+
+            for event in events:
+                out.append('  %s_%s_call,\n' % (name, event.get('name')))
+
+            out.append('};\n\n')
+
+            tables.append(name)
+
+    out.append('static const struct event_trampoline_table event_trampoline_tables[] = {\n\n')
+
+    for name in tables:
+        out.append('  { "%s", %s_event_trampolines, sizeof(%s_event_trampolines)/sizeof(%s_event_trampolines[0]) },\n' % (name, name, name, name))
+
+    out.append('};\n')
+
+    sys.stdout.write(''.join(out))
+
+
+if __name__ == '__main__':
+    main()
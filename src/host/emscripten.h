@@ -0,0 +1,18 @@
+#ifndef EXA_WAYLAND_HOST_EMSCRIPTEN_H
+#define EXA_WAYLAND_HOST_EMSCRIPTEN_H
+
+/* Native stand-in for the part of the Emscripten API used by client.c, implemented by host.c.
+   The JS glue is never run: calls are recorded with their arguments, host.c plays their effects on
+   the glue state and the event ring is fed by the host */
+
+#define EM_LOG_CONSOLE 1
+
+int emscripten_load_fun(const char * fun, const char * sig);
+
+int emscripten_run_fun(int handle, ...);
+
+void emscripten_log(int flags, const char * format, ...);
+
+double emscripten_get_now(void);
+
+#endif
@@ -0,0 +1,291 @@
+#define _DEFAULT_SOURCE
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "emscripten.h"
+#include "event-ring.h"
+#include "host.h"
+
+#define HOST_FUNS_MAX 256
+#define HOST_SHM_MAX 64
+#define HOST_SHM_FD 0x7f000000 // first shm fd of exa, as in Module['shm'].fds[fd-0x7f000000]
+
+/* What a JS function does to the glue state, found in its script when it is loaded: the
+   statements are the ones of client.c, $n being the argument n */
+
+struct host_fun {
+
+  const char * fun;
+  const char * sig;
+  unsigned int calls;
+  int ring_arg;        // Module['wayland'].ring = $n
+  int replay_arg;      // Module['wayland'].replay = $n
+  int shm_arg;         // returns Module['shm'].fds[$n-0x7f000000].mem
+  int creates_surface; // returns the id of the canvas pushed in Module['surfaces']
+};
+
+struct host_shm {
+
+  void * mem;
+  int size;
+};
+
+static struct host_fun funs[HOST_FUNS_MAX];
+static int nb_funs = 0;
+
+static struct host_call calls[HOST_CALLS_MAX];
+static unsigned long nb_calls = 0;
+
+static struct js_event_ring * ring = NULL;
+static int replay = 0;
+static int nb_surfaces = 0;
+
+static struct host_shm shms[HOST_SHM_MAX];
+static int nb_shms = 0;
+
+static struct host_counters counters;
+
+// Index of the argument assigned or indexed after statement, -1 when the script does not contain it
+
+static int script_arg(const char * fun, const char * statement) {
+
+  const char * s = strstr(fun, statement);
+
+  if (!s || (s[strlen(statement)] != '$'))
+    return -1;
+
+  return atoi(s + strlen(statement) + 1);
+}
+
+int emscripten_load_fun(const char * fun, const char * sig) {
+
+  if (nb_funs >= HOST_FUNS_MAX)
+    return -1;
+
+  struct host_fun * f = &funs[nb_funs];
+
+  f->fun = fun;
+  f->sig = sig;
+  f->ring_arg = script_arg(fun, "Module['wayland'].ring = ");
+  f->replay_arg = script_arg(fun, "Module['wayland'].replay = ");
+  f->shm_arg = script_arg(fun, "Module['shm'].fds[");
+  f->creates_surface = (strstr(fun, "Module['surfaces'].push(") != NULL);
+
+  return nb_funs++;
+}
+
+// The script is not run: the call is recorded with its arguments and its effects on the glue state are played
+
+int emscripten_run_fun(int handle, ...) {
+
+  ++counters.js_calls;
+
+  if ( (handle < 0) || (handle >= nb_funs) )
+    return 0;
+
+  struct host_fun * f = &funs[handle];
+  struct host_call * call = &calls[nb_calls++ & (HOST_CALLS_MAX - 1)];
+
+  ++f->calls;
+
+  call->handle = handle;
+  call->nb_args = 0;
+
+  va_list ap;
+
+  va_start(ap, handle);
+
+  for (const char * c = f->sig + 1; *c && (call->nb_args < HOST_ARGS_MAX); ++c) {
+
+    switch (*c) {
+
+    case 'j':
+      call->args[call->nb_args++].i = va_arg(ap, int64_t);
+      break;
+    case 'p':
+      call->args[call->nb_args++].i = (intptr_t)va_arg(ap, void *);
+      break;
+    case 'f':
+    case 'd':
+      call->args[call->nb_args++].d = va_arg(ap, double);
+      break;
+    default:
+      call->args[call->nb_args++].i = va_arg(ap, int);
+      break;
+    }
+  }
+
+  va_end(ap);
+
+  if ( (f->ring_arg >= 0) && (f->ring_arg < call->nb_args) )
+    ring = (struct js_event_ring *)(intptr_t)call->args[f->ring_arg].i;
+
+  if ( (f->replay_arg >= 0) && (f->replay_arg < call->nb_args) )
+    replay = (int)call->args[f->replay_arg].i; // live events are dropped while replaying
+
+  if (f->creates_surface)
+    return ++nb_surfaces;
+
+  if ( (f->shm_arg >= 0) && (f->shm_arg < call->nb_args) ) {
+
+    int64_t index = call->args[f->shm_arg].i - HOST_SHM_FD;
+
+    return ( (index >= 0) && (index < nb_shms) )?(int)(intptr_t)shms[index].mem:0;
+  }
+
+  return 0;
+}
+
+int host_shm_create(int size, void ** mem) {
+
+  if ( (size <= 0) || (nb_shms >= HOST_SHM_MAX) )
+    return -1;
+
+#ifdef MAP_32BIT
+  void * m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#else
+  void * m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#endif
+
+  if (m == MAP_FAILED)
+    return -1;
+
+  if ((uintptr_t)m + size > UINT32_MAX) {
+
+    munmap(m, size);
+    return -1;
+  }
+
+  shms[nb_shms].mem = m;
+  shms[nb_shms].size = size;
+
+  *mem = m;
+
+  return HOST_SHM_FD + nb_shms++;
+}
+
+void emscripten_log(int flags, const char * format, ...) {
+
+  va_list ap;
+
+  va_start(ap, format);
+  vfprintf(stderr, format, ap);
+  va_end(ap);
+
+  fputc('\n', stderr);
+}
+
+double emscripten_get_now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int host_push_event(int type, int arg1, int arg2, int arg3) {
+
+  if (replay)
+    return 0;
+
+  if (!ring || ((ring->head - ring->tail) >= ring->size))
+    return -1;
+
+  struct js_event * record = &ring->records[ring->head & (ring->size - 1)];
+
+  record->type = type;
+  record->args[0] = arg1;
+  record->args[1] = arg2;
+  record->args[2] = arg3;
+  record->args[3] = 0;
+  record->timestamp = emscripten_get_now();
+
+  ++ring->head;
+
+  return 0;
+}
+
+void host_get_counters(struct host_counters * c) {
+
+  *c = counters;
+}
+
+const struct host_call * host_get_call(unsigned int age) {
+
+  if ( (age >= HOST_CALLS_MAX) || (age >= nb_calls) )
+    return NULL;
+
+  return &calls[(nb_calls - 1 - age) & (HOST_CALLS_MAX - 1)];
+}
+
+void host_dump_calls(FILE * f) {
+
+  for (int i = 0; i < nb_funs; ++i)
+    fprintf(f, "%8u %-12s %.60s\n", funs[i].calls, funs[i].sig, funs[i].fun);
+
+  fprintf(f, "latest calls:\n");
+
+  for (int age = HOST_CALLS_MAX - 1; age >= 0; --age) {
+
+    const struct host_call * call = host_get_call(age);
+
+    if (!call)
+      continue;
+
+    fprintf(f, "%4d (", call->handle);
+
+    for (int i = 0; i < call->nb_args; ++i) {
+
+      char c = funs[call->handle].sig[i+1];
+
+      if ( (c == 'f') || (c == 'd') )
+	fprintf(f, "%s%g", (i)?", ":"", call->args[i].d);
+      else if (c == 'p')
+	fprintf(f, "%s0x%llx", (i)?", ":"", (unsigned long long)call->args[i].i);
+      else
+	fprintf(f, "%s%lld", (i)?", ":"", (long long)call->args[i].i);
+    }
+
+    fprintf(f, ") %.40s\n", funs[call->handle].fun);
+  }
+}
+
+// Allocations of client.c, linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t nmemb, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+void __real_free(void * ptr);
+
+void * __wrap_malloc(size_t size) {
+
+  ++counters.mallocs;
+  return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t nmemb, size_t size) {
+
+  ++counters.mallocs;
+  return __real_calloc(nmemb, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size) {
+
+  ++counters.mallocs;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void * ptr) {
+
+  if (ptr)
+    ++counters.frees;
+
+  __real_free(ptr);
+}
@@ -0,0 +1,54 @@
+#ifndef EXA_WAYLAND_HOST_H
+#define EXA_WAYLAND_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Script side of the native host: plays the role of the JS glue. client.c is built unchanged,
+   what the glue keeps in Module (the event ring and replay flag given to wl_display_connect,
+   the canvases, the shm pools) is taken from the arguments of the emscripten_run_fun calls */
+
+#define HOST_ARGS_MAX 12
+#define HOST_CALLS_MAX 64 // latest calls recorded, power of two
+
+struct host_counters {
+
+  unsigned long js_calls;
+  unsigned long mallocs; // malloc, calloc and realloc done by client.c
+  unsigned long frees;
+};
+
+// A JS function run by client.c, with its arguments as read from its signature
+
+struct host_call {
+
+  int handle;
+  int nb_args;
+  union {
+
+    int64_t i; // i, j and p
+    double d;  // f and d
+  } args[HOST_ARGS_MAX];
+};
+
+// Writes a record in the event ring handed over by wl_display_connect, as Module['wayland'].writeEvent does
+
+int host_push_event(int type, int arg1, int arg2, int arg3);
+
+/* Shared memory of size bytes for wl_shm.create_pool, as Module['shm'].fds holds it: returns the
+   fd, in the range of the exa shm fds, and the memory in *mem. The heap is 32 bits for client.c,
+   the memory is mapped below 4 GB. -1 when it cannot */
+
+int host_shm_create(int size, void ** mem);
+
+void host_get_counters(struct host_counters * counters);
+
+// Calls of the latest first, NULL beyond the ones recorded
+
+const struct host_call * host_get_call(unsigned int age);
+
+// Number of calls of each JS function, i.e. the requests that reached the compositor, and the latest ones
+
+void host_dump_calls(FILE * f);
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef EXA_WAYLAND_PIXEL_H
+#define EXA_WAYLAND_PIXEL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+/* Conversion of wl_shm pixels to the straight alpha RGBA wanted by ImageData.
+
+   wl_shm formats are little endian words: ARGB8888 is B, G, R, A in memory and ABGR8888
+   is R, G, B, A, both with premultiplied alpha. Each kernel has a scalar reference; the
+   wasm SIMD one (built with -msimd128) gives exactly the same bytes, see test/pixel-test.c */
+
+#define PIXEL_FORMAT_ARGB8888 0          // WL_SHM_FORMAT_ARGB8888
+#define PIXEL_FORMAT_XRGB8888 1          // WL_SHM_FORMAT_XRGB8888
+#define PIXEL_FORMAT_ABGR8888 0x34324241 // WL_SHM_FORMAT_ABGR8888
+#define PIXEL_FORMAT_XBGR8888 0x34324258 // WL_SHM_FORMAT_XBGR8888
+
+enum pixel_kernel {
+
+  PIXEL_KERNEL_COPY = 0,  // other formats are copied as is
+  PIXEL_KERNEL_ARGB8888,  // swizzle and un-premultiply
+  PIXEL_KERNEL_XRGB8888,  // swizzle and opaque alpha
+  PIXEL_KERNEL_ABGR8888,  // un-premultiply
+  PIXEL_KERNEL_XBGR8888,  // opaque alpha
+  NB_PIXEL_KERNELS,
+};
+
+typedef void (*pixel_row_kernel)(uint8_t * dst, const uint8_t * src, int width);
+
+static inline enum pixel_kernel pixel_kernel_from_format(uint32_t format) {
+
+  switch (format) {
+
+  case PIXEL_FORMAT_ARGB8888:
+    return PIXEL_KERNEL_ARGB8888;
+  case PIXEL_FORMAT_XRGB8888:
+    return PIXEL_KERNEL_XRGB8888;
+  case PIXEL_FORMAT_ABGR8888:
+    return PIXEL_KERNEL_ABGR8888;
+  case PIXEL_FORMAT_XBGR8888:
+    return PIXEL_KERNEL_XBGR8888;
+  default:
+    return PIXEL_KERNEL_COPY;
+  }
+}
+
+// Un-premultiply as (c * reciprocal[a] + 0.5) >> 16 with reciprocal[a] = 255 * 65536 / a: 32 bits products,
+// at most 1 away from the exact rounding. The table is constant, no initialization is needed
+
+#define PIXEL_RECIPROCAL(a) (((a)?(255u * 65536 + (a) / 2):0) / ((a) + !(a)))
+#define PIXEL_RECIPROCALS4(a) PIXEL_RECIPROCAL(a), PIXEL_RECIPROCAL(a + 1), PIXEL_RECIPROCAL(a + 2), PIXEL_RECIPROCAL(a + 3)
+#define PIXEL_RECIPROCALS16(a) PIXEL_RECIPROCALS4(a), PIXEL_RECIPROCALS4(a + 4), PIXEL_RECIPROCALS4(a + 8), PIXEL_RECIPROCALS4(a + 12)
+#define PIXEL_RECIPROCALS64(a) PIXEL_RECIPROCALS16(a), PIXEL_RECIPROCALS16(a + 16), PIXEL_RECIPROCALS16(a + 32), PIXEL_RECIPROCALS16(a + 48)
+
+static const uint32_t pixel_reciprocals[256] = {
+
+  PIXEL_RECIPROCALS64(0), PIXEL_RECIPROCALS64(64), PIXEL_RECIPROCALS64(128), PIXEL_RECIPROCALS64(192)
+};
+
+static inline uint8_t pixel_unpremultiply(uint32_t c, uint32_t a) {
+
+  uint32_t v = (c * pixel_reciprocals[a] + 0x8000) >> 16;
+
+  return (v > 255)?255:v; // c > a in a malformed buffer
+}
+
+// Scalar reference kernels
+
+static inline void pixel_row_copy(uint8_t * dst, const uint8_t * src, int width) {
+
+  memcpy(dst, src, (size_t)width * 4);
+}
+
+static inline void pixel_row_argb8888_scalar(uint8_t * dst, const uint8_t * src, int width) {
+
+  for (int i = 0; i < width; ++i, src += 4, dst += 4) {
+
+    uint32_t a = src[3];
+
+    if (a == 255) { // the same as un-premultiplying
+
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+    }
+    else {
+
+      dst[0] = pixel_unpremultiply(src[2], a);
+      dst[1] = pixel_unpremultiply(src[1], a);
+      dst[2] = pixel_unpremultiply(src[0], a);
+    }
+
+    dst[3] = a;
+  }
+}
+
+static inline void pixel_row_xrgb8888_scalar(uint8_t * dst, const uint8_t * src, int width) {
+
+  for (int i = 0; i < width; ++i, src += 4, dst += 4) {
+
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst[3] = 255;
+  }
+}
+
+static inline void pixel_row_abgr8888_scalar(uint8_t * dst, const uint8_t * src, int width) {
+
+  for (int i = 0; i < width; ++i, src += 4, dst += 4) {
+
+    uint32_t a = src[3];
+
+    if (a == 255) {
+
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+    }
+    else {
+
+      dst[0] = pixel_unpremultiply(src[0], a);
+      dst[1] = pixel_unpremultiply(src[1], a);
+      dst[2] = pixel_unpremultiply(src[2], a);
+    }
+
+    dst[3] = a;
+  }
+}
+
+static inline void pixel_row_xbgr8888_scalar(uint8_t * dst, const uint8_t * src, int width) {
+
+  for (int i = 0; i < width; ++i, src += 4, dst += 4) {
+
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+    dst[3] = 255;
+  }
+}
+
+static const pixel_row_kernel pixel_scalar_kernels[NB_PIXEL_KERNELS] = {
+
+  [PIXEL_KERNEL_COPY] = pixel_row_copy,
+  [PIXEL_KERNEL_ARGB8888] = pixel_row_argb8888_scalar,
+  [PIXEL_KERNEL_XRGB8888] = pixel_row_xrgb8888_scalar,
+  [PIXEL_KERNEL_ABGR8888] = pixel_row_abgr8888_scalar,
+  [PIXEL_KERNEL_XBGR8888] = pixel_row_xbgr8888_scalar,
+};
+
+#ifdef __wasm_simd128__
+
+// 4 pixels per vector, the remaining ones go through the scalar kernel
+
+#define PIXEL_SWIZZLE(v) wasm_i8x16_shuffle(v, v, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+
+static inline int pixel_opaque4(v128_t v) {
+
+  const v128_t alpha = wasm_i32x4_splat(0xff000000);
+
+  return wasm_i32x4_all_true(wasm_i32x4_eq(wasm_v128_and(v, alpha), alpha));
+}
+
+// v is R, G, B, A: one 32 bits lane per pixel, the alpha lookups are scalar as there is no gather
+
+static inline v128_t pixel_unpremultiply4(v128_t v) {
+
+  const v128_t byte = wasm_i32x4_splat(0xff);
+  const v128_t round = wasm_i32x4_splat(0x8000);
+
+  v128_t reciprocal = wasm_i32x4_make(pixel_reciprocals[wasm_u8x16_extract_lane(v, 3)],
+				      pixel_reciprocals[wasm_u8x16_extract_lane(v, 7)],
+				      pixel_reciprocals[wasm_u8x16_extract_lane(v, 11)],
+				      pixel_reciprocals[wasm_u8x16_extract_lane(v, 15)]);
+
+  v128_t r = wasm_v128_and(v, byte);
+  v128_t g = wasm_v128_and(wasm_u32x4_shr(v, 8), byte);
+  v128_t b = wasm_v128_and(wasm_u32x4_shr(v, 16), byte);
+
+  r = wasm_u32x4_min(wasm_u32x4_shr(wasm_i32x4_add(wasm_i32x4_mul(r, reciprocal), round), 16), byte);
+  g = wasm_u32x4_min(wasm_u32x4_shr(wasm_i32x4_add(wasm_i32x4_mul(g, reciprocal), round), 16), byte);
+  b = wasm_u32x4_min(wasm_u32x4_shr(wasm_i32x4_add(wasm_i32x4_mul(b, reciprocal), round), 16), byte);
+
+  return wasm_v128_or(wasm_v128_or(r, wasm_i32x4_shl(g, 8)), wasm_v128_or(wasm_i32x4_shl(b, 16), wasm_v128_andnot(v, wasm_i32x4_splat(0x00ffffff))));
+}
+
+static inline void pixel_row_argb8888_simd(uint8_t * dst, const uint8_t * src, int width) {
+
+  int i = 0;
+
+  for (; i + 4 <= width; i += 4) {
+
+    v128_t v = PIXEL_SWIZZLE(wasm_v128_load(src + i * 4));
+
+    if (!pixel_opaque4(v))
+      v = pixel_unpremultiply4(v);
+
+    wasm_v128_store(dst + i * 4, v);
+  }
+
+  pixel_row_argb8888_scalar(dst + i * 4, src + i * 4, width - i);
+}
+
+static inline void pixel_row_xrgb8888_simd(uint8_t * dst, const uint8_t * src, int width) {
+
+  const v128_t alpha = wasm_i32x4_splat(0xff000000);
+
+  int i = 0;
+
+  for (; i + 4 <= width; i += 4)
+    wasm_v128_store(dst + i * 4, wasm_v128_or(PIXEL_SWIZZLE(wasm_v128_load(src + i * 4)), alpha));
+
+  pixel_row_xrgb8888_scalar(dst + i * 4, src + i * 4, width - i);
+}
+
+static inline void pixel_row_abgr8888_simd(uint8_t * dst, const uint8_t * src, int width) {
+
+  int i = 0;
+
+  for (; i + 4 <= width; i += 4) {
+
+    v128_t v = wasm_v128_load(src + i * 4);
+
+    if (!pixel_opaque4(v))
+      v = pixel_unpremultiply4(v);
+
+    wasm_v128_store(dst + i * 4, v);
+  }
+
+  pixel_row_abgr8888_scalar(dst + i * 4, src + i * 4, width - i);
+}
+
+static inline void pixel_row_xbgr8888_simd(uint8_t * dst, const uint8_t * src, int width) {
+
+  const v128_t alpha = wasm_i32x4_splat(0xff000000);
+
+  int i = 0;
+
+  for (; i + 4 <= width; i += 4)
+    wasm_v128_store(dst + i * 4, wasm_v128_or(wasm_v128_load(src + i * 4), alpha));
+
+  pixel_row_xbgr8888_scalar(dst + i * 4, src + i * 4, width - i);
+}
+
+static const pixel_row_kernel pixel_kernels[NB_PIXEL_KERNELS] = {
+
+  [PIXEL_KERNEL_COPY] = pixel_row_copy,
+  [PIXEL_KERNEL_ARGB8888] = pixel_row_argb8888_simd,
+  [PIXEL_KERNEL_XRGB8888] = pixel_row_xrgb8888_simd,
+  [PIXEL_KERNEL_ABGR8888] = pixel_row_abgr8888_simd,
+  [PIXEL_KERNEL_XBGR8888] = pixel_row_xbgr8888_simd,
+};
+
+#else
+
+#define pixel_kernels pixel_scalar_kernels
+
+#endif
+
+// Compare of size bytes, for the tile change detection of client.c
+
+#ifdef __wasm_simd128__
+
+static inline int pixel_equal(const uint8_t * a, const uint8_t * b, int size) {
+
+  v128_t diff = wasm_i32x4_splat(0);
+
+  int i = 0;
+
+  for (; i + 16 <= size; i += 16)
+    diff = wasm_v128_or(diff, wasm_v128_xor(wasm_v128_load(a + i), wasm_v128_load(b + i)));
+
+  return !wasm_v128_any_true(diff) && (memcmp(a + i, b + i, size - i) == 0);
+}
+
+#else
+
+static inline int pixel_equal(const uint8_t * a, const uint8_t * b, int size) {
+
+  return memcmp(a, b, size) == 0;
+}
+
+#endif
+
+// Rows [y0, y1) of a buffer, dst is packed RGBA
+
+static inline void pixel_convert(enum pixel_kernel kernel, uint8_t * dst, const uint8_t * src, int src_stride, int width, int y0, int y1) {
+
+  pixel_row_kernel row = pixel_kernels[kernel];
+
+  for (int y = y0; y < y1; ++y)
+    row(dst + (size_t)y * width * 4, src + (size_t)y * src_stride, width);
+}
+
+#endif
@@ -0,0 +1,550 @@
+#ifndef EXA_WAYLAND_REGION_H
+#define EXA_WAYLAND_REGION_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Regions as y-x banded rectangles, the pixman representation: boxes are sorted by y then x,
+   the boxes of a band share the same y1 and y2 and never touch, bands never overlap and two
+   touching bands never have the same x spans (they are coalesced). The set of boxes is then
+   the smallest one of this form, see test/region-test.c
+
+   A zeroed struct region is empty. Operations return -1 when out of memory, leaving the
+   destination unchanged */
+
+struct region_box {
+
+  int32_t x1, y1, x2, y2; // x2 and y2 excluded
+};
+
+struct region {
+
+  struct region_box extents;
+  int nb_boxes;
+  int size;                 // allocated boxes
+  struct region_box * boxes;
+};
+
+enum region_op {
+
+  REGION_OP_UNION = 0,
+  REGION_OP_INTERSECT,
+  REGION_OP_SUBTRACT,
+};
+
+static inline int region_empty(const struct region * region) {
+
+  return region->nb_boxes == 0;
+}
+
+static inline void region_clear(struct region * region) {
+
+  region->nb_boxes = 0;
+  region->extents = (struct region_box){ 0, 0, 0, 0 };
+}
+
+static inline void region_fini(struct region * region) {
+
+  free(region->boxes);
+  memset(region, 0, sizeof(*region));
+}
+
+static inline int region_reserve(struct region * region, int size) {
+
+  if (size <= region->size)
+    return 0;
+
+  int new_size = (region->size)?region->size * 2:4;
+
+  while (new_size < size)
+    new_size *= 2;
+
+  struct region_box * boxes = (struct region_box *)realloc(region->boxes, new_size * sizeof(struct region_box));
+
+  if (!boxes)
+    return -1;
+
+  region->boxes = boxes;
+  region->size = new_size;
+
+  return 0;
+}
+
+// Rectangle from the x, y, width, height of the protocol, clamped instead of overflowing
+
+static inline struct region_box region_box_make(int32_t x, int32_t y, int32_t width, int32_t height) {
+
+  int32_t x2 = (x > INT32_MAX - width)?INT32_MAX:x + width;
+  int32_t y2 = (y > INT32_MAX - height)?INT32_MAX:y + height;
+
+  return (struct region_box){ x, y, x2, y2 };
+}
+
+static inline int region_set_box(struct region * region, struct region_box box) {
+
+  if ( (box.x1 >= box.x2) || (box.y1 >= box.y2) ) {
+
+    region_clear(region);
+    return 0;
+  }
+
+  if (region_reserve(region, 1) < 0)
+    return -1;
+
+  region->boxes[0] = box;
+  region->nb_boxes = 1;
+  region->extents = box;
+
+  return 0;
+}
+
+static inline int region_copy(struct region * dst, const struct region * src) {
+
+  if (dst == src)
+    return 0;
+
+  if (region_reserve(dst, src->nb_boxes) < 0)
+    return -1;
+
+  if (src->nb_boxes)
+    memcpy(dst->boxes, src->boxes, src->nb_boxes * sizeof(struct region_box));
+
+  dst->nb_boxes = src->nb_boxes;
+  dst->extents = src->extents;
+
+  return 0;
+}
+
+static inline void region_translate(struct region * region, int32_t dx, int32_t dy) {
+
+  if (region_empty(region))
+    return;
+
+  for (int i = 0; i < region->nb_boxes; ++i) {
+
+    region->boxes[i].x1 += dx;
+    region->boxes[i].x2 += dx;
+    region->boxes[i].y1 += dy;
+    region->boxes[i].y2 += dy;
+  }
+
+  region->extents.x1 += dx;
+  region->extents.x2 += dx;
+  region->extents.y1 += dy;
+  region->extents.y2 += dy;
+}
+
+// Index past the band starting at boxes[i]
+
+static inline int region_band_end(const struct region_box * boxes, int nb_boxes, int i) {
+
+  int y1 = boxes[i].y1;
+
+  while ( (i < nb_boxes) && (boxes[i].y1 == y1) )
+    ++i;
+
+  return i;
+}
+
+// Append a span to the band starting at band_start, merged with the last one if they overlap or touch
+
+static inline int region_append_span(struct region * out, int * band_start, int32_t x1, int32_t x2, int32_t y1, int32_t y2) {
+
+  if (x1 >= x2)
+    return 0;
+
+  if ( (out->nb_boxes > *band_start) && (out->boxes[out->nb_boxes-1].x2 >= x1) ) {
+
+    if (out->boxes[out->nb_boxes-1].x2 < x2)
+      out->boxes[out->nb_boxes-1].x2 = x2;
+
+    return 0;
+  }
+
+  if (region_reserve(out, out->nb_boxes + 1) < 0)
+    return -1;
+
+  out->boxes[out->nb_boxes++] = (struct region_box){ x1, y1, x2, y2 };
+
+  return 0;
+}
+
+// The band starting at band_start is merged into the previous one when they touch and have the same spans
+
+static inline void region_coalesce(struct region * out, int * prev_band, int band_start) {
+
+  int n = out->nb_boxes - band_start;
+
+  if ( (n > 0) && (*prev_band >= 0) && (band_start - *prev_band == n) && (out->boxes[*prev_band].y2 == out->boxes[band_start].y1) ) {
+
+    int same = 1;
+
+    for (int i = 0; (i < n) && same; ++i)
+      same = (out->boxes[*prev_band+i].x1 == out->boxes[band_start+i].x1) && (out->boxes[*prev_band+i].x2 == out->boxes[band_start+i].x2);
+
+    if (same) {
+
+      int32_t y2 = out->boxes[band_start].y2;
+
+      for (int i = 0; i < n; ++i)
+	out->boxes[*prev_band+i].y2 = y2;
+
+      out->nb_boxes = band_start;
+      return;
+    }
+  }
+
+  if (n > 0)
+    *prev_band = band_start;
+}
+
+// One band of the result: the x spans of a and b (either may be empty) combined by op
+
+static inline int region_op_band(struct region * out, enum region_op op, const struct region_box * a, int na, const struct region_box * b, int nb, int32_t y1, int32_t y2) {
+
+  int band_start = out->nb_boxes;
+  int i = 0, j = 0;
+
+  switch (op) {
+
+  case REGION_OP_UNION:
+
+    while ( (i < na) || (j < nb) ) {
+
+      const struct region_box * box = ( (j >= nb) || ((i < na) && (a[i].x1 <= b[j].x1)) )?&a[i++]:&b[j++];
+
+      if (region_append_span(out, &band_start, box->x1, box->x2, y1, y2) < 0)
+	return -1;
+    }
+
+    break;
+
+  case REGION_OP_INTERSECT:
+
+    while ( (i < na) && (j < nb) ) {
+
+      int32_t x1 = (a[i].x1 > b[j].x1)?a[i].x1:b[j].x1;
+      int32_t x2 = (a[i].x2 < b[j].x2)?a[i].x2:b[j].x2;
+
+      if (region_append_span(out, &band_start, x1, x2, y1, y2) < 0)
+	return -1;
+
+      if (a[i].x2 < b[j].x2)
+	++i;
+      else
+	++j;
+    }
+
+    break;
+
+  case REGION_OP_SUBTRACT:
+
+    for (; i < na; ++i) {
+
+      int32_t x1 = a[i].x1;
+
+      while ( (j < nb) && (b[j].x2 <= x1) )
+	++j;
+
+      for (int k = j; (k < nb) && (b[k].x1 < a[i].x2); ++k) {
+
+	if (region_append_span(out, &band_start, x1, b[k].x1, y1, y2) < 0)
+	  return -1;
+
+	if (b[k].x2 > x1)
+	  x1 = b[k].x2;
+      }
+
+      if (region_append_span(out, &band_start, x1, a[i].x2, y1, y2) < 0)
+	return -1;
+    }
+
+    break;
+  }
+
+  return 0;
+}
+
+static inline void region_update_extents(struct region * region) {
+
+  if (region_empty(region)) {
+
+    region_clear(region);
+    return;
+  }
+
+  struct region_box extents = { region->boxes[0].x1, region->boxes[0].y1, region->boxes[0].x2, region->boxes[region->nb_boxes-1].y2 };
+
+  for (int i = 0; i < region->nb_boxes; ++i) {
+
+    if (region->boxes[i].x1 < extents.x1)
+      extents.x1 = region->boxes[i].x1;
+    if (region->boxes[i].x2 > extents.x2)
+      extents.x2 = region->boxes[i].x2;
+  }
+
+  region->extents = extents;
+}
+
+/* dst = a op b, dst may be a or b. The y axis is cut where any band of a or b starts or ends,
+   each slice is then one band of the result */
+
+static inline int region_op(struct region * dst, const struct region * a, const struct region * b, enum region_op op) {
+
+  struct region out = { { 0, 0, 0, 0 }, 0, 0, NULL };
+
+  if (region_reserve(&out, a->nb_boxes + b->nb_boxes + 1) < 0)
+    return -1;
+
+  int ia = 0, ib = 0;
+  int prev_band = -1;
+
+  int32_t y = INT32_MIN;
+
+  while ( (ia < a->nb_boxes) || (ib < b->nb_boxes) ) {
+
+    // Bands already passed, then the current slice [y, next)
+
+    if ( (ia < a->nb_boxes) && (a->boxes[ia].y2 <= y) )
+      ia = region_band_end(a->boxes, a->nb_boxes, ia);
+
+    if ( (ib < b->nb_boxes) && (b->boxes[ib].y2 <= y) )
+      ib = region_band_end(b->boxes, b->nb_boxes, ib);
+
+    if ( (ia >= a->nb_boxes) && (ib >= b->nb_boxes) )
+      break;
+
+    int32_t next = INT32_MAX;
+
+    int a_in = 0, b_in = 0;
+
+    if (ia < a->nb_boxes) {
+
+      if (a->boxes[ia].y1 > y) {
+
+	next = a->boxes[ia].y1;
+      }
+      else {
+
+	a_in = 1;
+	next = a->boxes[ia].y2;
+      }
+    }
+
+    if (ib < b->nb_boxes) {
+
+      if (b->boxes[ib].y1 > y) {
+
+	if (b->boxes[ib].y1 < next)
+	  next = b->boxes[ib].y1;
+      }
+      else {
+
+	b_in = 1;
+
+	if (b->boxes[ib].y2 < next)
+	  next = b->boxes[ib].y2;
+      }
+    }
+
+    if ( a_in || b_in ) {
+
+      int na = (a_in)?region_band_end(a->boxes, a->nb_boxes, ia) - ia:0;
+      int nb = (b_in)?region_band_end(b->boxes, b->nb_boxes, ib) - ib:0;
+
+      int band_start = out.nb_boxes;
+
+      if (region_op_band(&out, op, a->boxes + ia, na, b->boxes + ib, nb, y, next) < 0) {
+
+	free(out.boxes);
+	return -1;
+      }
+
+      region_coalesce(&out, &prev_band, band_start);
+    }
+
+    y = next;
+  }
+
+  free(dst->boxes);
+
+  *dst = out;
+
+  region_update_extents(dst);
+
+  return 0;
+}
+
+static inline int region_union(struct region * dst, const struct region * a, const struct region * b) {
+
+  if (region_empty(a))
+    return region_copy(dst, b);
+
+  if (region_empty(b))
+    return region_copy(dst, a);
+
+  return region_op(dst, a, b, REGION_OP_UNION);
+}
+
+static inline int region_intersect(struct region * dst, const struct region * a, const struct region * b) {
+
+  if ( region_empty(a) || region_empty(b) || (a->extents.x2 <= b->extents.x1) || (b->extents.x2 <= a->extents.x1) ||
+       (a->extents.y2 <= b->extents.y1) || (b->extents.y2 <= a->extents.y1) ) {
+
+    region_clear(dst);
+    return 0;
+  }
+
+  return region_op(dst, a, b, REGION_OP_INTERSECT);
+}
+
+static inline int region_subtract(struct region * dst, const struct region * a, const struct region * b) {
+
+  if ( region_empty(a) || region_empty(b) || (a->extents.x2 <= b->extents.x1) || (b->extents.x2 <= a->extents.x1) ||
+       (a->extents.y2 <= b->extents.y1) || (b->extents.y2 <= a->extents.y1) )
+    return region_copy(dst, a);
+
+  return region_op(dst, a, b, REGION_OP_SUBTRACT);
+}
+
+// First box of the band of boxes[i]
+
+static inline int region_band_start(const struct region_box * boxes, int i) {
+
+  int y1 = boxes[i].y1;
+
+  while ( (i > 0) && (boxes[i-1].y1 == y1) )
+    --i;
+
+  return i;
+}
+
+/* Rectangle variants. Union has a fast path for a box in the last band or below all the
+   others, the way damage usually comes (scanlines, rows of tiles): it is appended in place */
+
+static inline int region_union_box(struct region * region, struct region_box box) {
+
+  if ( (box.x1 >= box.x2) || (box.y1 >= box.y2) )
+    return 0;
+
+  const struct region_box * e = &region->extents;
+
+  if ( region_empty(region) || ((box.x1 <= e->x1) && (box.y1 <= e->y1) && (box.x2 >= e->x2) && (box.y2 >= e->y2)) )
+    return region_set_box(region, box);
+
+  const struct region_box * last = &region->boxes[region->nb_boxes-1];
+
+  int below = (box.y1 >= last->y2);
+
+  if ( below || ((box.y1 == last->y1) && (box.y2 == last->y2) && (box.x1 >= last->x2)) ) {
+
+    int band_start = (below)?region->nb_boxes:region_band_start(region->boxes, region->nb_boxes - 1);
+    int prev_band = (band_start > 0)?region_band_start(region->boxes, band_start - 1):-1;
+
+    if (region_append_span(region, &band_start, box.x1, box.x2, box.y1, box.y2) < 0)
+      return -1;
+
+    region_coalesce(region, &prev_band, band_start);
+
+    if (box.x1 < region->extents.x1)
+      region->extents.x1 = box.x1;
+    if (box.x2 > region->extents.x2)
+      region->extents.x2 = box.x2;
+    if (box.y2 > region->extents.y2)
+      region->extents.y2 = box.y2;
+
+    return 0;
+  }
+
+  struct region rect = { box, 1, 1, &box };
+
+  return region_op(region, region, &rect, REGION_OP_UNION);
+}
+
+static inline int region_subtract_box(struct region * region, struct region_box box) {
+
+  if ( (box.x1 >= box.x2) || (box.y1 >= box.y2) )
+    return 0;
+
+  struct region rect = { box, 1, 1, &box };
+
+  return region_subtract(region, region, &rect);
+}
+
+static inline int region_intersect_box(struct region * region, struct region_box box) {
+
+  if ( (box.x1 >= box.x2) || (box.y1 >= box.y2) ) {
+
+    region_clear(region);
+    return 0;
+  }
+
+  const struct region_box * e = &region->extents;
+
+  if ( (box.x1 <= e->x1) && (box.y1 <= e->y1) && (box.x2 >= e->x2) && (box.y2 >= e->y2) )
+    return 0;
+
+  struct region rect = { box, 1, 1, &box };
+
+  return region_intersect(region, region, &rect);
+}
+
+// The box is entirely in the region. As spans are merged, one box of each band has to cover it
+
+static inline int region_contains_box(const struct region * region, struct region_box box) {
+
+  if ( (box.x1 >= box.x2) || (box.y1 >= box.y2) )
+    return 1;
+
+  int32_t y = box.y1;
+
+  for (int i = 0; i < region->nb_boxes; ) {
+
+    int end = region_band_end(region->boxes, region->nb_boxes, i);
+
+    if (region->boxes[i].y2 > y) {
+
+      if (region->boxes[i].y1 > y)
+	return 0;
+
+      int covered = 0;
+
+      for (int j = i; (j < end) && !covered; ++j)
+	covered = (region->boxes[j].x1 <= box.x1) && (region->boxes[j].x2 >= box.x2);
+
+      if (!covered)
+	return 0;
+
+      y = region->boxes[i].y2;
+
+      if (y >= box.y2)
+	return 1;
+    }
+
+    i = end;
+  }
+
+  return 0;
+}
+
+static inline int region_contains_point(const struct region * region, int32_t x, int32_t y) {
+
+  if ( (x < region->extents.x1) || (x >= region->extents.x2) || (y < region->extents.y1) || (y >= region->extents.y2) )
+    return 0;
+
+  for (int i = 0; i < region->nb_boxes; ++i) {
+
+    const struct region_box * box = &region->boxes[i];
+
+    if (box->y1 > y)
+      return 0;
+
+    if ( (y < box->y2) && (x >= box->x1) && (x < box->x2) )
+      return 1;
+  }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pixel.h"
+
+/* Golden test of the pixel conversion kernels (make test, or make test-wasm for the SIMD ones).
+   The golden image covers every (color, alpha) pair: pixel (x, y) has alpha y and color x,
+   including the malformed color > alpha */
+
+#define GOLDEN_SIZE 256
+
+static uint8_t src[GOLDEN_SIZE * GOLDEN_SIZE * 4];
+static uint8_t dst[GOLDEN_SIZE * GOLDEN_SIZE * 4];
+static uint8_t ref[GOLDEN_SIZE * GOLDEN_SIZE * 4];
+
+static const struct {
+
+  const char * name;
+  enum pixel_kernel kernel;
+  uint32_t hash; // FNV-1a of the converted golden image
+} kernels[] = {
+
+  { "copy", PIXEL_KERNEL_COPY, 0xcc8b55c5 },
+  { "argb8888", PIXEL_KERNEL_ARGB8888, 0xfb0103ea },
+  { "xrgb8888", PIXEL_KERNEL_XRGB8888, 0x37869dc5 },
+  { "abgr8888", PIXEL_KERNEL_ABGR8888, 0x76cfa96e },
+  { "xbgr8888", PIXEL_KERNEL_XBGR8888, 0xacc09dc5 },
+};
+
+// A few pixels by hand: source bytes in memory order, expected RGBA
+
+static const struct {
+
+  enum pixel_kernel kernel;
+  uint8_t src[4];
+  uint8_t rgba[4];
+} pixels[] = {
+
+  { PIXEL_KERNEL_ARGB8888, { 0x10, 0x20, 0x30, 0xff }, { 0x30, 0x20, 0x10, 0xff } },
+  { PIXEL_KERNEL_ARGB8888, { 0x40, 0x20, 0x00, 0x80 }, { 0x00, 0x40, 0x80, 0x80 } },
+  { PIXEL_KERNEL_ARGB8888, { 0x00, 0x00, 0x80, 0x80 }, { 0xff, 0x00, 0x00, 0x80 } },
+  { PIXEL_KERNEL_ARGB8888, { 0x12, 0x34, 0x56, 0x00 }, { 0x00, 0x00, 0x00, 0x00 } },
+  { PIXEL_KERNEL_ARGB8888, { 0x01, 0x01, 0x01, 0x01 }, { 0xff, 0xff, 0xff, 0x01 } },
+  { PIXEL_KERNEL_XRGB8888, { 0x10, 0x20, 0x30, 0x00 }, { 0x30, 0x20, 0x10, 0xff } },
+  { PIXEL_KERNEL_ABGR8888, { 0x40, 0x20, 0x00, 0x80 }, { 0x80, 0x40, 0x00, 0x80 } },
+  { PIXEL_KERNEL_XBGR8888, { 0x10, 0x20, 0x30, 0x42 }, { 0x10, 0x20, 0x30, 0xff } },
+};
+
+static uint32_t fnv1a(const uint8_t * data, size_t size) {
+
+  uint32_t hash = 0x811c9dc5;
+
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * 0x01000193;
+
+  return hash;
+}
+
+int main(int argc, char * argv[]) {
+
+  int failures = 0;
+
+  for (int y = 0; y < GOLDEN_SIZE; ++y) {
+
+    for (int x = 0; x < GOLDEN_SIZE; ++x) {
+
+      uint8_t * p = &src[(y * GOLDEN_SIZE + x) * 4];
+
+      p[0] = x;
+      p[1] = (x * 7) & 0xff;
+      p[2] = 255 - x;
+      p[3] = y;
+    }
+  }
+
+  for (unsigned int i = 0; i < sizeof(pixels)/sizeof(pixels[0]); ++i) {
+
+    uint8_t out[4];
+
+    pixel_convert(pixels[i].kernel, out, pixels[i].src, 4, 1, 0, 1);
+
+    if (memcmp(out, pixels[i].rgba, 4) != 0) {
+
+      printf("pixel %u: got %02x %02x %02x %02x, expected %02x %02x %02x %02x\n", i, out[0], out[1], out[2], out[3], pixels[i].rgba[0], pixels[i].rgba[1], pixels[i].rgba[2], pixels[i].rgba[3]);
+      ++failures;
+    }
+  }
+
+  for (unsigned int i = 0; i < sizeof(kernels)/sizeof(kernels[0]); ++i) {
+
+    enum pixel_kernel kernel = kernels[i].kernel;
+
+    memset(dst, 0, sizeof(dst));
+
+    pixel_convert(kernel, dst, src, GOLDEN_SIZE * 4, GOLDEN_SIZE, 0, GOLDEN_SIZE);
+
+    uint32_t hash = fnv1a(dst, sizeof(dst));
+
+    if (hash != kernels[i].hash) {
+
+      printf("%s: golden image hash %08x, expected %08x\n", kernels[i].name, hash, kernels[i].hash);
+      ++failures;
+    }
+
+    // Row tails and unaligned rows against the scalar reference
+
+    for (int width = 1; width <= 19; ++width) {
+
+      for (int offset = 0; offset < 4; ++offset) {
+
+	const uint8_t * row = src + (width * GOLDEN_SIZE + offset) * 4 + offset;
+
+	memset(dst, 0, width * 4 + 4);
+	memset(ref, 0, width * 4 + 4);
+
+	pixel_kernels[kernel](dst + offset, row, width);
+	pixel_scalar_kernels[kernel](ref + offset, row, width);
+
+	if (memcmp(dst, ref, width * 4 + 4) != 0) {
+
+	  printf("%s: width %d offset %d differs from the scalar kernel\n", kernels[i].name, width, offset);
+	  ++failures;
+	}
+      }
+    }
+  }
+
+  // Compare: equal buffers, then a single byte changed at each position
+
+  for (int size = 1; size <= 40; ++size) {
+
+    memcpy(dst, src, size);
+
+    if (!pixel_equal(dst, src, size)) {
+
+      printf("pixel_equal: %d equal bytes found different\n", size);
+      ++failures;
+    }
+
+    for (int i = 0; i < size; ++i) {
+
+      dst[i] ^= 0x10;
+
+      if (pixel_equal(dst, src, size)) {
+
+	printf("pixel_equal: byte %d of %d not found different\n", i, size);
+	++failures;
+      }
+
+      dst[i] ^= 0x10;
+    }
+  }
+
+  printf("pixel-test: %s%s\n", (failures)?"FAILED":"ok",
+#ifdef __wasm_simd128__
+	 " (simd128)"
+#else
+	 " (scalar)"
+#endif
+	 );
+
+  return (failures)?1:0;
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "region.h"
+
+/* Test of the banded region engine (make test). Random unions, intersections and subtractions
+   of rectangles are done on regions and on bitmaps of GRID_SIZE x GRID_SIZE cells, the regions
+   must cover the same cells and stay in the canonical banded form */
+
+#define GRID_SIZE 24
+#define NB_ROUNDS 2000
+#define NB_STEPS 12
+
+typedef uint8_t grid[GRID_SIZE][GRID_SIZE]; // [y][x]
+
+static uint32_t seed = 1;
+
+static int random_int(int n) {
+
+  seed = seed * 1103515245 + 12345;
+
+  return (seed >> 16) % n;
+}
+
+static struct region_box random_box(void) {
+
+  int x = random_int(GRID_SIZE) - 2, y = random_int(GRID_SIZE) - 2;
+
+  return region_box_make(x, y, random_int(GRID_SIZE / 2) + 1, random_int(GRID_SIZE / 2) + 1);
+}
+
+static void grid_box(grid g, struct region_box box, enum region_op op) {
+
+  for (int y = 0; y < GRID_SIZE; ++y) {
+
+    for (int x = 0; x < GRID_SIZE; ++x) {
+
+      int in = (x >= box.x1) && (x < box.x2) && (y >= box.y1) && (y < box.y2);
+
+      if (op == REGION_OP_UNION)
+	g[y][x] |= in;
+      else if (op == REGION_OP_INTERSECT)
+	g[y][x] &= in;
+      else
+	g[y][x] &= !in;
+    }
+  }
+}
+
+// Canonical form: sorted bands of non touching spans, extents, no bands left to coalesce
+
+static const char * region_check(const struct region * region) {
+
+  int band = 0, prev_band = -1;
+
+  while (band < region->nb_boxes) {
+
+    int end = region_band_end(region->boxes, region->nb_boxes, band);
+
+    for (int i = band; i < end; ++i) {
+
+      const struct region_box * box = &region->boxes[i];
+
+      if ( (box->x1 >= box->x2) || (box->y1 >= box->y2) )
+	return "empty box";
+      if (box->y2 != region->boxes[band].y2)
+	return "band of different heights";
+      if ( (i > band) && (box->x1 <= region->boxes[i-1].x2) )
+	return "spans not sorted or touching";
+      if ( (box->x1 < region->extents.x1) || (box->x2 > region->extents.x2) || (box->y1 < region->extents.y1) || (box->y2 > region->extents.y2) )
+	return "box out of the extents";
+    }
+
+    if (prev_band >= 0) {
+
+      const struct region_box * prev = &region->boxes[prev_band];
+
+      if (prev->y2 > region->boxes[band].y1)
+	return "bands overlapping";
+
+      if ( (prev->y2 == region->boxes[band].y1) && (band - prev_band == end - band) ) {
+
+	int same = 1;
+
+	for (int i = 0; i < end - band; ++i)
+	  same = same && (region->boxes[prev_band+i].x1 == region->boxes[band+i].x1) && (region->boxes[prev_band+i].x2 == region->boxes[band+i].x2);
+
+	if (same)
+	  return "bands not coalesced";
+      }
+    }
+
+    prev_band = band;
+    band = end;
+  }
+
+  if (region->nb_boxes) {
+
+    struct region_box e = region->extents;
+
+    if ( (e.y1 != region->boxes[0].y1) || (e.y2 != region->boxes[region->nb_boxes-1].y2) )
+      return "extents too large";
+  }
+
+  return NULL;
+}
+
+static int region_matches(const struct region * region, grid g) {
+
+  for (int y = -4; y < GRID_SIZE + 4; ++y) {
+
+    for (int x = -4; x < GRID_SIZE + 4; ++x) {
+
+      int in = (x >= 0) && (x < GRID_SIZE) && (y >= 0) && (y < GRID_SIZE) && g[y][x];
+
+      if (region_contains_point(region, x, y) != in)
+	return 0;
+    }
+  }
+
+  return 1;
+}
+
+int main(int argc, char * argv[]) {
+
+  int failures = 0;
+
+  for (int round = 0; (round < NB_ROUNDS) && (failures < 10); ++round) {
+
+    struct region region = { { 0, 0, 0, 0 }, 0, 0, NULL };
+    struct region other = { { 0, 0, 0, 0 }, 0, 0, NULL };
+
+    grid g, h;
+
+    memset(g, 0, sizeof(g));
+    memset(h, 0, sizeof(h));
+
+    // Cells are kept in [0, GRID_SIZE) by intersecting with the grid at the end of each step
+
+    struct region_box bounds = { 0, 0, GRID_SIZE, GRID_SIZE };
+
+    for (int step = 0; step < NB_STEPS; ++step) {
+
+      struct region_box box = random_box();
+
+      enum region_op op = (enum region_op)random_int(3);
+
+      if (step < 3)
+	op = REGION_OP_UNION;
+
+      switch (random_int(4)) {
+
+      case 0: // with a rectangle
+
+	grid_box(g, box, op);
+
+	if (op == REGION_OP_UNION)
+	  region_union_box(&region, box);
+	else if (op == REGION_OP_INTERSECT)
+	  region_intersect_box(&region, box);
+	else
+	  region_subtract_box(&region, box);
+
+	break;
+
+      case 1: // with another region
+
+	grid_box(h, box, REGION_OP_UNION);
+	region_union_box(&other, box);
+
+	for (int y = 0; y < GRID_SIZE; ++y) {
+
+	  for (int x = 0; x < GRID_SIZE; ++x) {
+
+	    if (op == REGION_OP_UNION)
+	      g[y][x] |= h[y][x];
+	    else if (op == REGION_OP_INTERSECT)
+	      g[y][x] &= h[y][x];
+	    else
+	      g[y][x] &= !h[y][x];
+	  }
+	}
+
+	if (op == REGION_OP_UNION)
+	  region_union(&region, &region, &other);
+	else if (op == REGION_OP_INTERSECT)
+	  region_intersect(&region, &region, &other);
+	else
+	  region_subtract(&region, &region, &other);
+
+	break;
+
+      case 2: // translated there and back
+
+	region_translate(&region, box.x1, box.y1);
+	region_translate(&region, -box.x1, -box.y1);
+
+	break;
+
+      case 3: // rows of spans from top to bottom, as damage comes
+
+	for (int y = box.y1; y < box.y2; y += 2) {
+
+	  for (int x = box.x1; x < box.x2; x += 3) {
+
+	    struct region_box span = { x, y, x + 2, y + 2 };
+
+	    grid_box(g, span, REGION_OP_UNION);
+	    region_union_box(&region, span);
+	  }
+	}
+
+	break;
+      }
+
+      region_intersect_box(&region, bounds);
+
+      const char * error = region_check(&region);
+
+      if (error) {
+
+	printf("round %d step %d: %s\n", round, step, error);
+	++failures;
+	break;
+      }
+
+      if (!region_matches(&region, g)) {
+
+	printf("round %d step %d: region differs from the bitmap\n", round, step);
+	++failures;
+	break;
+      }
+
+      // Covering: a random box is contained when all its cells are set
+
+      struct region_box test = random_box();
+
+      int contained = 1;
+
+      for (int y = test.y1; y < test.y2; ++y)
+	for (int x = test.x1; x < test.x2; ++x)
+	  contained = contained && (x >= 0) && (x < GRID_SIZE) && (y >= 0) && (y < GRID_SIZE) && g[y][x];
+
+      if (region_contains_box(&region, test) != contained) {
+
+	printf("round %d step %d: box %d,%d %d,%d contained %d, expected %d\n", round, step, test.x1, test.y1, test.x2, test.y2, !contained, contained);
+	++failures;
+	break;
+      }
+    }
+
+    region_fini(&region);
+    region_fini(&other);
+  }
+
+  printf("region-test: %s\n", (failures)?"FAILED":"ok");
+
+  return (failures)?1:0;
+}